@@ -1,5 +1,7 @@
 #include "driver/io-unix.h"
+#include "driver/io-uring.h"
 
+#include <algorithm>
 #include <sstream>
 
 namespace saw {
@@ -8,16 +10,35 @@ IFdOwner::IFdOwner(UnixEventPort &event_port, int file_descriptor, int fd_flags,
 				   uint32_t event_mask)
 	: event_port{event_port}, file_descriptor{file_descriptor},
 	  fd_flags{fd_flags}, event_mask{event_mask} {
-	event_port.subscribe(*this, file_descriptor, event_mask);
+	if (event_mask != 0) {
+		event_port.queueInterestChange(*this);
+	}
 }
 
 IFdOwner::~IFdOwner() {
 	if (file_descriptor >= 0) {
-		event_port.unsubscribe(file_descriptor);
+		event_port.unsubscribe(*this);
 		::close(file_descriptor);
 	}
 }
 
+void IFdOwner::setInterest(uint32_t mask) {
+	if (event_mask == mask) {
+		return;
+	}
+	event_mask = mask;
+	event_port.queueInterestChange(*this);
+}
+
+int IFdOwner::release() {
+	int released = file_descriptor;
+	if (file_descriptor >= 0) {
+		event_port.unsubscribe(*this);
+		file_descriptor = -1;
+	}
+	return released;
+}
+
 ssize_t unixRead(int fd, void *buffer, size_t length) {
 	return ::recv(fd, buffer, length, 0);
 }
@@ -26,14 +47,52 @@ ssize_t unixWrite(int fd, const void *buffer, size_t length) {
 	return ::send(fd, buffer, length, 0);
 }
 
+static_assert(sizeof(IoVector) == sizeof(struct ::iovec),
+			  "IoVector has to be layout compatible with iovec");
+static_assert(offsetof(IoVector, data) == offsetof(struct ::iovec, iov_base),
+			  "IoVector has to be layout compatible with iovec");
+static_assert(offsetof(IoVector, length) == offsetof(struct ::iovec, iov_len),
+			  "IoVector has to be layout compatible with iovec");
+
+ssize_t unixReadv(int fd, std::span<const IoVector> segments) {
+	int count = static_cast<int>(std::min<size_t>(segments.size(), IOV_MAX));
+	return ::readv(fd,
+				   reinterpret_cast<const struct ::iovec *>(segments.data()),
+				   count);
+}
+
+ssize_t unixWritev(int fd, std::span<const IoVector> segments) {
+	int count = static_cast<int>(std::min<size_t>(segments.size(), IOV_MAX));
+	return ::writev(fd,
+					reinterpret_cast<const struct ::iovec *>(segments.data()),
+					count);
+}
+
 UnixIoStream::UnixIoStream(UnixEventPort &event_port, int file_descriptor,
 						   int fd_flags, uint32_t event_mask)
-	: IFdOwner{event_port, file_descriptor, fd_flags, event_mask | EPOLLRDHUP} {
-}
+	: IFdOwner{event_port, file_descriptor, fd_flags, 0},
+	  allowed_events{event_mask | EPOLLRDHUP | EPOLLERR} {}
 
 ErrorOr<size_t> UnixIoStream::read(void *buffer, size_t length) {
 	ssize_t read_bytes = unixRead(fd(), buffer, length);
 	if (read_bytes > 0) {
+		if (quick_ack) {
+			unixSetQuickAck(fd());
+		}
+		return static_cast<size_t>(read_bytes);
+	} else if (read_bytes == 0) {
+		return criticalError("Disconnected", Error::Code::Disconnected);
+	}
+
+	return recoverableError("Currently busy");
+}
+
+ErrorOr<size_t> UnixIoStream::readv(std::span<const IoVector> segments) {
+	ssize_t read_bytes = unixReadv(fd(), segments);
+	if (read_bytes > 0) {
+		if (quick_ack) {
+			unixSetQuickAck(fd());
+		}
 		return static_cast<size_t>(read_bytes);
 	} else if (read_bytes == 0) {
 		return criticalError("Disconnected", Error::Code::Disconnected);
@@ -42,22 +101,83 @@ ErrorOr<size_t> UnixIoStream::read(void *buffer, size_t length) {
 	return recoverableError("Currently busy");
 }
 
+Maybe<int> UnixIoStream::inputFd() const { return fd(); }
+
+bool UnixIoStream::setReadLowWatermark(size_t bytes) {
+	int value = static_cast<int>(std::min<size_t>(bytes, INT_MAX));
+	return ::setsockopt(fd(), SOL_SOCKET, SO_RCVLOWAT, &value,
+						sizeof(value)) == 0;
+}
+
 Conveyor<void> UnixIoStream::readReady() {
 	auto caf = newConveyorAndFeeder<void>();
 	read_ready = std::move(caf.feeder);
+	read_ready->onDropped([this]() { updateInterest(); });
+	updateInterest();
 	return std::move(caf.conveyor);
 }
 
 Conveyor<void> UnixIoStream::onReadDisconnected() {
 	auto caf = newConveyorAndFeeder<void>();
 	on_read_disconnect = std::move(caf.feeder);
+	on_read_disconnect->onDropped([this]() { updateInterest(); });
+	updateInterest();
 	return std::move(caf.conveyor);
 }
 
 ErrorOr<size_t> UnixIoStream::write(const void *buffer, size_t length) {
-	ssize_t write_bytes = unixWrite(fd(), buffer, length);
+	bool zero_copy = zero_copy_threshold > 0 && length >= zero_copy_threshold;
+
+	ssize_t write_bytes = zero_copy
+							  ? ::send(fd(), buffer, length, MSG_ZEROCOPY)
+							  : unixWrite(fd(), buffer, length);
+	if (write_bytes < 0 && zero_copy && errno == ENOBUFS) {
+		// Out of pinnable memory for notifications, so copy this one
+		zero_copy = false;
+		write_bytes = unixWrite(fd(), buffer, length);
+	}
+
+	if (write_bytes > 0) {
+		if (zero_copy) {
+			size_t bytes = static_cast<size_t>(write_bytes);
+			zero_copy_pending.emplace_back(zero_copy_next_id++, bytes);
+			zero_copy_referenced += bytes;
+			updateInterest();
+		}
+		return static_cast<size_t>(write_bytes);
+	}
+
+	int error = errno;
+
+	if (error == EAGAIN || error == EWOULDBLOCK) {
+		return recoverableError("Currently busy");
+	}
+
+	return criticalError("Disconnected", Error::Code::Disconnected);
+}
+
+ErrorOr<size_t> UnixIoStream::writev(std::span<const IoVector> segments) {
+	ssize_t write_bytes = unixWritev(fd(), segments);
+	if (write_bytes > 0) {
+		return static_cast<size_t>(write_bytes);
+	}
+
+	int error = errno;
+
+	if (error == EAGAIN || error == EWOULDBLOCK) {
+		return recoverableError("Currently busy");
+	}
+
+	return criticalError("Disconnected", Error::Code::Disconnected);
+}
+
+ErrorOr<size_t> UnixIoStream::sendFile(int fd, uint64_t offset, size_t length) {
+	off_t file_offset = static_cast<off_t>(offset);
+	ssize_t write_bytes = ::sendfile(this->fd(), fd, &file_offset, length);
 	if (write_bytes > 0) {
 		return static_cast<size_t>(write_bytes);
+	} else if (write_bytes == 0) {
+		return criticalError("End of file", Error::Code::Exhausted);
 	}
 
 	int error = errno;
@@ -66,75 +186,472 @@ ErrorOr<size_t> UnixIoStream::write(const void *buffer, size_t length) {
 		return recoverableError("Currently busy");
 	}
 
+	// Files which can't be mapped into the page cache take the copying path
+	if (error == EINVAL || error == ENOSYS) {
+		return OutputStream::sendFile(fd, offset, length);
+	}
+
 	return criticalError("Disconnected", Error::Code::Disconnected);
 }
 
+Maybe<int> UnixIoStream::outputFd() const { return fd(); }
+
+bool UnixIoStream::setZeroCopyThreshold(size_t threshold) {
+	if (threshold > 0 && zero_copy_threshold == 0) {
+		int value = 1;
+		if (::setsockopt(fd(), SOL_SOCKET, SO_ZEROCOPY, &value,
+						 sizeof(value)) < 0) {
+			return false;
+		}
+	}
+
+	zero_copy_threshold = threshold;
+	return true;
+}
+
+size_t UnixIoStream::referencedBytes() const { return zero_copy_referenced; }
+
+bool UnixIoStream::setWriteLowWatermark(size_t bytes) {
+	int value = static_cast<int>(std::min<size_t>(bytes, INT_MAX));
+	return ::setsockopt(fd(), IPPROTO_TCP, TCP_NOTSENT_LOWAT, &value,
+						sizeof(value)) == 0;
+}
+
+void UnixIoStream::readErrorQueue() {
+	bool released = false;
+
+	while (true) {
+		uint8_t control[128];
+		struct ::msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (::recvmsg(fd(), &msg, MSG_ERRQUEUE) < 0) {
+			break;
+		}
+
+		for (struct ::cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+			 cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			bool is_recverr =
+				(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+				(cmsg->cmsg_level == SOL_IPV6 &&
+				 cmsg->cmsg_type == IPV6_RECVERR);
+			if (!is_recverr) {
+				continue;
+			}
+
+			struct ::sock_extended_err err;
+			memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+			if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				continue;
+			}
+
+			// ee_info to ee_data is the inclusive range of released sends
+			uint32_t range = err.ee_data - err.ee_info;
+			for (auto iter = zero_copy_pending.begin();
+				 iter != zero_copy_pending.end();) {
+				if (iter->first - err.ee_info <= range) {
+					zero_copy_referenced -= iter->second;
+					iter = zero_copy_pending.erase(iter);
+					released = true;
+				} else {
+					++iter;
+				}
+			}
+		}
+	}
+
+	if (released && write_ready) {
+		write_ready->feed();
+	}
+}
+
 Conveyor<void> UnixIoStream::writeReady() {
 	auto caf = newConveyorAndFeeder<void>();
 	write_ready = std::move(caf.feeder);
+	write_ready->onDropped([this]() { updateInterest(); });
+	updateInterest();
 	return std::move(caf.conveyor);
 }
 
+namespace {
+bool isWaiting(const Own<ConveyorFeeder<void>> &feeder) {
+	return feeder && feeder->space() > 0;
+}
+} // namespace
+
+void UnixIoStream::setQuickAck(bool enabled) {
+	quick_ack = enabled && unixSetQuickAck(fd());
+}
+
+void UnixIoStream::updateInterest() {
+	uint32_t mask = 0;
+	if (isWaiting(read_ready)) {
+		mask |= EPOLLIN;
+	}
+	if (isWaiting(on_read_disconnect)) {
+		mask |= EPOLLRDHUP;
+	}
+	if (isWaiting(write_ready)) {
+		mask |= EPOLLOUT;
+	}
+	if (!zero_copy_pending.empty()) {
+		// Completions are reported through the error queue
+		mask |= EPOLLERR;
+	}
+	setInterest(mask & allowed_events);
+}
+
+namespace {
+/**
+ * Feeders whose conveyor was dropped have no space left. Those are released,
+ * so the stream stops asking for their events.
+ */
+void feedReadiness(Own<ConveyorFeeder<void>> &feeder) {
+	if (!feeder) {
+		return;
+	}
+	if (feeder->space() == 0) {
+		feeder = nullptr;
+		return;
+	}
+	feeder->feed();
+}
+} // namespace
+
 void UnixIoStream::notify(uint32_t mask) {
-	if (mask & EPOLLOUT) {
-		if (write_ready) {
-			write_ready->feed();
+	if (mask & EPOLLERR) {
+		if (!zero_copy_pending.empty()) {
+			readErrorQueue();
 		}
 	}
 
+	if (mask & EPOLLOUT) {
+		feedReadiness(write_ready);
+	}
+
 	if (mask & EPOLLIN) {
-		if (read_ready) {
-			read_ready->feed();
-		}
+		feedReadiness(read_ready);
 	}
 
 	if (mask & EPOLLRDHUP) {
-		if (on_read_disconnect) {
-			on_read_disconnect->feed();
-		}
+		feedReadiness(on_read_disconnect);
 	}
+
+	updateInterest();
 }
 
+namespace {
+constexpr size_t PUMP_BUFFER_SIZE = 64 * 1024;
+
+class PumpOperation {
+private:
+	InputStream &input;
+	OutputStream &output;
+	Own<ConveyorFeeder<size_t>> feeder;
+
+	bool splicing = false;
+	int pipefds[2] = {-1, -1};
+	size_t pipe_capacity = 0;
+	size_t pipe_fill = 0;
+
+	std::vector<uint8_t> buffer;
+	size_t buffer_begin = 0;
+	size_t buffer_end = 0;
+
+	size_t transferred = 0;
+	bool input_done = false;
+	bool finished = false;
+
+	SinkConveyor read_ready;
+	SinkConveyor read_disconnected;
+	SinkConveyor write_ready;
+
+	ErrorOr<bool> spliceStep(int in_fd, int out_fd) {
+		bool progress = false;
+
+		if (!input_done && pipe_fill < pipe_capacity) {
+			ssize_t n = ::splice(in_fd, nullptr, pipefds[1], nullptr,
+								 pipe_capacity - pipe_fill,
+								 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n > 0) {
+				pipe_fill += static_cast<size_t>(n);
+				progress = true;
+			} else if (n == 0) {
+				input_done = true;
+				progress = true;
+			} else if (errno != EAGAIN && errno != EINTR) {
+				return criticalError("Couldn't splice from input",
+									 Error::Code::Disconnected);
+			}
+		}
+
+		if (pipe_fill > 0) {
+			ssize_t n =
+				::splice(pipefds[0], nullptr, out_fd, nullptr, pipe_fill,
+						 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n > 0) {
+				pipe_fill -= static_cast<size_t>(n);
+				transferred += static_cast<size_t>(n);
+				progress = true;
+			} else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+				return criticalError("Couldn't splice to output",
+									 Error::Code::Disconnected);
+			}
+		}
+
+		return progress;
+	}
+
+	ErrorOr<bool> copyStep() {
+		bool progress = false;
+
+		if (!input_done && buffer_end < buffer.size()) {
+			ErrorOr<size_t> n_err = input.read(buffer.data() + buffer_end,
+											   buffer.size() - buffer_end);
+			if (n_err.isValue()) {
+				buffer_end += n_err.value();
+				progress = n_err.value() > 0;
+			} else if (n_err.error().isCritical()) {
+				Error::Code code = n_err.error().code();
+				if (code != Error::Code::Disconnected &&
+					code != Error::Code::Exhausted) {
+					return std::move(n_err.error());
+				}
+				input_done = true;
+				progress = true;
+			}
+		}
+
+		if (buffer_begin < buffer_end) {
+			ErrorOr<size_t> n_err = output.write(buffer.data() + buffer_begin,
+												 buffer_end - buffer_begin);
+			if (n_err.isValue()) {
+				buffer_begin += n_err.value();
+				transferred += n_err.value();
+				progress = progress || n_err.value() > 0;
+				if (buffer_begin == buffer_end) {
+					buffer_begin = 0;
+					buffer_end = 0;
+				}
+			} else if (n_err.error().isCritical()) {
+				return std::move(n_err.error());
+			}
+		}
+
+		return progress;
+	}
+
+public:
+	PumpOperation(InputStream &input, OutputStream &output,
+				  Own<ConveyorFeeder<size_t>> feeder)
+		: input{input}, output{output}, feeder{std::move(feeder)} {}
+
+	~PumpOperation() {
+		if (pipefds[0] >= 0) {
+			::close(pipefds[0]);
+			::close(pipefds[1]);
+		}
+	}
+
+	SAW_FORBID_COPY(PumpOperation);
+	SAW_FORBID_MOVE(PumpOperation);
+
+	void start() {
+		if (input.inputFd().has_value() && output.outputFd().has_value()) {
+			if (::pipe2(pipefds, O_NONBLOCK | O_CLOEXEC) == 0) {
+				int capacity = ::fcntl(pipefds[0], F_GETPIPE_SZ);
+				pipe_capacity = capacity > 0 ? static_cast<size_t>(capacity)
+											 : PUMP_BUFFER_SIZE;
+				splicing = true;
+			} else {
+				pipefds[0] = -1;
+				pipefds[1] = -1;
+			}
+		}
+		if (!splicing) {
+			buffer.resize(PUMP_BUFFER_SIZE);
+		}
+
+		read_ready = input.readReady().then([this]() { step(); }).sink();
+		read_disconnected =
+			input.onReadDisconnected().then([this]() { step(); }).sink();
+		write_ready = output.writeReady().then([this]() { step(); }).sink();
+
+		// Readiness may have been signaled before the pump subscribed
+		step();
+	}
+
+	void step() {
+		if (finished) {
+			return;
+		}
+
+		bool progress = true;
+		while (progress) {
+			ErrorOr<bool> progress_or_error =
+				splicing ? spliceStep(*input.inputFd(), *output.outputFd())
+						 : copyStep();
+			if (progress_or_error.isError()) {
+				finished = true;
+				if (feeder) {
+					feeder->fail(std::move(progress_or_error.error()));
+				}
+				return;
+			}
+			progress = progress_or_error.value();
+		}
+
+		if (input_done && pipe_fill == 0 && buffer_begin == buffer_end) {
+			finished = true;
+			if (feeder) {
+				feeder->feed(size_t{transferred});
+			}
+		}
+	}
+};
+} // namespace
+
+UnixServer::DrainEvent::DrainEvent(UnixServer &server) : server{server} {}
+
+void UnixServer::DrainEvent::fire() { server.drain(); }
+
 UnixServer::UnixServer(UnixEventPort &event_port, int file_descriptor,
-					   int fd_flags)
-	: IFdOwner{event_port, file_descriptor, fd_flags, EPOLLIN} {}
+					   int fd_flags, uint32_t event_mask,
+					   const SocketOptions &options)
+	: IFdOwner{event_port, file_descriptor, fd_flags, event_mask},
+	  quick_ack{options.quick_ack} {}
 
 Conveyor<Own<IoStream>> UnixServer::accept() {
 	auto caf = newConveyorAndFeeder<Own<IoStream>>();
 	accept_feeder = std::move(caf.feeder);
+	accept_feeder->onTaken([this]() {
+		if (paused && accept_feeder->queued() < max_pending_accepts) {
+			scheduleDrain();
+		}
+	});
+
+	// Connections may have arrived while nobody was accepting
+	paused = false;
+	scheduleDrain();
+
 	return std::move(caf.conveyor);
 }
 
-void UnixServer::notify(uint32_t mask) {
-	if (mask & EPOLLIN) {
-		if (accept_feeder) {
-			struct ::sockaddr_storage address;
-			socklen_t address_length = sizeof(address);
-
-			int accept_fd =
-				::accept4(fd(), reinterpret_cast<struct ::sockaddr *>(&address),
-						  &address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
-			if (accept_fd < 0) {
-				return;
+void UnixServer::setMaxPendingAccepts(size_t limit) {
+	max_pending_accepts = std::max<size_t>(limit, 1);
+	if (paused) {
+		scheduleDrain();
+	}
+}
+
+const ServerMetrics &UnixServer::metrics() const { return server_metrics; }
+
+Maybe<int> UnixServer::listenFd() const { return fd(); }
+
+void UnixServer::scheduleDrain() {
+	if (!drain_event) {
+		drain_event = heap<DrainEvent>(*this);
+	}
+	if (!drain_event->isArmed()) {
+		drain_event->armLater();
+	}
+}
+
+void UnixServer::scheduleRetry() {
+	if (!drain_event) {
+		drain_event = heap<DrainEvent>(*this);
+	}
+	if (!drain_event->isArmed() && !drain_event->isScheduled()) {
+		drain_event->armAfter(UNIX_ACCEPT_RETRY_DELAY);
+	}
+}
+
+void UnixServer::drain() {
+	// Connections stay in the backlog until someone accepts again
+	if (!accept_feeder || accept_feeder->space() == 0) {
+		return;
+	}
+
+	size_t batch = 0;
+	bool backlog_left = true;
+	// Failed attempts count as well, so a flood of aborted connections
+	// can't keep the loop busy
+	for (size_t attempts = 0; attempts < UNIX_ACCEPT_BATCH_SIZE; ++attempts) {
+		if (accept_feeder->queued() >= max_pending_accepts) {
+			// Resumed by the onTaken callback
+			if (!paused) {
+				paused = true;
+				++server_metrics.pauses;
+			}
+			backlog_left = false;
+			break;
+		}
+		paused = false;
+
+		struct ::sockaddr_storage address;
+		socklen_t address_length = sizeof(address);
+
+		int accept_fd =
+			::accept4(fd(), reinterpret_cast<struct ::sockaddr *>(&address),
+					  &address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (accept_fd < 0) {
+			int error = errno;
+			if (error == EAGAIN || error == EWOULDBLOCK) {
+				backlog_left = false;
+				break;
 			}
-			auto fd_stream = heap<UnixIoStream>(event_port, accept_fd, 0,
-												EPOLLIN | EPOLLOUT);
-			accept_feeder->feed(std::move(fd_stream));
+			if (error == EMFILE || error == ENFILE || error == ENOBUFS ||
+				error == ENOMEM) {
+				// Won't be notified again for the waiting connections
+				++server_metrics.accept_errors;
+				scheduleRetry();
+				backlog_left = false;
+				break;
+			}
+			if (error != EINTR && error != ECONNABORTED) {
+				// Errors of a single connection, the next one may succeed
+				++server_metrics.accept_errors;
+			}
+			continue;
+		}
+
+		++batch;
+		auto fd_stream =
+			heap<UnixIoStream>(event_port, accept_fd, 0, EPOLLIN | EPOLLOUT);
+		if (quick_ack && address.ss_family != AF_UNIX) {
+			fd_stream->setQuickAck(true);
 		}
+		accept_feeder->feed(std::move(fd_stream));
+	}
+
+	if (batch > 0) {
+		server_metrics.accepted += batch;
+		++server_metrics.accept_batches;
+		server_metrics.max_accept_batch =
+			std::max<uint64_t>(server_metrics.max_accept_batch, batch);
+	}
+
+	if (backlog_left) {
+		scheduleDrain();
+	}
+}
+
+void UnixServer::notify(uint32_t mask) {
+	if (mask & EPOLLIN) {
+		drain();
 	}
 }
 
 UnixDatagram::UnixDatagram(UnixEventPort &event_port, int file_descriptor,
 						   int fd_flags)
-	: IFdOwner{event_port, file_descriptor, fd_flags, EPOLLIN | EPOLLOUT} {}
+	: IFdOwner{event_port, file_descriptor, fd_flags, 0},
+	  source_address{heap<UnixNetworkAddress>()} {}
 
 namespace {
 ssize_t unixReadMsg(int fd, void *buffer, size_t length) {
-	struct ::sockaddr_storage their_addr;
-	socklen_t addr_len = sizeof(sockaddr_storage);
-	return ::recvfrom(fd, buffer, length, 0,
-					  reinterpret_cast<struct ::sockaddr *>(&their_addr),
-					  &addr_len);
+	return ::recv(fd, buffer, length, 0);
 }
 
 ssize_t unixWriteMsg(int fd, const void *buffer, size_t length,
@@ -152,9 +669,21 @@ ErrorOr<size_t> UnixDatagram::read(void *buffer, size_t length) {
 	return recoverableError("Currently busy");
 }
 
+ErrorOr<size_t> UnixDatagram::read(void *buffer, size_t length,
+								   NetworkAddress *&source) {
+	ErrorOr<size_t> read_bytes =
+		unixReadFrom(fd(), buffer, length, *source_address);
+	if (read_bytes.isValue()) {
+		source = source_address.get();
+	}
+	return read_bytes;
+}
+
 Conveyor<void> UnixDatagram::readReady() {
 	auto caf = newConveyorAndFeeder<void>();
 	read_ready = std::move(caf.feeder);
+	read_ready->onDropped([this]() { updateInterest(); });
+	updateInterest();
 	return std::move(caf.conveyor);
 }
 
@@ -171,24 +700,64 @@ ErrorOr<size_t> UnixDatagram::write(const void *buffer, size_t length,
 	return recoverableError("Currently busy");
 }
 
+ErrorOr<size_t> UnixDatagram::write(const void *buffer, size_t length) {
+	ssize_t write_bytes = ::send(fd(), buffer, length, 0);
+	if (write_bytes > 0) {
+		return static_cast<size_t>(write_bytes);
+	}
+	return recoverableError("Currently busy");
+}
+
 Conveyor<void> UnixDatagram::writeReady() {
 	auto caf = newConveyorAndFeeder<void>();
 	write_ready = std::move(caf.feeder);
+	write_ready->onDropped([this]() { updateInterest(); });
+	updateInterest();
 	return std::move(caf.conveyor);
 }
 
+void UnixDatagram::updateInterest() {
+	uint32_t mask = 0;
+	if (isWaiting(read_ready)) {
+		mask |= EPOLLIN;
+	}
+	if (isWaiting(write_ready)) {
+		mask |= EPOLLOUT;
+	}
+	setInterest(mask);
+}
+
+ErrorOr<void> UnixDatagram::connect(NetworkAddress &peer) {
+	return unixConnectDatagram(fd(), peer);
+}
+
+Own<DatagramBatch> UnixDatagram::newBatch(size_t count, size_t packet_size) {
+	return heap<UnixDatagramBatch>(count, packet_size);
+}
+
+ErrorOr<size_t> UnixDatagram::readBatch(DatagramBatch &batch) {
+	return unixReadBatch(fd(), static_cast<UnixDatagramBatch &>(batch));
+}
+
+ErrorOr<size_t> UnixDatagram::writeBatch(DatagramBatch &batch, size_t count) {
+	return unixWriteBatch(fd(), static_cast<UnixDatagramBatch &>(batch),
+						  count);
+}
+
+bool UnixDatagram::setReceiveOffload(bool enabled) {
+	return unixSetReceiveOffload(fd(), enabled);
+}
+
 void UnixDatagram::notify(uint32_t mask) {
 	if (mask & EPOLLOUT) {
-		if (write_ready) {
-			write_ready->feed();
-		}
+		feedReadiness(write_ready);
 	}
 
 	if (mask & EPOLLIN) {
-		if (read_ready) {
-			read_ready->feed();
-		}
+		feedReadiness(read_ready);
 	}
+
+	updateInterest();
 }
 
 namespace {
@@ -197,6 +766,7 @@ bool beginsWith(const std::string_view &viewed,
 	return viewed.size() >= begins.size() &&
 		   viewed.compare(0, begins.size(), begins) == 0;
 }
+} // namespace
 
 std::variant<UnixNetworkAddress, UnixNetworkAddress *>
 translateNetworkAddressToUnixNetworkAddress(NetworkAddress &addr) {
@@ -210,8 +780,9 @@ translateNetworkAddressToUnixNetworkAddress(NetworkAddress &addr) {
 				return static_cast<UnixNetworkAddress *>(arg);
 			}
 
-			auto sock_addrs = SocketAddress::parse(
-				std::string_view{arg->address()}, arg->port());
+			auto sock_addrs =
+				SocketAddress::parse(std::string_view{arg->address()},
+									 arg->port(), AI_NUMERICHOST);
 
 			return UnixNetworkAddress{arg->address(), arg->port(),
 									  std::move(sock_addrs)};
@@ -237,107 +808,315 @@ UnixNetworkAddress &translateToUnixAddressRef(
 		addr_variant);
 }
 
+namespace {
+std::string_view stripUnixPrefix(const std::string &path) {
+	std::string_view addr_view{path};
+	std::string_view begins_with = "unix:";
+	if (beginsWith(addr_view, begins_with)) {
+		addr_view.remove_prefix(begins_with.size());
+	}
+	return addr_view;
+}
 } // namespace
 
-Own<Server> UnixNetwork::listen(NetworkAddress &addr) {
-	auto unix_addr_storage = translateNetworkAddressToUnixNetworkAddress(addr);
-	UnixNetworkAddress &address = translateToUnixAddressRef(unix_addr_storage);
+UnixResolver::CompletionEvent::CompletionEvent(EventLoop &loop,
+											   UnixResolver &resolver)
+	: CrossThreadEvent{loop}, resolver{resolver} {}
 
-	assert(address.unixAddressSize() > 0);
-	if (address.unixAddressSize() == 0) {
-		return nullptr;
-	}
+void UnixResolver::CompletionEvent::fire() { resolver.deliver(); }
 
-	int fd = address.unixAddress(0).socket(SOCK_STREAM);
-	if (fd < 0) {
-		return nullptr;
-	}
+UnixResolver::UnixResolver(EventLoop &loop) : completion_event{loop, *this} {}
 
-	int val = 1;
-	int rc = ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
-	if (rc < 0) {
-		::close(fd);
-		return nullptr;
+UnixResolver::~UnixResolver() {
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		stopping = true;
 	}
-
-	bool failed = address.unixAddress(0).bind(fd);
-	if (failed) {
-		::close(fd);
-		return nullptr;
+	lookup_available.notify_all();
+	for (auto &worker : workers) {
+		worker.join();
 	}
-
-	::listen(fd, SOMAXCONN);
-
-	return heap<UnixServer>(event_port, fd, 0);
 }
 
-Conveyor<Own<IoStream>> UnixNetwork::connect(NetworkAddress &addr) {
-	auto unix_addr_storage = translateNetworkAddressToUnixNetworkAddress(addr);
-	UnixNetworkAddress &address = translateToUnixAddressRef(unix_addr_storage);
+Conveyor<Own<NetworkAddress>> UnixResolver::resolve(const std::string &path,
+													uint16_t port_hint) {
+	std::string_view host = stripUnixPrefix(path);
 
-	assert(address.unixAddressSize() > 0);
-	if (address.unixAddressSize() == 0) {
-		return Conveyor<Own<IoStream>>{criticalError("No address found")};
+	std::vector<SocketAddress> numeric =
+		SocketAddress::parse(host, port_hint, AI_NUMERICHOST);
+	if (!numeric.empty()) {
+		return Conveyor<Own<NetworkAddress>>{
+			heap<UnixNetworkAddress>(path, port_hint, std::move(numeric))};
 	}
 
-	int fd = address.unixAddress(0).socket(SOCK_STREAM);
-	if (fd < 0) {
-		return Conveyor<Own<IoStream>>{criticalError("Couldn't open socket")};
+	std::string key = std::to_string(port_hint) + '/' + std::string{host};
+
+	auto cached = cache.find(key);
+	if (cached != cache.end()) {
+		if (cached->second.expires > std::chrono::steady_clock::now()) {
+			std::vector<SocketAddress> addresses = cached->second.addresses;
+			return Conveyor<Own<NetworkAddress>>{heap<UnixNetworkAddress>(
+				path, port_hint, std::move(addresses))};
+		}
+		cache.erase(cached);
 	}
 
-	Own<UnixIoStream> io_stream =
-		heap<UnixIoStream>(event_port, fd, 0, EPOLLIN | EPOLLOUT);
+	auto caf = newConveyorAndFeeder<Own<NetworkAddress>>();
 
-	bool success = false;
-	for (size_t i = 0; i < address.unixAddressSize(); ++i) {
-		SocketAddress &addr_iter = address.unixAddress(i);
-		int status =
-			::connect(fd, addr_iter.getRaw(), addr_iter.getRawLength());
-		if (status < 0) {
-			int error = errno;
-			/*
-			 * It's not connected yet...
-			 * But edge triggered epolling means that it'll
-			 * be ready when the signal is triggered
-			 */
-
-			/// @todo Add limit node when implemented
-			if (error == EINPROGRESS) {
-				/*
-				Conveyor<void> write_ready = io_stream->writeReady();
-				return write_ready.then(
-					[ios{std::move(io_stream)}]() mutable {
-						ios->write_ready = nullptr;
-						return std::move(ios);
-					});
-				*/
-				success = true;
-				break;
-			} else if (error != EINTR) {
-				/// @todo Push error message from
-				return Conveyor<Own<IoStream>>{
-					criticalError("Couldn't connect")};
+	auto pending = waiting.find(key);
+	if (pending != waiting.end()) {
+		// Coalesced with the running lookup
+		pending->second.feeders.push_back(std::move(caf.feeder));
+		return std::move(caf.conveyor);
+	}
+
+	Waiting &entry = waiting[key];
+	entry.path = path;
+	entry.port = port_hint;
+	entry.feeders.push_back(std::move(caf.feeder));
+
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		lookups.push_back(Lookup{key, std::string{host}, port_hint});
+	}
+	if (workers.size() < UNIX_RESOLVER_THREADS) {
+		workers.emplace_back([this]() { work(); });
+	}
+	lookup_available.notify_one();
+
+	return std::move(caf.conveyor);
+}
+
+void UnixResolver::work() {
+	while (true) {
+		Lookup lookup;
+		{
+			std::unique_lock<std::mutex> lock{mutex};
+			lookup_available.wait(
+				lock, [this]() { return stopping || !lookups.empty(); });
+			if (stopping) {
+				return;
+			}
+			lookup = std::move(lookups.front());
+			lookups.pop_front();
+		}
+
+		std::vector<SocketAddress> addresses =
+			SocketAddress::parse(lookup.host, lookup.port);
+
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			resolved.push_back(
+				Resolved{std::move(lookup.key), std::move(addresses)});
+		}
+		completion_event.armCrossThread();
+	}
+}
+
+void UnixResolver::deliver() {
+	std::vector<Resolved> finished;
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		finished.swap(resolved);
+	}
+
+	for (auto &result : finished) {
+		// Failed lookups aren't cached
+		if (!result.addresses.empty()) {
+			store(result.key, result.addresses);
+		}
+
+		auto pending = waiting.find(result.key);
+		if (pending == waiting.end()) {
+			continue;
+		}
+		Waiting entry = std::move(pending->second);
+		waiting.erase(pending);
+
+		for (auto &feeder : entry.feeders) {
+			if (result.addresses.empty()) {
+				feeder->fail(criticalError("Couldn't resolve address"));
+				continue;
+			}
+			std::vector<SocketAddress> addresses = result.addresses;
+			feeder->feed(heap<UnixNetworkAddress>(entry.path, entry.port,
+												  std::move(addresses)));
+		}
+	}
+}
+
+void UnixResolver::store(const std::string &key,
+						 const std::vector<SocketAddress> &addresses) {
+	auto now = std::chrono::steady_clock::now();
+	if (cache.size() >= UNIX_RESOLVER_CACHE_SIZE) {
+		for (auto iter = cache.begin(); iter != cache.end();) {
+			if (iter->second.expires <= now) {
+				iter = cache.erase(iter);
+			} else {
+				++iter;
 			}
-		} else {
-			success = true;
-			break;
 		}
+		if (cache.size() >= UNIX_RESOLVER_CACHE_SIZE) {
+			cache.erase(std::min_element(
+				cache.begin(), cache.end(), [](const auto &a, const auto &b) {
+					return a.second.expires < b.second.expires;
+				}));
+		}
+	}
+
+	cache[key] = CacheEntry{addresses, now + UNIX_RESOLVER_TTL};
+}
+
+namespace {
+/**
+ * Connect whose address is still being resolved
+ */
+class UnixResolvingConnect {
+public:
+	Own<ConveyorFeeder<Own<IoStream>>> feeder;
+	/// Unset once the resolved value arrived
+	bool resolving = true;
+	SinkConveyor resolution;
+	SinkConveyor connecting;
+
+	UnixResolvingConnect(Own<ConveyorFeeder<Own<IoStream>>> feeder)
+		: feeder{std::move(feeder)} {}
+};
+} // namespace
+
+Conveyor<Own<IoStream>> unixConnectResolving(
+	UnixResolver &resolver, NetworkAddress &addr,
+	std::function<Conveyor<Own<IoStream>>(UnixNetworkAddress &)> connect) {
+	auto unix_addr_storage = translateNetworkAddressToUnixNetworkAddress(addr);
+	UnixNetworkAddress &address = translateToUnixAddressRef(unix_addr_storage);
+
+	if (address.unixAddressSize() > 0 ||
+		std::holds_alternative<UnixNetworkAddress *>(unix_addr_storage)) {
+		return connect(address);
+	}
+
+	auto caf = newConveyorAndFeeder<Own<IoStream>>();
+	Own<UnixResolvingConnect> operation =
+		heap<UnixResolvingConnect>(std::move(caf.feeder));
+	UnixResolvingConnect &op = *operation;
+
+	op.resolution =
+		resolver.resolve(addr.address(), addr.port())
+			.then(
+				[&op, connect](Own<NetworkAddress> resolved) {
+					op.resolving = false;
+					auto resolved_storage =
+						translateNetworkAddressToUnixNetworkAddress(*resolved);
+					op.connecting =
+						connect(translateToUnixAddressRef(resolved_storage))
+							.then(
+								[&op](Own<IoStream> stream) {
+									op.feeder->feed(std::move(stream));
+								},
+								[&op](Error &&error) {
+									op.feeder->fail(error.copyError());
+									return std::move(error);
+								})
+							.sink();
+				},
+				[&op](Error &&error) {
+					// Immediate conveyors report exhaustion after their value
+					if (op.resolving) {
+						op.feeder->fail(error.copyError());
+					}
+					return std::move(error);
+				})
+			.sink();
+
+	return caf.conveyor.attach(std::move(operation));
+}
+
+namespace {
+uint32_t listenEventMask(const ListenOptions &options) {
+	uint32_t event_mask = EPOLLIN;
+	if (options.exclusive_wakeup) {
+		event_mask |= EPOLLEXCLUSIVE;
+	}
+	return event_mask;
+}
+} // namespace
+
+Own<Server> UnixNetwork::listen(NetworkAddress &addr) {
+	return listen(addr, ListenOptions{});
+}
+
+Own<Server> UnixNetwork::listen(NetworkAddress &addr,
+								const ListenOptions &options) {
+	auto unix_addr_storage = translateNetworkAddressToUnixNetworkAddress(addr);
+	UnixNetworkAddress &address = translateToUnixAddressRef(unix_addr_storage);
+
+	// Names have to be resolved with parseAddress first
+	if (address.unixAddressSize() == 0) {
+		return nullptr;
+	}
+
+	int fd = address.unixAddress(0).socket(SOCK_STREAM, options.socket);
+	if (fd < 0) {
+		return nullptr;
 	}
 
-	if (!success) {
-		return criticalError("Couldn't connect");
+	if (!unixListenSocket(fd, address.unixAddress(0), options)) {
+		::close(fd);
+		return nullptr;
 	}
 
-	return Conveyor<Own<IoStream>>{std::move(io_stream)};
+	return heap<UnixServer>(event_port, fd, 0, listenEventMask(options),
+							options.socket);
+}
+
+Conveyor<Own<IoStream>> UnixNetwork::connect(NetworkAddress &addr) {
+	return connect(addr, SocketOptions{});
+}
+
+Conveyor<Own<IoStream>> UnixNetwork::connect(NetworkAddress &addr,
+											 const SocketOptions &options) {
+	return unixConnectResolving(
+		resolver, addr,
+		[this, options](
+			UnixNetworkAddress &address) -> Conveyor<Own<IoStream>> {
+			if (address.unixAddressSize() == 0) {
+				return Conveyor<Own<IoStream>>{
+					criticalError("No address found")};
+			}
+
+			std::vector<SocketAddress> addresses;
+			for (size_t i = 0; i < address.unixAddressSize(); ++i) {
+				addresses.push_back(address.unixAddress(i));
+			}
+
+			auto caf = newConveyorAndFeeder<Own<IoStream>>();
+			Own<UnixConnectOperation> operation = heap<UnixConnectOperation>(
+				event_port, event_loop, std::move(addresses), options,
+				std::move(caf.feeder));
+			operation->start();
+
+			return caf.conveyor.attach(std::move(operation));
+		});
 }
 
 Own<Datagram> UnixNetwork::datagram(NetworkAddress &addr) {
+	return datagram(addr, SocketOptions{});
+}
+
+Own<Datagram> UnixNetwork::datagram(NetworkAddress &addr,
+									const SocketOptions &options) {
 	auto unix_addr_storage = translateNetworkAddressToUnixNetworkAddress(addr);
 	UnixNetworkAddress &address = translateToUnixAddressRef(unix_addr_storage);
 
-	SAW_ASSERT(address.unixAddressSize() > 0) { return nullptr; }
+	// Names have to be resolved with parseAddress first
+	if (address.unixAddressSize() == 0) {
+		return nullptr;
+	}
 
-	int fd = address.unixAddress(0).socket(SOCK_DGRAM);
+	int fd = address.unixAddress(0).socket(SOCK_DGRAM, options);
+	if (fd < 0) {
+		return nullptr;
+	}
 
 	int optval = 1;
 	int rc =
@@ -356,7 +1135,49 @@ Own<Datagram> UnixNetwork::datagram(NetworkAddress &addr) {
 	return heap<UnixDatagram>(event_port, fd, 0);
 }
 
-const std::string &UnixNetworkAddress::address() const { return path; }
+UnixNetworkAddress::UnixNetworkAddress() : port_hint{0} {
+	struct ::sockaddr_storage empty;
+	memset(&empty, 0, sizeof(empty));
+	addresses.emplace_back(&empty, sizeof(empty), false);
+}
+
+const std::string &UnixNetworkAddress::address() const {
+	if (path_outdated) {
+		path_outdated = false;
+		char host[NI_MAXHOST];
+		const SocketAddress &sock_addr = addresses.front();
+		int error = ::getnameinfo(sock_addr.getRaw(), sock_addr.getRawLength(),
+								  host, sizeof(host), nullptr, 0,
+								  NI_NUMERICHOST);
+		if (error == 0) {
+			path.assign(host);
+		} else {
+			path.clear();
+		}
+	}
+	return path;
+}
+
+void UnixNetworkAddress::assign(const struct ::sockaddr *addr,
+								socklen_t len) {
+	assert(!addresses.empty());
+	addresses.front() = SocketAddress{addr, len, false};
+
+	switch (addr->sa_family) {
+	case AF_INET:
+		port_hint = ntohs(
+			reinterpret_cast<const struct ::sockaddr_in *>(addr)->sin_port);
+		break;
+	case AF_INET6:
+		port_hint = ntohs(
+			reinterpret_cast<const struct ::sockaddr_in6 *>(addr)->sin6_port);
+		break;
+	default:
+		port_hint = 0;
+		break;
+	}
+	path_outdated = true;
+}
 
 uint16_t UnixNetworkAddress::port() const { return port_hint; }
 
@@ -368,43 +1189,1301 @@ SocketAddress &UnixNetworkAddress::unixAddress(size_t i) {
 
 size_t UnixNetworkAddress::unixAddressSize() const { return addresses.size(); }
 
-UnixNetwork::UnixNetwork(UnixEventPort &event) : event_port{event} {}
+bool unixListenSocket(int fd, const SocketAddress &address,
+					  const ListenOptions &options) {
+	int val = 1;
+	int rc = ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+	if (rc < 0) {
+		return false;
+	}
 
-Conveyor<Own<NetworkAddress>> UnixNetwork::parseAddress(const std::string &path,
-														uint16_t port_hint) {
-	std::string_view addr_view{path};
-	{
-		std::string_view begins_with = "unix:";
-		if (beginsWith(addr_view, begins_with)) {
-			addr_view.remove_prefix(begins_with.size());
+	if (options.reuse_port) {
+		rc = ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+		if (rc < 0) {
+			return false;
+		}
+	}
+
+	const SocketOptions &socket_options = options.socket;
+	if (socket_options.incoming_cpu) {
+		rc = ::setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU,
+						  &*socket_options.incoming_cpu, sizeof(int));
+		if (rc < 0) {
+			return false;
 		}
 	}
 
-	std::vector<SocketAddress> addresses =
-		SocketAddress::parse(addr_view, port_hint);
+	sa_family_t family = address.getRaw()->sa_family;
+	if (family == AF_INET || family == AF_INET6) {
+		if (socket_options.fast_open > 0) {
+			rc = ::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN,
+							  &socket_options.fast_open, sizeof(int));
+			if (rc < 0) {
+				return false;
+			}
+		}
+		if (socket_options.defer_accept > 0) {
+			rc = ::setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+							  &socket_options.defer_accept, sizeof(int));
+			if (rc < 0) {
+				return false;
+			}
+		}
+	}
 
-	return Conveyor<Own<NetworkAddress>>{
-		heap<UnixNetworkAddress>(path, port_hint, std::move(addresses))};
+	bool failed = address.bind(fd);
+	if (failed) {
+		return false;
+	}
+
+	return ::listen(fd, SOMAXCONN) == 0;
 }
 
-UnixIoProvider::UnixIoProvider(UnixEventPort &port_ref, Own<EventPort> port)
-	: event_port{port_ref}, event_loop{std::move(port)}, unix_network{
-															 port_ref} {}
+ErrorOr<size_t> unixReadFrom(int fd, void *buffer, size_t length,
+							 UnixNetworkAddress &source) {
+	struct ::sockaddr_storage their_addr;
+	socklen_t addr_len = sizeof(their_addr);
+	ssize_t read_bytes =
+		::recvfrom(fd, buffer, length, 0,
+				   reinterpret_cast<struct ::sockaddr *>(&their_addr),
+				   &addr_len);
+	if (read_bytes > 0) {
+		source.assign(reinterpret_cast<struct ::sockaddr *>(&their_addr),
+					  addr_len);
+		return static_cast<size_t>(read_bytes);
+	}
+	return recoverableError("Currently busy");
+}
 
-Own<InputStream> UnixIoProvider::wrapInputFd(int fd) {
-	return heap<UnixIoStream>(event_port, fd, 0, EPOLLIN);
+ErrorOr<void> unixConnectDatagram(int fd, NetworkAddress &peer) {
+	auto unix_addr_storage = translateNetworkAddressToUnixNetworkAddress(peer);
+	UnixNetworkAddress &address = translateToUnixAddressRef(unix_addr_storage);
+
+	for (size_t i = 0; i < address.unixAddressSize(); ++i) {
+		SocketAddress &sock_addr = address.unixAddress(i);
+		if (::connect(fd, sock_addr.getRaw(), sock_addr.getRawLength()) == 0) {
+			return Void{};
+		}
+	}
+	return criticalError("Couldn't connect datagram");
 }
 
-Network &UnixIoProvider::network() {
-	return static_cast<Network &>(unix_network);
+namespace {
+constexpr size_t UNIX_BATCH_CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+} // namespace
+
+UnixDatagramBatch::UnixDatagramBatch(size_t count, size_t packet_size)
+	: packet_size{packet_size}, storage(count * packet_size),
+	  packet_descriptors(count), headers(count), iovecs(count), names(count),
+	  control(count * UNIX_BATCH_CONTROL_SIZE) {
+	sources.reserve(count);
+	for (size_t i = 0; i < count; ++i) {
+		sources.push_back(heap<UnixNetworkAddress>());
+		packet_descriptors[i] =
+			DatagramPacket{storage.data() + i * packet_size, 0, nullptr, 0};
+	}
 }
 
-EventLoop &UnixIoProvider::eventLoop() { return event_loop; }
+std::span<DatagramPacket> UnixDatagramBatch::packets() {
+	return packet_descriptors;
+}
 
-} // namespace unix
+size_t UnixDatagramBatch::packetSize() const { return packet_size; }
+
+ErrorOr<size_t> unixReadBatch(int fd, UnixDatagramBatch &batch) {
+	size_t count = batch.packet_descriptors.size();
+	for (size_t i = 0; i < count; ++i) {
+		batch.iovecs[i].iov_base = batch.storage.data() + i * batch.packet_size;
+		batch.iovecs[i].iov_len = batch.packet_size;
+
+		struct ::msghdr &header = batch.headers[i].msg_hdr;
+		header.msg_name = &batch.names[i];
+		header.msg_namelen = sizeof(struct ::sockaddr_storage);
+		header.msg_iov = &batch.iovecs[i];
+		header.msg_iovlen = 1;
+		header.msg_control =
+			batch.control.data() + i * UNIX_BATCH_CONTROL_SIZE;
+		header.msg_controllen = UNIX_BATCH_CONTROL_SIZE;
+		header.msg_flags = 0;
+		batch.headers[i].msg_len = 0;
+	}
+
+	int received = ::recvmmsg(fd, batch.headers.data(),
+							  static_cast<unsigned int>(count), 0, nullptr);
+	if (received < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return recoverableError("Currently busy");
+		}
+		return criticalError("Failed to receive datagram batch");
+	}
+
+	for (int i = 0; i < received; ++i) {
+		struct ::msghdr &header = batch.headers[i].msg_hdr;
+		DatagramPacket &packet = batch.packet_descriptors[i];
+
+		packet.length = batch.headers[i].msg_len;
+		packet.segment_size = 0;
+		for (struct ::cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg;
+			 cmsg = CMSG_NXTHDR(&header, cmsg)) {
+			if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+				int segment_size;
+				memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+				packet.segment_size = static_cast<size_t>(segment_size);
+			}
+		}
+
+		batch.sources[i]->assign(
+			reinterpret_cast<struct ::sockaddr *>(&batch.names[i]),
+			header.msg_namelen);
+		packet.address = batch.sources[i].get();
+	}
+
+	return static_cast<size_t>(received);
+}
+
+ErrorOr<size_t> unixWriteBatch(int fd, UnixDatagramBatch &batch,
+							   size_t count) {
+	assert(count <= batch.packet_descriptors.size());
+	count = std::min(count, batch.packet_descriptors.size());
+	if (count == 0) {
+		return size_t{0};
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		DatagramPacket &packet = batch.packet_descriptors[i];
+		assert(packet.address);
+		assert(packet.length <= batch.packet_size);
+
+		batch.iovecs[i].iov_base = packet.data;
+		batch.iovecs[i].iov_len = packet.length;
+
+		SocketAddress &dest =
+			static_cast<UnixNetworkAddress &>(*packet.address).unixAddress();
+
+		struct ::msghdr &header = batch.headers[i].msg_hdr;
+		header.msg_name = dest.getRaw();
+		header.msg_namelen = dest.getRawLength();
+		header.msg_iov = &batch.iovecs[i];
+		header.msg_iovlen = 1;
+		header.msg_control = nullptr;
+		header.msg_controllen = 0;
+		header.msg_flags = 0;
+
+		if (packet.segment_size > 0 && packet.segment_size < packet.length) {
+			header.msg_control =
+				batch.control.data() + i * UNIX_BATCH_CONTROL_SIZE;
+			header.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+			struct ::cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t segment_size = static_cast<uint16_t>(packet.segment_size);
+			memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+		}
+	}
+
+	int sent = ::sendmmsg(fd, batch.headers.data(),
+						  static_cast<unsigned int>(count), 0);
+	if (sent < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return recoverableError("Currently busy");
+		}
+		return criticalError("Failed to send datagram batch");
+	}
+
+	return static_cast<size_t>(sent);
+}
+
+bool unixApplySocketOptions(int fd, int family, int type,
+							const SocketOptions &options) {
+	auto set = [fd](int level, int name, int value) {
+		return ::setsockopt(fd, level, name, &value, sizeof(value)) == 0;
+	};
+
+	if (options.receive_buffer &&
+		!set(SOL_SOCKET, SO_RCVBUF, *options.receive_buffer)) {
+		return false;
+	}
+	if (options.send_buffer &&
+		!set(SOL_SOCKET, SO_SNDBUF, *options.send_buffer)) {
+		return false;
+	}
+	if (options.busy_poll &&
+		!set(SOL_SOCKET, SO_BUSY_POLL, *options.busy_poll)) {
+		return false;
+	}
+
+	if ((family != AF_INET && family != AF_INET6) || type != SOCK_STREAM) {
+		return true;
+	}
+	if (options.no_delay && !set(IPPROTO_TCP, TCP_NODELAY, 1)) {
+		return false;
+	}
+	if (options.quick_ack && !set(IPPROTO_TCP, TCP_QUICKACK, 1)) {
+		return false;
+	}
+	return true;
+}
+
+bool unixSetQuickAck(int fd) {
+	int value = 1;
+	return ::setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &value,
+						sizeof(value)) == 0;
+}
+
+bool unixSetReceiveOffload(int fd, bool enabled) {
+	int value = enabled ? 1 : 0;
+	return ::setsockopt(fd, SOL_UDP, UDP_GRO, &value, sizeof(value)) == 0;
+}
+
+std::vector<SocketAddress>
+interleaveAddressFamilies(std::vector<SocketAddress> &&addresses) {
+	if (addresses.empty()) {
+		return std::move(addresses);
+	}
+
+	sa_family_t family = addresses.front().getRaw()->sa_family;
+	std::vector<SocketAddress> preferred;
+	std::vector<SocketAddress> others;
+	for (SocketAddress &address : addresses) {
+		if (address.getRaw()->sa_family == family) {
+			preferred.push_back(address);
+		} else {
+			others.push_back(address);
+		}
+	}
+
+	std::vector<SocketAddress> ordered;
+	ordered.reserve(addresses.size());
+	for (size_t i = 0; i < std::max(preferred.size(), others.size()); ++i) {
+		if (i < preferred.size()) {
+			ordered.push_back(preferred[i]);
+		}
+		if (i < others.size()) {
+			ordered.push_back(others[i]);
+		}
+	}
+	return ordered;
+}
+
+UnixConnectOperation::Attempt::Attempt(UnixConnectOperation &operation,
+									   UnixEventPort &event_port,
+									   int file_descriptor)
+	: IFdOwner{event_port, file_descriptor, 0, EPOLLOUT},
+	  operation{operation} {}
+
+void UnixConnectOperation::Attempt::notify(uint32_t mask) {
+	if (mask & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+		done = true;
+		operation.settle_event.armLater();
+	}
+}
+
+UnixConnectOperation::SettleEvent::SettleEvent(EventLoop &loop,
+											   UnixConnectOperation &operation)
+	: Event{loop}, operation{operation} {}
+
+void UnixConnectOperation::SettleEvent::fire() { operation.settle(); }
+
+UnixConnectOperation::StartEvent::StartEvent(EventLoop &loop,
+											 UnixConnectOperation &operation)
+	: TimerEvent{loop}, operation{operation} {}
+
+void UnixConnectOperation::StartEvent::fire() { operation.startNext(); }
+
+UnixConnectOperation::UnixConnectOperation(
+	UnixEventPort &event_port, EventLoop &event_loop,
+	std::vector<SocketAddress> &&addresses, const SocketOptions &options,
+	Own<ConveyorFeeder<Own<IoStream>>> feeder)
+	: event_port{event_port},
+	  addresses{interleaveAddressFamilies(std::move(addresses))},
+	  options{options},
+	  settle_event{event_loop, *this}, start_event{event_loop, *this},
+	  feeder{std::move(feeder)} {}
+
+void UnixConnectOperation::start() { startNext(); }
+
+void UnixConnectOperation::startNext() {
+	while (next_address < addresses.size()) {
+		SocketAddress &address = addresses[next_address++];
+
+		int fd = address.socket(SOCK_STREAM, options);
+		if (fd < 0) {
+			continue;
+		}
+
+		int status = ::connect(fd, address.getRaw(), address.getRawLength());
+		if (status == 0) {
+			finish(fd);
+			return;
+		}
+
+		// An interrupted connect continues in the background
+		int error = errno;
+		if (error == EINPROGRESS || error == EINTR) {
+			attempts.push_back(heap<Attempt>(*this, event_port, fd));
+			if (next_address < addresses.size()) {
+				start_event.armAfter(UNIX_CONNECT_ATTEMPT_DELAY);
+			}
+			return;
+		}
+
+		::close(fd);
+	}
+
+	if (attempts.empty() && feeder) {
+		feeder->fail(criticalError("Couldn't connect"));
+	}
+}
+
+void UnixConnectOperation::settle() {
+	bool failed = false;
+	for (auto iter = attempts.begin(); iter != attempts.end();) {
+		Attempt &attempt = **iter;
+		if (!attempt.done) {
+			++iter;
+			continue;
+		}
+
+		int error = 0;
+		socklen_t length = sizeof(error);
+		int status =
+			::getsockopt(attempt.fd(), SOL_SOCKET, SO_ERROR, &error, &length);
+		if (status == 0 && error == 0) {
+			finish(attempt.release());
+			return;
+		}
+
+		iter = attempts.erase(iter);
+		failed = true;
+	}
+
+	// A failed attempt doesn't have to wait for the delay of the next one
+	if (failed) {
+		start_event.cancel();
+		startNext();
+	}
+}
+
+void UnixConnectOperation::finish(int fd) {
+	start_event.cancel();
+	attempts.clear();
+	next_address = addresses.size();
+
+	Own<UnixIoStream> stream =
+		heap<UnixIoStream>(event_port, fd, 0, EPOLLIN | EPOLLOUT);
+	if (options.quick_ack) {
+		stream->setQuickAck(true);
+	}
+
+	if (feeder) {
+		feeder->feed(std::move(stream));
+	}
+}
+
+UnixNetwork::UnixNetwork(UnixEventPort &event, EventLoop &event_loop)
+	: event_port{event}, event_loop{event_loop}, resolver{event_loop} {}
+
+Conveyor<Own<NetworkAddress>> UnixNetwork::parseAddress(const std::string &path,
+														uint16_t port_hint) {
+	return resolver.resolve(path, port_hint);
+}
+
+UnixFileDescriptor::UnixFileDescriptor(int file_descriptor)
+	: file_descriptor{file_descriptor} {}
+
+UnixFileDescriptor::~UnixFileDescriptor() {
+	if (file_descriptor >= 0) {
+		::close(file_descriptor);
+	}
+}
+
+UnixFileWorkers::CompletionEvent::CompletionEvent(EventLoop &loop,
+												  UnixFileWorkers &workers)
+	: CrossThreadEvent{loop}, workers{workers} {}
+
+void UnixFileWorkers::CompletionEvent::fire() { workers.deliver(); }
+
+UnixFileWorkers::UnixFileWorkers(EventLoop &loop)
+	: completion_event{loop, *this} {}
+
+UnixFileWorkers::~UnixFileWorkers() {
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		stopping = true;
+	}
+	job_available.notify_all();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+void UnixFileWorkers::submit(Own<Job> job) {
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		jobs.push_back(std::move(job));
+	}
+	if (workers.size() < UNIX_FILE_THREADS) {
+		workers.emplace_back([this]() { work(); });
+	}
+	job_available.notify_one();
+}
+
+namespace {
+void runFileJob(UnixFileWorkers::Job &job) {
+	int fd = job.file->get();
+	size_t length = job.buffer.size();
+
+	while (job.transferred < length) {
+		uint8_t *data = job.buffer.data() + job.transferred;
+		size_t remaining = length - job.transferred;
+		off_t offset = static_cast<off_t>(job.offset + job.transferred);
+
+		ssize_t result = job.write ? ::pwrite(fd, data, remaining, offset)
+								   : ::pread(fd, data, remaining, offset);
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			job.error = errno;
+			break;
+		}
+		if (result == 0) {
+			break;
+		}
+		job.transferred += static_cast<size_t>(result);
+	}
+
+	if (!job.write) {
+		job.buffer.resize(job.transferred);
+	}
+}
+} // namespace
+
+void UnixFileWorkers::work() {
+	while (true) {
+		Own<Job> job;
+		{
+			std::unique_lock<std::mutex> lock{mutex};
+			job_available.wait(lock,
+							   [this]() { return stopping || !jobs.empty(); });
+			if (stopping) {
+				return;
+			}
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		runFileJob(*job);
+
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			finished.push_back(std::move(job));
+		}
+		completion_event.armCrossThread();
+	}
+}
+
+void UnixFileWorkers::deliver() {
+	std::vector<Own<Job>> done;
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		done.swap(finished);
+	}
+
+	for (auto &job : done) {
+		// Jobs of destroyed streams only release the descriptor
+		if (job->owner) {
+			job->owner->complete(*job);
+		}
+	}
+}
+
+UnixFileStream::UnixFileStream(UnixFileWorkers &workers, int file_descriptor,
+							   const FileOptions &options)
+	: workers{workers}, file{share<UnixFileDescriptor>(file_descriptor)},
+	  options{options} {}
+
+UnixFileStream::~UnixFileStream() {
+	if (read_job) {
+		read_job->owner = nullptr;
+	}
+	if (write_job) {
+		write_job->owner = nullptr;
+	}
+}
+
+void UnixFileStream::read(void *buffer, size_t min_length, size_t max_length) {
+	SAW_ASSERT(buffer && max_length >= min_length && min_length > 0) {
+		return;
+	}
+	SAW_ASSERT(!read_task.has_value()) { return; }
+
+	read_task = ReadTask{buffer, min_length, max_length, 0};
+	readStep();
+}
+
+void UnixFileStream::readStep() {
+	size_t available = read_buffer.size() - read_begin;
+
+	if (read_task.has_value()) {
+		ReadTask &task = *read_task;
+
+		size_t amount =
+			std::min(available, task.max_length - task.already_read);
+		if (amount > 0) {
+			memcpy(static_cast<uint8_t *>(task.buffer) + task.already_read,
+				   read_buffer.data() + read_begin, amount);
+			read_begin += amount;
+			available -= amount;
+			task.already_read += amount;
+		}
+
+		bool drained = read_end && available == 0;
+		if (task.already_read >= task.min_length || drained) {
+			size_t read_bytes = task.already_read;
+			read_task = std::nullopt;
+			if (read_bytes > 0 && read_done) {
+				read_done->feed(std::move(read_bytes));
+			}
+		}
+	}
+
+	if (read_end && available == 0) {
+		if (!read_end_reported && on_read_disconnect) {
+			read_end_reported = true;
+			on_read_disconnect->feed();
+		}
+		return;
+	}
+
+	size_t wanted = 0;
+	if (read_task.has_value()) {
+		wanted = read_task->max_length - read_task->already_read;
+	}
+	fillReadAhead(wanted);
+}
+
+void UnixFileStream::fillReadAhead(size_t wanted) {
+	if (read_job || read_end) {
+		return;
+	}
+
+	size_t available = read_buffer.size() - read_begin;
+	if (available >= std::max(options.read_ahead, wanted)) {
+		return;
+	}
+
+	Own<UnixFileWorkers::Job> job = heap<UnixFileWorkers::Job>();
+	job->file = file;
+	job->write = false;
+	job->offset = read_offset;
+	job->buffer.resize(std::max(options.read_ahead, wanted));
+	job->owner = this;
+
+	read_job = job.get();
+	workers.submit(std::move(job));
+}
+
+void UnixFileStream::complete(UnixFileWorkers::Job &job) {
+	if (job.write) {
+		completeWrite(job);
+	} else {
+		completeRead(job);
+	}
+}
+
+void UnixFileStream::completeRead(UnixFileWorkers::Job &job) {
+	read_job = nullptr;
+
+	if (job.error != 0) {
+		read_task = std::nullopt;
+		if (read_done) {
+			read_done->fail(criticalError("Couldn't read file"));
+		}
+		return;
+	}
+
+	if (job.transferred == 0) {
+		read_end = true;
+	} else if (read_begin == read_buffer.size()) {
+		read_buffer.swap(job.buffer);
+		read_begin = 0;
+	} else {
+		read_buffer.erase(read_buffer.begin(),
+						  read_buffer.begin() +
+							  static_cast<std::ptrdiff_t>(read_begin));
+		read_begin = 0;
+		read_buffer.insert(read_buffer.end(), job.buffer.begin(),
+						   job.buffer.end());
+	}
+	read_offset += job.transferred;
+
+	readStep();
+}
+
+Conveyor<size_t> UnixFileStream::readDone() {
+	auto caf = newConveyorAndFeeder<size_t>();
+	read_done = std::move(caf.feeder);
+	return std::move(caf.conveyor);
+}
+
+Conveyor<void> UnixFileStream::onReadDisconnected() {
+	auto caf = newConveyorAndFeeder<void>();
+	on_read_disconnect = std::move(caf.feeder);
+	return std::move(caf.conveyor);
+}
+
+void UnixFileStream::write(const void *buffer, size_t length) {
+	SAW_ASSERT(buffer && length > 0) { return; }
+	SAW_ASSERT(!write_job) { return; }
+
+	const uint8_t *data = static_cast<const uint8_t *>(buffer);
+
+	Own<UnixFileWorkers::Job> job = heap<UnixFileWorkers::Job>();
+	job->file = file;
+	job->write = true;
+	// Ignored by the kernel for files opened with O_APPEND
+	job->offset = write_offset;
+	job->buffer.assign(data, data + length);
+	job->owner = this;
+
+	write_job = job.get();
+	workers.submit(std::move(job));
+}
+
+void UnixFileStream::completeWrite(UnixFileWorkers::Job &job) {
+	write_job = nullptr;
+
+	if (job.error != 0) {
+		if (write_done) {
+			write_done->fail(criticalError("Couldn't write file"));
+		}
+		return;
+	}
+
+	write_offset += job.transferred;
+	if (write_done) {
+		write_done->feed(size_t{job.transferred});
+	}
+}
+
+Conveyor<size_t> UnixFileStream::writeDone() {
+	auto caf = newConveyorAndFeeder<size_t>();
+	write_done = std::move(caf.feeder);
+	return std::move(caf.conveyor);
+}
+
+ErrorOr<Own<AsyncFileStream>> unixOpenFile(UnixFileWorkers &workers,
+										   const std::string &path,
+										   FileMode mode,
+										   const FileOptions &options) {
+	int flags = O_CLOEXEC;
+	switch (mode) {
+	case FileMode::Read:
+		flags |= O_RDONLY;
+		break;
+	case FileMode::Write:
+		flags |= O_WRONLY | O_CREAT | O_TRUNC;
+		break;
+	case FileMode::Append:
+		flags |= O_WRONLY | O_CREAT | O_APPEND;
+		break;
+	}
+
+	int fd = ::open(path.c_str(), flags, 0666);
+	if (fd < 0) {
+		return criticalError("Couldn't open file");
+	}
+
+	int advice = POSIX_FADV_NORMAL;
+	switch (options.access) {
+	case FileAccess::Normal:
+		break;
+	case FileAccess::Sequential:
+		advice = POSIX_FADV_SEQUENTIAL;
+		break;
+	case FileAccess::Random:
+		advice = POSIX_FADV_RANDOM;
+		break;
+	}
+	// Only a hint, failing to apply it isn't an error
+	::posix_fadvise(fd, 0, 0, advice);
+
+	return Own<AsyncFileStream>{heap<UnixFileStream>(workers, fd, options)};
+}
+
+UnixSharedMemoryStream::Wakeup::Wakeup(UnixEventPort &event_port,
+									   int file_descriptor,
+									   Own<ConveyorFeeder<void>> &feeder)
+	: IFdOwner{event_port, file_descriptor, 0, EPOLLIN}, feeder{feeder} {}
+
+void UnixSharedMemoryStream::Wakeup::notify(uint32_t mask) {
+	if (mask & EPOLLIN) {
+		uint64_t count;
+		ssize_t drained = ::read(fd(), &count, sizeof(count));
+		(void)drained;
+		if (feeder) {
+			feeder->feed();
+		}
+	}
+}
+
+namespace {
+void signalEventFd(int fd) {
+	uint64_t count = 1;
+	ssize_t written = ::write(fd, &count, sizeof(count));
+	(void)written;
+}
+
+UnixSharedMemoryRing &sharedMemoryRing(uint8_t *mapping, size_t index) {
+	return *reinterpret_cast<UnixSharedMemoryRing *>(
+		mapping + index * UNIX_SHARED_MEMORY_RING_STRIDE);
+}
+
+uint8_t *sharedMemoryRingData(uint8_t *mapping, size_t index) {
+	return mapping + index * UNIX_SHARED_MEMORY_RING_STRIDE +
+		   sizeof(UnixSharedMemoryRing);
+}
+} // namespace
+
+UnixSharedMemoryStream::UnixSharedMemoryStream(
+	UnixEventPort &event_port, Own<IoStream> control, uint8_t *mapping,
+	const std::array<int, 4> &event_fds, bool server_side)
+	: control{std::move(control)}, mapping{mapping},
+	  input{sharedMemoryRing(mapping, server_side ? 0 : 1)},
+	  input_data{sharedMemoryRingData(mapping, server_side ? 0 : 1)},
+	  output{sharedMemoryRing(mapping, server_side ? 1 : 0)},
+	  output_data{sharedMemoryRingData(mapping, server_side ? 1 : 0)},
+	  input_data_ready{event_port, event_fds[server_side ? 0 : 2],
+					   read_ready},
+	  output_space_ready{event_port, event_fds[server_side ? 3 : 1],
+						 write_ready},
+	  input_space_fd{event_fds[server_side ? 1 : 3]},
+	  output_data_fd{event_fds[server_side ? 2 : 0]} {}
+
+UnixSharedMemoryStream::~UnixSharedMemoryStream() {
+	output.closed.store(1);
+	signalEventFd(output_data_fd);
+	input.closed.store(1);
+	signalEventFd(input_space_fd);
+
+	::close(input_space_fd);
+	::close(output_data_fd);
+	::munmap(mapping, UNIX_SHARED_MEMORY_LENGTH);
+}
+
+ErrorOr<size_t> UnixSharedMemoryStream::read(void *buffer, size_t length) {
+	uint64_t tail = input.tail.load(std::memory_order_relaxed);
+	uint64_t head = input.head.load(std::memory_order_acquire);
+	if (head == tail) {
+		// Either the producer sees the flag or this sees its new head
+		input.reader_waiting.store(1);
+		head = input.head.load();
+		if (head == tail) {
+			if (input.closed.load() && input.head.load() == tail) {
+				return criticalError("Disconnected", Error::Code::Disconnected);
+			}
+			return recoverableError("Currently busy");
+		}
+		input.reader_waiting.store(0, std::memory_order_relaxed);
+	}
+
+	size_t amount = static_cast<size_t>(
+		std::min(static_cast<uint64_t>(length), head - tail));
+	size_t offset = tail & (UNIX_SHARED_MEMORY_RING_SIZE - 1);
+	size_t first = std::min(amount, UNIX_SHARED_MEMORY_RING_SIZE - offset);
+	uint8_t *destination = static_cast<uint8_t *>(buffer);
+	memcpy(destination, input_data + offset, first);
+	memcpy(destination + first, input_data, amount - first);
+
+	input.tail.store(tail + amount);
+	if (input.writer_waiting.load() && input.writer_waiting.exchange(0)) {
+		signalEventFd(input_space_fd);
+	}
+	return amount;
+}
+
+Conveyor<void> UnixSharedMemoryStream::readReady() {
+	auto caf = newConveyorAndFeeder<void>();
+	read_ready = std::move(caf.feeder);
+	return std::move(caf.conveyor);
+}
+
+Conveyor<void> UnixSharedMemoryStream::onReadDisconnected() {
+	return control->onReadDisconnected();
+}
+
+ErrorOr<size_t> UnixSharedMemoryStream::write(const void *buffer,
+											   size_t length) {
+	if (output.closed.load(std::memory_order_relaxed)) {
+		return criticalError("Disconnected", Error::Code::Disconnected);
+	}
+
+	uint64_t head = output.head.load(std::memory_order_relaxed);
+	uint64_t tail = output.tail.load(std::memory_order_acquire);
+	size_t space = UNIX_SHARED_MEMORY_RING_SIZE - (head - tail);
+	if (space == 0) {
+		output.writer_waiting.store(1);
+		tail = output.tail.load();
+		space = UNIX_SHARED_MEMORY_RING_SIZE - (head - tail);
+		if (space == 0) {
+			return recoverableError("Currently busy");
+		}
+		output.writer_waiting.store(0, std::memory_order_relaxed);
+	}
+
+	size_t amount = std::min(length, space);
+	size_t offset = head & (UNIX_SHARED_MEMORY_RING_SIZE - 1);
+	size_t first = std::min(amount, UNIX_SHARED_MEMORY_RING_SIZE - offset);
+	const uint8_t *source = static_cast<const uint8_t *>(buffer);
+	memcpy(output_data + offset, source, first);
+	memcpy(output_data, source + first, amount - first);
+
+	output.head.store(head + amount);
+	if (output.reader_waiting.load() && output.reader_waiting.exchange(0)) {
+		signalEventFd(output_data_fd);
+	}
+	return amount;
+}
+
+Conveyor<void> UnixSharedMemoryStream::writeReady() {
+	auto caf = newConveyorAndFeeder<void>();
+	write_ready = std::move(caf.feeder);
+	return std::move(caf.conveyor);
+}
+
+namespace {
+/// The memfd followed by the eventfds
+constexpr size_t SHARED_MEMORY_HANDSHAKE_FDS = 5;
+
+void closeDescriptors(std::span<const int> fds) {
+	for (int fd : fds) {
+		if (fd >= 0) {
+			::close(fd);
+		}
+	}
+}
+
+ErrorOr<Own<IoStream>> unixAcceptSharedMemory(UnixEventPort &event_port,
+											  Own<IoStream> control) {
+	Maybe<int> socket = control->outputFd();
+	SAW_ASSERT(socket) { return criticalError("Control stream has no socket"); }
+
+	std::array<int, SHARED_MEMORY_HANDSHAKE_FDS> fds;
+	fds.fill(-1);
+
+	fds[0] = ::memfd_create("forstio-shm", MFD_CLOEXEC);
+	if (fds[0] < 0 || ::ftruncate(fds[0], UNIX_SHARED_MEMORY_LENGTH) < 0) {
+		closeDescriptors(fds);
+		return criticalError("Couldn't create shared memory");
+	}
+	for (size_t i = 1; i < fds.size(); ++i) {
+		fds[i] = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fds[i] < 0) {
+			closeDescriptors(fds);
+			return criticalError("Couldn't create eventfd");
+		}
+	}
+
+	void *mapped = ::mmap(nullptr, UNIX_SHARED_MEMORY_LENGTH,
+						  PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (mapped == MAP_FAILED) {
+		closeDescriptors(fds);
+		return criticalError("Couldn't map shared memory");
+	}
+	uint8_t *mapping = static_cast<uint8_t *>(mapped);
+	// Initialized before the peer can see the memory
+	for (size_t i = 0; i < 2; ++i) {
+		new (&sharedMemoryRing(mapping, i)) UnixSharedMemoryRing{};
+	}
+
+	uint64_t length = UNIX_SHARED_MEMORY_LENGTH;
+	struct ::iovec payload = {&length, sizeof(length)};
+	alignas(struct ::cmsghdr) char
+		buffer[CMSG_SPACE(sizeof(int) * SHARED_MEMORY_HANDSHAKE_FDS)];
+	memset(buffer, 0, sizeof(buffer));
+
+	struct ::msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &payload;
+	message.msg_iovlen = 1;
+	message.msg_control = buffer;
+	message.msg_controllen = sizeof(buffer);
+
+	struct ::cmsghdr *header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(int) * SHARED_MEMORY_HANDSHAKE_FDS);
+	memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+
+	// A fresh connection has an empty send buffer, so this doesn't block
+	ssize_t sent = ::sendmsg(*socket, &message, MSG_NOSIGNAL);
+	::close(fds[0]);
+	std::array<int, 4> event_fds{fds[1], fds[2], fds[3], fds[4]};
+	if (sent != static_cast<ssize_t>(sizeof(length))) {
+		::munmap(mapping, UNIX_SHARED_MEMORY_LENGTH);
+		closeDescriptors(event_fds);
+		return criticalError("Couldn't pass shared memory");
+	}
+
+	return Own<IoStream>{heap<UnixSharedMemoryStream>(
+		event_port, std::move(control), mapping, event_fds, true)};
+}
+
+/**
+ * Takes over control once the server passed the shared memory. Returns a
+ * recoverable error while it hasn't arrived yet.
+ */
+ErrorOr<Own<IoStream>> unixReceiveSharedMemory(UnixEventPort &event_port,
+											   Own<IoStream> &control) {
+	Maybe<int> socket = control->inputFd();
+	SAW_ASSERT(socket) { return criticalError("Control stream has no socket"); }
+
+	uint64_t length = 0;
+	struct ::iovec payload = {&length, sizeof(length)};
+	alignas(struct ::cmsghdr) char
+		buffer[CMSG_SPACE(sizeof(int) * SHARED_MEMORY_HANDSHAKE_FDS)];
+
+	struct ::msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &payload;
+	message.msg_iovlen = 1;
+	message.msg_control = buffer;
+	message.msg_controllen = sizeof(buffer);
+
+	ssize_t received = ::recvmsg(*socket, &message, MSG_CMSG_CLOEXEC);
+	if (received < 0) {
+		int error = errno;
+		if (error == EAGAIN || error == EWOULDBLOCK || error == EINTR) {
+			return recoverableError("Currently busy");
+		}
+		return criticalError("Disconnected", Error::Code::Disconnected);
+	} else if (received == 0) {
+		return criticalError("Disconnected", Error::Code::Disconnected);
+	}
+
+	std::array<int, SHARED_MEMORY_HANDSHAKE_FDS> fds;
+	fds.fill(-1);
+	size_t count = 0;
+	struct ::cmsghdr *header = CMSG_FIRSTHDR(&message);
+	if (header && header->cmsg_level == SOL_SOCKET &&
+		header->cmsg_type == SCM_RIGHTS) {
+		count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds.data(), CMSG_DATA(header),
+			   sizeof(int) * std::min(count, fds.size()));
+	}
+
+	if (received != static_cast<ssize_t>(sizeof(length)) ||
+		count != fds.size() || (message.msg_flags & MSG_CTRUNC) ||
+		length != UNIX_SHARED_MEMORY_LENGTH) {
+		closeDescriptors(fds);
+		return criticalError("Invalid shared memory handshake");
+	}
+
+	void *mapped = ::mmap(nullptr, UNIX_SHARED_MEMORY_LENGTH,
+						  PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	::close(fds[0]);
+	std::array<int, 4> event_fds{fds[1], fds[2], fds[3], fds[4]};
+	if (mapped == MAP_FAILED) {
+		closeDescriptors(event_fds);
+		return criticalError("Couldn't map shared memory");
+	}
+
+	return Own<IoStream>{heap<UnixSharedMemoryStream>(
+		event_port, std::move(control), static_cast<uint8_t *>(mapped),
+		event_fds, false)};
+}
+
+/*
+ * Waits on the control connection until the shared memory arrives
+ */
+struct UnixSharedMemoryConnectHelper {
+public:
+	UnixEventPort &event_port;
+	Own<ConveyorFeeder<Own<IoStream>>> feeder;
+	SinkConveyor connection_sink;
+	SinkConveyor control_reader;
+
+	Own<IoStream> control = nullptr;
+	bool connected = false;
+
+public:
+	UnixSharedMemoryConnectHelper(UnixEventPort &event_port,
+								  Own<ConveyorFeeder<Own<IoStream>>> f)
+		: event_port{event_port}, feeder{std::move(f)} {}
+
+	void turn() {
+		if (!control) {
+			return;
+		}
+
+		ErrorOr<Own<IoStream>> stream =
+			unixReceiveSharedMemory(event_port, control);
+		if (!stream.isError()) {
+			feeder->feed(std::move(stream.value()));
+		} else if (stream.error().isCritical()) {
+			feeder->fail(std::move(stream.error()));
+			control = nullptr;
+		}
+	}
+};
+
+Maybe<SocketAddress> unixDomainAddress(const std::string &path) {
+	std::string_view stripped = stripUnixPrefix(path);
+
+	struct ::sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (stripped.empty() || stripped.size() >= sizeof(address.sun_path)) {
+		return std::nullopt;
+	}
+	memcpy(address.sun_path, stripped.data(), stripped.size());
+
+	socklen_t length = static_cast<socklen_t>(
+		offsetof(struct ::sockaddr_un, sun_path) + stripped.size() + 1);
+	return SocketAddress{&address, length, false};
+}
+} // namespace
+
+UnixSharedMemoryServer::PauseEvent::PauseEvent(UnixSharedMemoryServer &server)
+	: server{server} {}
+
+void UnixSharedMemoryServer::PauseEvent::fire() { server.updateAccepting(); }
+
+UnixSharedMemoryServer::UnixSharedMemoryServer(UnixEventPort &event_port,
+											   Own<UnixServer> control,
+											   const std::string &path)
+	: event_port{event_port}, control{std::move(control)}, path{path} {}
+
+UnixSharedMemoryServer::~UnixSharedMemoryServer() { ::unlink(path.c_str()); }
+
+Conveyor<Own<IoStream>> UnixSharedMemoryServer::accept() {
+	auto caf = newConveyorAndFeeder<Own<IoStream>>();
+	accept_feeder = std::move(caf.feeder);
+	accept_feeder->onTaken([this]() {
+		if (!accepting) {
+			updateAccepting();
+		}
+	});
+
+	updateAccepting();
+
+	return std::move(caf.conveyor);
+}
+
+void UnixSharedMemoryServer::handshake(Own<IoStream> connection) {
+	ErrorOr<Own<IoStream>> stream =
+		unixAcceptSharedMemory(event_port, std::move(connection));
+	if (stream.isError()) {
+		++handshake_errors;
+		return;
+	}
+
+	accept_feeder->feed(std::move(stream.value()));
+	if (accept_feeder->space() == 0 ||
+		accept_feeder->queued() >= max_pending_accepts) {
+		if (!pause_event) {
+			pause_event = heap<PauseEvent>(*this);
+		}
+		if (!pause_event->isArmed()) {
+			pause_event->armLater();
+		}
+	}
+}
+
+void UnixSharedMemoryServer::updateAccepting() {
+	bool wanted = accept_feeder && accept_feeder->space() > 0 &&
+				  accept_feeder->queued() < max_pending_accepts;
+	if (wanted == accepting) {
+		return;
+	}
+	accepting = wanted;
+
+	if (!wanted) {
+		++pauses;
+		// The control server stops accepting once its conveyor is gone
+		control_accepting = SinkConveyor{};
+		return;
+	}
+
+	control_accepting =
+		control->accept()
+			.then([this](Own<IoStream> connection) {
+				handshake(std::move(connection));
+			})
+			.sink();
+}
+
+void UnixSharedMemoryServer::setMaxPendingAccepts(size_t limit) {
+	max_pending_accepts = std::max<size_t>(limit, 1);
+	updateAccepting();
+}
+
+const ServerMetrics &UnixSharedMemoryServer::metrics() const {
+	server_metrics = control->metrics();
+	server_metrics.pauses += pauses;
+	server_metrics.accept_errors += handshake_errors;
+	return server_metrics;
+}
+
+UnixSharedMemoryNetwork::UnixSharedMemoryNetwork(UnixEventPort &event_port,
+												 EventLoop &event_loop)
+	: event_port{event_port}, event_loop{event_loop} {}
+
+Conveyor<Own<NetworkAddress>>
+UnixSharedMemoryNetwork::parseAddress(const std::string &address,
+									  uint16_t port_hint) {
+	return Conveyor<Own<NetworkAddress>>{
+		heap<StringNetworkAddress>(address, port_hint)};
+}
+
+Own<Server> UnixSharedMemoryNetwork::listen(NetworkAddress &addr) {
+	return listen(addr, ListenOptions{});
+}
+
+Own<Server> UnixSharedMemoryNetwork::listen(NetworkAddress &addr,
+											const ListenOptions &options) {
+	Maybe<SocketAddress> address = unixDomainAddress(addr.address());
+	if (!address) {
+		return nullptr;
+	}
+
+	int fd = address->socket(SOCK_STREAM);
+	if (fd < 0) {
+		return nullptr;
+	}
+
+	if (!unixListenSocket(fd, *address, options)) {
+		::close(fd);
+		return nullptr;
+	}
+
+	return heap<UnixSharedMemoryServer>(
+		event_port,
+		heap<UnixServer>(event_port, fd, 0, listenEventMask(options),
+						 options.socket),
+		std::string{stripUnixPrefix(addr.address())});
+}
+
+Conveyor<Own<IoStream>> UnixSharedMemoryNetwork::connect(NetworkAddress &addr) {
+	return connect(addr, SocketOptions{});
+}
+
+Conveyor<Own<IoStream>>
+UnixSharedMemoryNetwork::connect(NetworkAddress &addr,
+								 const SocketOptions &options) {
+	(void)options;
+	Maybe<SocketAddress> address = unixDomainAddress(addr.address());
+	if (!address) {
+		return Conveyor<Own<IoStream>>{criticalError("Invalid socket path")};
+	}
+
+	auto caf = newConveyorAndFeeder<Own<IoStream>>();
+	Own<UnixSharedMemoryConnectHelper> helper =
+		heap<UnixSharedMemoryConnectHelper>(event_port, std::move(caf.feeder));
+	UnixSharedMemoryConnectHelper *hlp_ptr = helper.get();
+
+	auto control_caf = newConveyorAndFeeder<Own<IoStream>>();
+	Own<UnixConnectOperation> operation = heap<UnixConnectOperation>(
+		event_port, event_loop, std::vector<SocketAddress>{*address},
+		SocketOptions{}, std::move(control_caf.feeder));
+	operation->start();
+
+	helper->connection_sink =
+		control_caf.conveyor.attach(std::move(operation))
+			.then([hlp_ptr](Own<IoStream> control) {
+				hlp_ptr->connected = true;
+				hlp_ptr->control = std::move(control);
+				// Waits first, an arrival before the attempt isn't signaled
+				hlp_ptr->control_reader = hlp_ptr->control->readReady()
+											  .then([hlp_ptr]() {
+												  hlp_ptr->turn();
+											  })
+											  .sink();
+				hlp_ptr->turn();
+			},
+			[hlp_ptr](Error &&error) {
+				if (!hlp_ptr->connected) {
+					hlp_ptr->feeder->fail(error.copyError());
+				}
+				return std::move(error);
+			})
+			.sink();
+
+	return caf.conveyor.attach(std::move(helper));
+}
+
+Own<Datagram> UnixSharedMemoryNetwork::datagram(NetworkAddress &addr) {
+	return datagram(addr, SocketOptions{});
+}
+
+Own<Datagram>
+UnixSharedMemoryNetwork::datagram(NetworkAddress &addr,
+								  const SocketOptions &options) {
+	(void)addr;
+	(void)options;
+	return nullptr;
+}
+
+UnixIoProvider::UnixIoProvider(UnixEventPort &port_ref, Own<EventPort> port)
+	: event_port{port_ref}, event_loop{std::move(port)},
+	  unix_network{port_ref, event_loop},
+	  shared_memory_network{port_ref, event_loop}, file_workers{event_loop} {}
+
+Own<InputStream> UnixIoProvider::wrapInputFd(int fd) {
+	return heap<UnixIoStream>(event_port, fd, 0, EPOLLIN);
+}
+
+ErrorOr<Own<AsyncFileStream>>
+UnixIoProvider::openFile(const std::string &path, FileMode mode,
+						 const FileOptions &options) {
+	return unixOpenFile(file_workers, path, mode, options);
+}
+
+Own<Server> UnixIoProvider::wrapListenFd(int fd,
+										 const ListenOptions &options) {
+	return heap<UnixServer>(event_port, fd, 0, listenEventMask(options),
+							options.socket);
+}
+
+Network &UnixIoProvider::network() {
+	return static_cast<Network &>(unix_network);
+}
+
+Network *UnixIoProvider::sharedMemoryNetwork() {
+	return &shared_memory_network;
+}
+
+EventLoop &UnixIoProvider::eventLoop() { return event_loop; }
+
+} // namespace unix
+
+Conveyor<size_t> pump(InputStream &input, OutputStream &output) {
+	auto caf = newConveyorAndFeeder<size_t>();
+
+	Own<unix::PumpOperation> operation =
+		heap<unix::PumpOperation>(input, output, std::move(caf.feeder));
+	operation->start();
+
+	return caf.conveyor.attach(std::move(operation));
+}
+
+ErrorOr<AsyncIoContext> setupAsyncIo() {
+	return setupAsyncIo(AsyncIoBackend::Default);
+}
+
+ErrorOr<AsyncIoContext> setupAsyncIo(AsyncIoBackend backend) {
+	using namespace unix;
+	if (backend == AsyncIoBackend::Uring) {
+		ErrorOr<AsyncIoContext> uring_context = setupUringAsyncIo();
+		if (!uring_context.isError()) {
+			return uring_context;
+		}
+		// Kernels without io_uring or sandboxes blocking it use epoll
+	}
 
-ErrorOr<AsyncIoContext> setupAsyncIo() {
-	using namespace unix;
 	try {
 		Own<UnixEventPort> prt = heap<UnixEventPort>();
 		UnixEventPort &prt_ref = *prt;
@@ -414,7 +2493,8 @@ ErrorOr<AsyncIoContext> setupAsyncIo() {
 
 		EventLoop &loop_ref = io_provider->eventLoop();
 
-		return {{std::move(io_provider), loop_ref, prt_ref}};
+		return {{std::move(io_provider), loop_ref, prt_ref,
+				 AsyncIoBackend::Default}};
 	} catch (std::bad_alloc &) {
 		return criticalError("Out of memory");
 	}
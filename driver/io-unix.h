@@ -8,21 +8,40 @@
 #include <sys/signalfd.h>
 
 #include <fcntl.h>
+#include <linux/errqueue.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include <cassert>
+#include <climits>
+#include <cstddef>
 #include <cstring>
 
 #include <errno.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <queue>
+#include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -42,6 +61,13 @@ private:
 	int fd_flags;
 	uint32_t event_mask;
 
+	/// Registration state as last applied by the event port
+	uint32_t registered_mask = 0;
+	bool registered = false;
+	bool change_queued = false;
+
+	friend class UnixEventPort;
+
 public:
 	IFdOwner(UnixEventPort &event_port, int file_descriptor, int fd_flags,
 			 uint32_t event_mask);
@@ -51,6 +77,21 @@ public:
 	virtual void notify(uint32_t mask) = 0;
 
 	int fd() const { return file_descriptor; }
+
+	/**
+	 * Changes the events this owner is notified about. Changes are collected
+	 * and applied right before the event port polls, so interest which is
+	 * dropped and taken up again within one turn doesn't cost a syscall.
+	 * A descriptor isn't registered at all until it has some interest.
+	 */
+	void setInterest(uint32_t mask);
+	uint32_t interest() const { return event_mask; }
+
+	/**
+	 * Unsubscribes the descriptor and hands over its ownership, so it isn't
+	 * closed on destruction
+	 */
+	int release();
 };
 
 class UnixEventPort final : public EventPort {
@@ -64,6 +105,9 @@ private:
 
 	int pipefds[2];
 
+	/// Owners whose interest changed since the last poll
+	std::vector<IFdOwner *> interest_changes;
+
 	std::vector<int> toUnixSignal(Signal signal) const {
 		switch (signal) {
 		case Signal::User1:
@@ -105,6 +149,8 @@ private:
 		epoll_event events[MAX_EPOLL_EVENTS];
 		int nfds = 0;
 		do {
+			applyInterestChanges();
+
 			nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, time);
 
 			if (nfds < 0) {
@@ -131,7 +177,7 @@ private:
 						continue;
 					}
 					while (1) {
-						ssize_t n = ::recv(pipefds[0], &i, sizeof(i), 0);
+						ssize_t n = ::read(pipefds[0], &i, sizeof(i));
 						if (n < 0) {
 							break;
 						}
@@ -149,6 +195,34 @@ private:
 		return true;
 	}
 
+	void applyInterest(IFdOwner &owner) {
+		uint32_t mask = owner.event_mask;
+		if (owner.registered ? owner.registered_mask == mask : mask == 0) {
+			return;
+		}
+
+		::epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = mask | EPOLLET;
+		event.data.ptr = &owner;
+
+		int op = owner.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		if (::epoll_ctl(epoll_fd, op, owner.file_descriptor, &event) < 0) {
+			/// @todo error_handling
+			return;
+		}
+		owner.registered = true;
+		owner.registered_mask = mask;
+	}
+
+	void applyInterestChanges() {
+		for (IFdOwner *owner : interest_changes) {
+			owner->change_queued = false;
+			applyInterest(*owner);
+		}
+		interest_changes.clear();
+	}
+
 public:
 	UnixEventPort() : epoll_fd{-1}, signal_fd{-1} {
 		::signal(SIGPIPE, SIG_IGN);
@@ -220,42 +294,44 @@ public:
 		if (time_point <= now) {
 			poll();
 		} else {
-			pollImpl(std::chrono::duration_cast<std::chrono::milliseconds>(
-						 time_point - now)
-						 .count());
+			// Rounded up, so timers of the loop don't wake up early
+			pollImpl(
+				std::chrono::ceil<std::chrono::milliseconds>(time_point - now)
+					.count());
 		}
 	}
 
 	void wake() override {
-		/// @todo pipe() in the beginning and write something minor into it like
-		/// uint8_t or sth the value itself doesn't matter
 		if (pipefds[1] < 0) {
 			return;
 		}
+		// The pipe is non blocking, so a full pipe is already woken up
 		uint8_t i = 0;
-		::send(pipefds[1], &i, sizeof(i), MSG_DONTWAIT);
+		::write(pipefds[1], &i, sizeof(i));
 	}
 
-	void subscribe(IFdOwner &owner, int fd, uint32_t event_mask) {
-		if (epoll_fd < 0 || fd < 0) {
-			return;
-		}
-		::epoll_event event;
-		memset(&event, 0, sizeof(event));
-		event.events = event_mask | EPOLLET;
-		event.data.ptr = &owner;
-
-		if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
-			/// @todo error_handling
+	void queueInterestChange(IFdOwner &owner) {
+		if (epoll_fd < 0 || owner.file_descriptor < 0 || owner.change_queued) {
 			return;
 		}
+		owner.change_queued = true;
+		interest_changes.push_back(&owner);
 	}
 
-	void unsubscribe(int fd) {
-		if (epoll_fd < 0 || fd < 0) {
+	void unsubscribe(IFdOwner &owner) {
+		if (owner.change_queued) {
+			interest_changes.erase(std::remove(interest_changes.begin(),
+											   interest_changes.end(), &owner),
+								   interest_changes.end());
+			owner.change_queued = false;
+		}
+		if (!owner.registered) {
 			return;
 		}
-		if (::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr) < 0) {
+		owner.registered = false;
+		owner.registered_mask = 0;
+		if (::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, owner.file_descriptor,
+						nullptr) < 0) {
 			/// @todo error_handling
 			return;
 		}
@@ -264,6 +340,8 @@ public:
 
 ssize_t unixRead(int fd, void *buffer, size_t length);
 ssize_t unixWrite(int fd, const void *buffer, size_t length);
+ssize_t unixReadv(int fd, std::span<const IoVector> segments);
+ssize_t unixWritev(int fd, std::span<const IoVector> segments);
 
 class UnixIoStream final : public IoStream, public IFdOwner {
 private:
@@ -271,20 +349,69 @@ private:
 	Own<ConveyorFeeder<void>> on_read_disconnect = nullptr;
 	Own<ConveyorFeeder<void>> write_ready = nullptr;
 
+	/// Events the stream was created for. Only those are ever registered.
+	uint32_t allowed_events;
+
+	/**
+	 * MSG_ZEROCOPY sends are numbered by the kernel in submission order.
+	 * Each pending entry is the id and the byte count of one send.
+	 */
+	size_t zero_copy_threshold = 0;
+	uint32_t zero_copy_next_id = 0;
+	std::deque<std::pair<uint32_t, size_t>> zero_copy_pending;
+	size_t zero_copy_referenced = 0;
+
+	/// TCP_QUICKACK is set again after each read, since the kernel clears it
+	bool quick_ack = false;
+
+	void readErrorQueue();
+
+	/**
+	 * Registers interest only in events somebody waits on, plus the error
+	 * queue while zero copy sends are pending. Also called once a waiting
+	 * conveyor was dropped.
+	 */
+	void updateInterest();
+
 public:
 	UnixIoStream(UnixEventPort &event_port, int file_descriptor, int fd_flags,
 				 uint32_t event_mask);
 
 	ErrorOr<size_t> read(void *buffer, size_t length) override;
 
+	using InputStream::readv;
+	ErrorOr<size_t> readv(std::span<const IoVector> segments) override;
+
+	Maybe<int> inputFd() const override;
+
+	bool setReadLowWatermark(size_t bytes) override;
+
 	Conveyor<void> readReady() override;
 
 	Conveyor<void> onReadDisconnected() override;
 
 	ErrorOr<size_t> write(const void *buffer, size_t length) override;
 
+	using OutputStream::writev;
+	ErrorOr<size_t> writev(std::span<const IoVector> segments) override;
+
+	ErrorOr<size_t> sendFile(int fd, uint64_t offset, size_t length) override;
+
+	Maybe<int> outputFd() const override;
+
+	bool setZeroCopyThreshold(size_t threshold) override;
+	size_t referencedBytes() const override;
+
+	bool setWriteLowWatermark(size_t bytes) override;
+
 	Conveyor<void> writeReady() override;
 
+	/**
+	 * See SocketOptions::quick_ack. Stays off if the socket doesn't
+	 * support it.
+	 */
+	void setQuickAck(bool enabled);
+
 	/*
 		void read(void *buffer, size_t min_length, size_t max_length) override;
 		Conveyor<size_t> readDone() override;
@@ -300,36 +427,113 @@ public:
 	void notify(uint32_t mask) override;
 };
 
+/**
+ * Connections accepted per readiness notification before other events get a
+ * chance to run
+ */
+constexpr size_t UNIX_ACCEPT_BATCH_SIZE = 64;
+
+/**
+ * Delay before the backlog is drained again after accepting failed for lack
+ * of descriptors or memory
+ */
+constexpr std::chrono::milliseconds UNIX_ACCEPT_RETRY_DELAY{10};
+
 class UnixServer final : public Server, public IFdOwner {
 private:
+	/**
+	 * Continues draining the backlog after a full batch, once the consumer
+	 * took pending connections or after a delay if accepting ran out of
+	 * resources. The listener is edge triggered, so it won't be notified
+	 * again for connections already in the backlog.
+	 */
+	class DrainEvent final : public TimerEvent {
+	private:
+		UnixServer &server;
+
+	public:
+		DrainEvent(UnixServer &server);
+
+		void fire() override;
+	};
+
 	Own<ConveyorFeeder<Own<IoStream>>> accept_feeder = nullptr;
+	Own<DrainEvent> drain_event = nullptr;
+
+	size_t max_pending_accepts = SERVER_DEFAULT_MAX_PENDING_ACCEPTS;
+	bool paused = false;
+
+	ServerMetrics server_metrics;
+
+	/// Not inherited from the listener, so it's set on each connection
+	bool quick_ack;
+
+	void drain();
+	void scheduleDrain();
+	void scheduleRetry();
 
 public:
-	UnixServer(UnixEventPort &event_port, int file_descriptor, int fd_flags);
+	UnixServer(UnixEventPort &event_port, int file_descriptor, int fd_flags,
+			   uint32_t event_mask = EPOLLIN,
+			   const SocketOptions &options = {});
 
 	Conveyor<Own<IoStream>> accept() override;
 
+	Maybe<int> listenFd() const override;
+
+	void setMaxPendingAccepts(size_t limit) override;
+
+	const ServerMetrics &metrics() const override;
+
 	void notify(uint32_t mask) override;
 };
 
+class UnixNetworkAddress;
+
 class UnixDatagram final : public Datagram, public IFdOwner {
 private:
 	Own<ConveyorFeeder<void>> read_ready = nullptr;
 	Own<ConveyorFeeder<void>> write_ready = nullptr;
 
+	/// Sender of the last message received with read
+	Own<UnixNetworkAddress> source_address;
+
+	/**
+	 * Registers interest only in events somebody waits on. Also called once
+	 * a waiting conveyor was dropped.
+	 */
+	void updateInterest();
+
 public:
 	UnixDatagram(UnixEventPort &event_port, int file_descriptor, int fd_flags);
 
 	ErrorOr<size_t> read(void *buffer, size_t length) override;
+	ErrorOr<size_t> read(void *buffer, size_t length,
+						 NetworkAddress *&source) override;
 	Conveyor<void> readReady() override;
 
 	ErrorOr<size_t> write(const void *buffer, size_t length,
 						  NetworkAddress &dest) override;
+	ErrorOr<size_t> write(const void *buffer, size_t length) override;
 	Conveyor<void> writeReady() override;
 
+	ErrorOr<void> connect(NetworkAddress &peer) override;
+
+	Own<DatagramBatch> newBatch(size_t count, size_t packet_size) override;
+	ErrorOr<size_t> readBatch(DatagramBatch &batch) override;
+	ErrorOr<size_t> writeBatch(DatagramBatch &batch, size_t count) override;
+	bool setReceiveOffload(bool enabled) override;
+
 	void notify(uint32_t mask) override;
 };
 
+/**
+ * Applies the options which aren't specific to listeners to a new socket.
+ * Returns false on failure.
+ */
+bool unixApplySocketOptions(int fd, int family, int type,
+							const SocketOptions &options);
+
 /**
  * Helper class which provides potential addresses to NetworkAddress
  */
@@ -355,10 +559,15 @@ public:
 		memcpy(&address.generic, sockaddr, len);
 	}
 
-	int socket(int type) const {
-		type |= SOCK_NONBLOCK | SOCK_CLOEXEC;
-
-		int result = ::socket(address.generic.sa_family, type, 0);
+	int socket(int type, const SocketOptions &options = {}) const {
+		int result = ::socket(address.generic.sa_family,
+							  type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (result >= 0 && !unixApplySocketOptions(
+							   result, address.generic.sa_family, type,
+							   options)) {
+			::close(result);
+			return -1;
+		}
 		return result;
 	}
 
@@ -379,14 +588,19 @@ public:
 
 	socklen_t getRawLength() const { return address_length; }
 
+	/**
+	 * Blocks while a name is resolved unless flags contains AI_NUMERICHOST
+	 */
 	static std::vector<SocketAddress> parse(std::string_view str,
-											uint16_t port_hint) {
+											uint16_t port_hint,
+											int flags = 0) {
 		std::vector<SocketAddress> results;
 
 		struct ::addrinfo *head;
 		struct ::addrinfo hints;
 		memset(&hints, 0, sizeof(hints));
 		hints.ai_family = AF_UNSPEC;
+		hints.ai_flags = flags;
 
 		std::string port_string = std::to_string(port_hint);
 		bool wildcard = str == "*" || str == "::";
@@ -412,7 +626,9 @@ public:
 
 class UnixNetworkAddress final : public OsNetworkAddress {
 private:
-	const std::string path;
+	mutable std::string path;
+	/// Set if path still has to be formatted from the socket address
+	mutable bool path_outdated = false;
 	uint16_t port_hint;
 	std::vector<SocketAddress> addresses;
 
@@ -421,30 +637,619 @@ public:
 					   std::vector<SocketAddress> &&addr)
 		: path{path}, port_hint{port_hint}, addresses{std::move(addr)} {}
 
+	/**
+	 * Address holding a single socket address which is meant to be
+	 * overwritten with assign
+	 */
+	UnixNetworkAddress();
+
 	const std::string &address() const override;
 
 	uint16_t port() const override;
 
+	/**
+	 * Replaces the address in place without allocating. The string form is
+	 * only formatted if address() is called.
+	 */
+	void assign(const struct ::sockaddr *addr, socklen_t len);
+
 	// Custom address info
 	SocketAddress &unixAddress(size_t i = 0);
 	size_t unixAddressSize() const;
 };
 
+/**
+ * Keeps the message headers, io vectors, address storage and control
+ * buffers recvmmsg and sendmmsg need next to the packet payloads
+ */
+class UnixDatagramBatch final : public DatagramBatch {
+private:
+	size_t packet_size;
+	std::vector<uint8_t> storage;
+	std::vector<DatagramPacket> packet_descriptors;
+
+	std::vector<struct ::mmsghdr> headers;
+	std::vector<struct ::iovec> iovecs;
+	std::vector<struct ::sockaddr_storage> names;
+	std::vector<uint8_t> control;
+	std::vector<Own<UnixNetworkAddress>> sources;
+
+	friend ErrorOr<size_t> unixReadBatch(int fd, UnixDatagramBatch &batch);
+	friend ErrorOr<size_t> unixWriteBatch(int fd, UnixDatagramBatch &batch,
+										  size_t count);
+
+public:
+	UnixDatagramBatch(size_t count, size_t packet_size);
+
+	std::span<DatagramPacket> packets() override;
+	size_t packetSize() const override;
+};
+
+/**
+ * Applies the listener options, binds and starts listening. Returns false on
+ * failure.
+ */
+bool unixListenSocket(int fd, const SocketAddress &address,
+					  const ListenOptions &options);
+
+ErrorOr<size_t> unixReadFrom(int fd, void *buffer, size_t length,
+							 UnixNetworkAddress &source);
+ErrorOr<void> unixConnectDatagram(int fd, NetworkAddress &peer);
+
+ErrorOr<size_t> unixReadBatch(int fd, UnixDatagramBatch &batch);
+ErrorOr<size_t> unixWriteBatch(int fd, UnixDatagramBatch &batch, size_t count);
+bool unixSetReceiveOffload(int fd, bool enabled);
+
+/**
+ * Sets TCP_QUICKACK on a stream socket. The kernel drops it again once it
+ * considers the connection interactive, so it has to be set after each
+ * read to stay in effect.
+ */
+bool unixSetQuickAck(int fd);
+
+/**
+ * Addresses which aren't OS addresses are only parsed if they are numeric,
+ * so this never blocks on a name lookup. Names translate to an address
+ * without entries and have to be resolved through UnixResolver first.
+ */
+std::variant<UnixNetworkAddress, UnixNetworkAddress *>
+translateNetworkAddressToUnixNetworkAddress(NetworkAddress &addr);
+
+UnixNetworkAddress &translateToUnixAddressRef(
+	std::variant<UnixNetworkAddress, UnixNetworkAddress *> &addr_variant);
+
+constexpr size_t UNIX_RESOLVER_THREADS = 2;
+constexpr size_t UNIX_RESOLVER_CACHE_SIZE = 1024;
+/**
+ * getaddrinfo doesn't report the TTL of records, so resolved names are kept
+ * for a fixed time
+ */
+constexpr std::chrono::seconds UNIX_RESOLVER_TTL{30};
+
+/**
+ * Resolves names with getaddrinfo on worker threads, so a slow lookup doesn't
+ * stall the event loop. Numeric addresses are parsed right away. Results are
+ * cached and concurrent lookups of the same name share one request.
+ */
+class UnixResolver {
+private:
+	class CompletionEvent final : public CrossThreadEvent {
+	private:
+		UnixResolver &resolver;
+
+	public:
+		CompletionEvent(EventLoop &loop, UnixResolver &resolver);
+
+		void fire() override;
+	};
+
+	struct Lookup {
+		std::string key;
+		std::string host;
+		uint16_t port;
+	};
+
+	struct Resolved {
+		std::string key;
+		std::vector<SocketAddress> addresses;
+	};
+
+	struct CacheEntry {
+		std::vector<SocketAddress> addresses;
+		std::chrono::steady_clock::time_point expires;
+	};
+
+	struct Waiting {
+		std::string path;
+		uint16_t port;
+		std::vector<Own<ConveyorFeeder<Own<NetworkAddress>>>> feeders;
+	};
+
+	// Shared with the workers
+	std::mutex mutex;
+	std::condition_variable lookup_available;
+	std::deque<Lookup> lookups;
+	std::vector<Resolved> resolved;
+	bool stopping = false;
+
+	std::vector<std::thread> workers;
+	CompletionEvent completion_event;
+
+	std::unordered_map<std::string, CacheEntry> cache;
+	std::unordered_map<std::string, Waiting> waiting;
+
+	void work();
+	void deliver();
+	void store(const std::string &key,
+			   const std::vector<SocketAddress> &addresses);
+
+public:
+	UnixResolver(EventLoop &loop);
+	/**
+	 * Waits for running lookups, since getaddrinfo can't be cancelled
+	 */
+	~UnixResolver();
+
+	SAW_FORBID_COPY(UnixResolver);
+	SAW_FORBID_MOVE(UnixResolver);
+
+	/**
+	 * Fails with a critical error if the name has no addresses
+	 */
+	Conveyor<Own<NetworkAddress>> resolve(const std::string &path,
+										  uint16_t port_hint);
+};
+
+/**
+ * Runs connect right away for numeric and OS addresses. Names are resolved
+ * through resolver first, so the lookup doesn't block the event loop.
+ */
+Conveyor<Own<IoStream>> unixConnectResolving(
+	UnixResolver &resolver, NetworkAddress &addr,
+	std::function<Conveyor<Own<IoStream>>(UnixNetworkAddress &)> connect);
+
+/**
+ * Orders addresses by alternating between the address families, starting
+ * with the family of the first address (RFC 8305 section 4)
+ */
+std::vector<SocketAddress>
+interleaveAddressFamilies(std::vector<SocketAddress> &&addresses);
+
+/**
+ * Delay before the next connect attempt starts while the previous ones are
+ * still pending (RFC 8305 section 5)
+ */
+constexpr std::chrono::milliseconds UNIX_CONNECT_ATTEMPT_DELAY{250};
+
+/**
+ * Races non blocking connects to all resolved addresses. A new attempt is
+ * started after UNIX_CONNECT_ATTEMPT_DELAY or as soon as an attempt failed,
+ * the first established connection wins and the other attempts are closed.
+ */
+class UnixConnectOperation {
+private:
+	class Attempt final : public IFdOwner {
+	private:
+		UnixConnectOperation &operation;
+
+	public:
+		/// Set once the socket reported writability or an error
+		bool done = false;
+
+		Attempt(UnixConnectOperation &operation, UnixEventPort &event_port,
+				int file_descriptor);
+
+		void notify(uint32_t mask) override;
+	};
+
+	/**
+	 * Attempts are only evaluated from the loop, since finishing one destroys
+	 * the others, which might still be in the current epoll batch
+	 */
+	class SettleEvent final : public Event {
+	private:
+		UnixConnectOperation &operation;
+
+	public:
+		SettleEvent(EventLoop &loop, UnixConnectOperation &operation);
+
+		void fire() override;
+	};
+
+	class StartEvent final : public TimerEvent {
+	private:
+		UnixConnectOperation &operation;
+
+	public:
+		StartEvent(EventLoop &loop, UnixConnectOperation &operation);
+
+		void fire() override;
+	};
+
+	UnixEventPort &event_port;
+	std::vector<SocketAddress> addresses;
+	SocketOptions options;
+	size_t next_address = 0;
+
+	std::vector<Own<Attempt>> attempts;
+	SettleEvent settle_event;
+	StartEvent start_event;
+
+	Own<ConveyorFeeder<Own<IoStream>>> feeder;
+
+	void startNext();
+	void settle();
+	void finish(int fd);
+
+public:
+	UnixConnectOperation(UnixEventPort &event_port, EventLoop &event_loop,
+						 std::vector<SocketAddress> &&addresses,
+						 const SocketOptions &options,
+						 Own<ConveyorFeeder<Own<IoStream>>> feeder);
+
+	SAW_FORBID_COPY(UnixConnectOperation);
+	SAW_FORBID_MOVE(UnixConnectOperation);
+
+	void start();
+};
+
 class UnixNetwork final : public Network {
 private:
 	UnixEventPort &event_port;
+	EventLoop &event_loop;
+	UnixResolver resolver;
+
+public:
+	UnixNetwork(UnixEventPort &event_port, EventLoop &event_loop);
+
+	Conveyor<Own<NetworkAddress>> parseAddress(const std::string &address,
+											   uint16_t port_hint = 0) override;
+
+	Own<Server> listen(NetworkAddress &addr) override;
+	Own<Server> listen(NetworkAddress &addr,
+					   const ListenOptions &options) override;
+
+	Conveyor<Own<IoStream>> connect(NetworkAddress &addr) override;
+	Conveyor<Own<IoStream>> connect(NetworkAddress &addr,
+									const SocketOptions &options) override;
+
+	Own<Datagram> datagram(NetworkAddress &addr) override;
+	Own<Datagram> datagram(NetworkAddress &addr,
+						   const SocketOptions &options) override;
+};
+
+constexpr size_t UNIX_FILE_THREADS = 2;
+
+/**
+ * Descriptor shared by a file stream and its running jobs. It's closed once
+ * the last of them is gone, so a worker never touches a reused descriptor.
+ */
+class UnixFileDescriptor {
+private:
+	int file_descriptor;
+
+public:
+	UnixFileDescriptor(int file_descriptor);
+	~UnixFileDescriptor();
+
+	SAW_FORBID_COPY(UnixFileDescriptor);
+	SAW_FORBID_MOVE(UnixFileDescriptor);
+
+	int get() const { return file_descriptor; }
+};
+
+class UnixFileStream;
+
+/**
+ * Runs pread and pwrite on worker threads which are started on first use.
+ * Jobs own their buffers, so a stream may be destroyed while its job runs.
+ */
+class UnixFileWorkers {
+public:
+	struct Job {
+		Our<UnixFileDescriptor> file;
+		bool write;
+		uint64_t offset;
+		/// Data to write, or the read destination resized to the read amount
+		std::vector<uint8_t> buffer;
+
+		// Written by the worker
+		size_t transferred = 0;
+		int error = 0;
+
+		// Only used on the thread of the loop
+		UnixFileStream *owner;
+	};
+
+private:
+	class CompletionEvent final : public CrossThreadEvent {
+	private:
+		UnixFileWorkers &workers;
+
+	public:
+		CompletionEvent(EventLoop &loop, UnixFileWorkers &workers);
+
+		void fire() override;
+	};
+
+	// Shared with the workers
+	std::mutex mutex;
+	std::condition_variable job_available;
+	std::deque<Own<Job>> jobs;
+	std::vector<Own<Job>> finished;
+	bool stopping = false;
+
+	std::vector<std::thread> workers;
+	CompletionEvent completion_event;
+
+	void work();
+	void deliver();
+
+public:
+	UnixFileWorkers(EventLoop &loop);
+	/**
+	 * Waits for running jobs. Queued jobs are dropped.
+	 */
+	~UnixFileWorkers();
+
+	SAW_FORBID_COPY(UnixFileWorkers);
+	SAW_FORBID_MOVE(UnixFileWorkers);
+
+	void submit(Own<Job> job);
+};
+
+class UnixFileStream final : public AsyncFileStream {
+private:
+	UnixFileWorkers &workers;
+	Our<UnixFileDescriptor> file;
+	FileOptions options;
+
+	/// Read-ahead data in [read_begin, read_buffer.size())
+	std::vector<uint8_t> read_buffer;
+	size_t read_begin = 0;
+	/// File offset behind the read-ahead data
+	uint64_t read_offset = 0;
+	bool read_end = false;
+	bool read_end_reported = false;
+	UnixFileWorkers::Job *read_job = nullptr;
+
+	struct ReadTask {
+		void *buffer;
+		size_t min_length;
+		size_t max_length;
+		size_t already_read;
+	};
+	Maybe<ReadTask> read_task;
+
+	uint64_t write_offset = 0;
+	UnixFileWorkers::Job *write_job = nullptr;
+
+	Own<ConveyorFeeder<size_t>> read_done = nullptr;
+	Own<ConveyorFeeder<void>> on_read_disconnect = nullptr;
+	Own<ConveyorFeeder<size_t>> write_done = nullptr;
+
+	void readStep();
+	void fillReadAhead(size_t wanted);
+
+	void completeRead(UnixFileWorkers::Job &job);
+	void completeWrite(UnixFileWorkers::Job &job);
+
+	friend class UnixFileWorkers;
+	void complete(UnixFileWorkers::Job &job);
+
+public:
+	UnixFileStream(UnixFileWorkers &workers, int file_descriptor,
+				   const FileOptions &options);
+	~UnixFileStream();
+
+	void read(void *buffer, size_t min_length, size_t max_length) override;
+
+	Conveyor<size_t> readDone() override;
+
+	Conveyor<void> onReadDisconnected() override;
+
+	/**
+	 * The data is copied, so the buffer may be reused right away
+	 */
+	void write(const void *buffer, size_t length) override;
+
+	Conveyor<size_t> writeDone() override;
+};
+
+/**
+ * Opens path with the hints of options applied. Shared by the providers.
+ */
+ErrorOr<Own<AsyncFileStream>> unixOpenFile(UnixFileWorkers &workers,
+										   const std::string &path,
+										   FileMode mode,
+										   const FileOptions &options);
+
+/**
+ * Capacity of each direction of a shared memory stream. Has to be a power of
+ * two, so ring positions wrap with a mask.
+ */
+constexpr size_t UNIX_SHARED_MEMORY_RING_SIZE = 256 * 1024;
+
+/**
+ * Control block in front of each ring. Positions only grow and are stored by
+ * one side each, so neither side takes a lock or enters the kernel while the
+ * other one keeps up. The waiting flags announce a side which is about to
+ * wait on its eventfd and has to be signaled.
+ */
+struct UnixSharedMemoryRing {
+	/// Bytes written so far, stored by the producer
+	alignas(64) std::atomic<uint64_t> head;
+	/// Bytes read so far, stored by the consumer
+	alignas(64) std::atomic<uint64_t> tail;
+
+	alignas(64) std::atomic<uint32_t> reader_waiting;
+	std::atomic<uint32_t> writer_waiting;
+	/// Set by the side which went away
+	std::atomic<uint32_t> closed;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+				  std::atomic<uint32_t>::is_always_lock_free,
+			  "Shared memory rings need address free atomics");
+
+constexpr size_t UNIX_SHARED_MEMORY_RING_STRIDE =
+	sizeof(UnixSharedMemoryRing) + UNIX_SHARED_MEMORY_RING_SIZE;
+/// Ring 0 carries data from the client to the server, ring 1 the answers
+constexpr size_t UNIX_SHARED_MEMORY_LENGTH = 2 * UNIX_SHARED_MEMORY_RING_STRIDE;
+
+/**
+ * Stream over two single producer single consumer rings in a memfd mapped by
+ * both processes. Eventfds are only signaled if the peer announced that it
+ * waits, so steady traffic doesn't need any syscalls.
+ * The unix socket the memory was passed over stays open to detect the peer
+ * going away.
+ */
+class UnixSharedMemoryStream final : public IoStream {
+private:
+	/**
+	 * Eventfd the peer signals while this side waits on a ring
+	 */
+	class Wakeup final : public IFdOwner {
+	private:
+		Own<ConveyorFeeder<void>> &feeder;
+
+	public:
+		Wakeup(UnixEventPort &event_port, int file_descriptor,
+			   Own<ConveyorFeeder<void>> &feeder);
+
+		void notify(uint32_t mask) override;
+	};
+
+	Own<IoStream> control;
+	uint8_t *mapping;
+
+	UnixSharedMemoryRing &input;
+	uint8_t *input_data;
+	UnixSharedMemoryRing &output;
+	uint8_t *output_data;
+
+	Own<ConveyorFeeder<void>> read_ready = nullptr;
+	Own<ConveyorFeeder<void>> write_ready = nullptr;
+
+	Wakeup input_data_ready;
+	Wakeup output_space_ready;
+	/// Signaled to the peer, the watched ones are owned by the wakeups
+	int input_space_fd;
+	int output_data_fd;
+
+public:
+	/**
+	 * Takes ownership of the mapping and of the data and space eventfds of
+	 * ring 0 followed by those of ring 1
+	 */
+	UnixSharedMemoryStream(UnixEventPort &event_port, Own<IoStream> control,
+						   uint8_t *mapping,
+						   const std::array<int, 4> &event_fds,
+						   bool server_side);
+	~UnixSharedMemoryStream();
+
+	SAW_FORBID_COPY(UnixSharedMemoryStream);
+	SAW_FORBID_MOVE(UnixSharedMemoryStream);
+
+	ErrorOr<size_t> read(void *buffer, size_t length) override;
+
+	Conveyor<void> readReady() override;
+
+	Conveyor<void> onReadDisconnected() override;
+
+	ErrorOr<size_t> write(const void *buffer, size_t length) override;
+
+	Conveyor<void> writeReady() override;
+};
+
+/**
+ * Accepts on a unix socket and hands each connection its shared memory
+ * before it's delivered. Removes the socket path on destruction.
+ */
+class UnixSharedMemoryServer final : public Server {
+private:
+	/**
+	 * Pauses accepting on the control socket once the accept conveyor is
+	 * full. Deferred, since the control subscription can't be dropped from
+	 * within its own callback.
+	 */
+	class PauseEvent final : public Event {
+	private:
+		UnixSharedMemoryServer &server;
+
+	public:
+		PauseEvent(UnixSharedMemoryServer &server);
+
+		void fire() override;
+	};
+
+	UnixEventPort &event_port;
+	Own<UnixServer> control;
+	std::string path;
+
+	Own<ConveyorFeeder<Own<IoStream>>> accept_feeder = nullptr;
+	SinkConveyor control_accepting;
+	bool accepting = false;
+	Own<PauseEvent> pause_event = nullptr;
+
+	size_t max_pending_accepts = SERVER_DEFAULT_MAX_PENDING_ACCEPTS;
+	uint64_t pauses = 0;
+	uint64_t handshake_errors = 0;
+	/// Counters of the control socket merged with the handshake ones
+	mutable ServerMetrics server_metrics;
+
+	/**
+	 * Passes the shared memory to a new client. A failed handshake only
+	 * closes that client's control connection.
+	 */
+	void handshake(Own<IoStream> connection);
+	void updateAccepting();
 
 public:
-	UnixNetwork(UnixEventPort &event_port);
+	UnixSharedMemoryServer(UnixEventPort &event_port, Own<UnixServer> control,
+						   const std::string &path);
+	~UnixSharedMemoryServer();
+
+	Conveyor<Own<IoStream>> accept() override;
+
+	void setMaxPendingAccepts(size_t limit) override;
+
+	const ServerMetrics &metrics() const override;
+};
+
+/**
+ * Network of UnixSharedMemoryStreams between processes on the same host.
+ * Addresses are unix socket paths, optionally prefixed with "unix:", ports
+ * are ignored.
+ */
+class UnixSharedMemoryNetwork final : public Network {
+private:
+	UnixEventPort &event_port;
+	EventLoop &event_loop;
+
+public:
+	UnixSharedMemoryNetwork(UnixEventPort &event_port, EventLoop &event_loop);
 
 	Conveyor<Own<NetworkAddress>> parseAddress(const std::string &address,
 											   uint16_t port_hint = 0) override;
 
 	Own<Server> listen(NetworkAddress &addr) override;
+	Own<Server> listen(NetworkAddress &addr,
+					   const ListenOptions &options) override;
 
+	/**
+	 * Socket options don't apply to the shared memory and are ignored
+	 */
 	Conveyor<Own<IoStream>> connect(NetworkAddress &addr) override;
+	Conveyor<Own<IoStream>> connect(NetworkAddress &addr,
+									const SocketOptions &options) override;
 
+	/**
+	 * Not supported
+	 */
 	Own<Datagram> datagram(NetworkAddress &addr) override;
+	Own<Datagram> datagram(NetworkAddress &addr,
+						   const SocketOptions &options) override;
 };
 
 class UnixIoProvider final : public IoProvider {
@@ -453,14 +1258,24 @@ private:
 	EventLoop event_loop;
 
 	UnixNetwork unix_network;
+	UnixSharedMemoryNetwork shared_memory_network;
+	UnixFileWorkers file_workers;
 
 public:
 	UnixIoProvider(UnixEventPort &port_ref, Own<EventPort> port);
 
 	Network &network() override;
 
+	Network *sharedMemoryNetwork() override;
+
 	Own<InputStream> wrapInputFd(int fd) override;
 
+	ErrorOr<Own<AsyncFileStream>>
+	openFile(const std::string &path, FileMode mode,
+			 const FileOptions &options) override;
+
+	Own<Server> wrapListenFd(int fd, const ListenOptions &options) override;
+
 	EventLoop &eventLoop();
 };
 } // namespace unix
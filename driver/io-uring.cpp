@@ -0,0 +1,1247 @@
+#include "driver/io-uring.h"
+
+#include <poll.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+
+namespace saw {
+namespace unix {
+UringRequest::UringRequest(UringEventPort &event_port, IUringOwner &owner,
+						   bool with_buffer)
+	: event_port{event_port}, owner{&owner} {
+	memset(&address, 0, sizeof(address));
+	if (with_buffer) {
+		event_port.acquireBuffer(*this);
+	}
+}
+
+UringRequest::~UringRequest() { event_port.releaseBuffer(*this); }
+
+UringEventPort::UringEventPort()
+	: ring_fd{-1}, features{0}, signal_fd{-1}, wake_fd{-1} {
+	::signal(SIGPIPE, SIG_IGN);
+
+	if (!setupRing()) {
+		return;
+	}
+
+	::sigemptyset(&signal_fd_set);
+	signal_fd = ::signalfd(-1, &signal_fd_set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0) {
+		return;
+	}
+	signal_request = heap<UringRequest>(*this, *this, false);
+
+	wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd < 0) {
+		return;
+	}
+	wake_request = heap<UringRequest>(*this, *this, false);
+	submitPoll(*wake_request, wake_fd, POLLIN, true);
+
+	/*
+	 * Registered buffers save the page pinning on every read and write.
+	 * Registration fails with a low RLIMIT_MEMLOCK, which only costs that
+	 * optimization.
+	 */
+	size_t fixed_size = URING_BUFFER_SIZE * URING_FIXED_BUFFER_COUNT;
+	void *fixed = ::mmap(nullptr, fixed_size, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (fixed == MAP_FAILED) {
+		return;
+	}
+
+	std::vector<struct ::iovec> iovecs;
+	iovecs.resize(URING_FIXED_BUFFER_COUNT);
+	for (size_t i = 0; i < URING_FIXED_BUFFER_COUNT; ++i) {
+		iovecs[i].iov_base =
+			static_cast<uint8_t *>(fixed) + i * URING_BUFFER_SIZE;
+		iovecs[i].iov_len = URING_BUFFER_SIZE;
+	}
+	int rc = ::syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS,
+					   iovecs.data(), URING_FIXED_BUFFER_COUNT);
+	if (rc < 0) {
+		::munmap(fixed, fixed_size);
+		return;
+	}
+
+	fixed_buffers = static_cast<uint8_t *>(fixed);
+	free_fixed_buffers.reserve(URING_FIXED_BUFFER_COUNT);
+	for (size_t i = URING_FIXED_BUFFER_COUNT; i > 0; --i) {
+		free_fixed_buffers.push_back(static_cast<int>(i - 1));
+	}
+}
+
+UringEventPort::~UringEventPort() {
+	if (ring_fd >= 0) {
+		/*
+		 * Give cancelled requests the chance to complete, so the kernel
+		 * doesn't touch their buffers after they are freed.
+		 */
+		struct ::__kernel_timespec timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = 1000000;
+		for (size_t i = 0; i < 16 && !orphaned_requests.empty(); ++i) {
+			if (enter(true, &timeout).isError()) {
+				break;
+			}
+			reapCompletions();
+		}
+	}
+
+	// Still owned by the kernel, so they are leaked with their buffers
+	for (auto &iter : orphaned_requests) {
+		(void)iter.second.release();
+	}
+	orphaned_requests.clear();
+	signal_request = nullptr;
+	wake_request = nullptr;
+
+	if (ring_fd >= 0) {
+		::close(ring_fd);
+	}
+	if (sqes != MAP_FAILED) {
+		::munmap(sqes, sqes_size);
+	}
+	if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+		::munmap(cq_ring, cq_ring_size);
+	}
+	if (sq_ring != MAP_FAILED) {
+		::munmap(sq_ring, sq_ring_size);
+	}
+	if (fixed_buffers) {
+		::munmap(fixed_buffers, URING_BUFFER_SIZE * URING_FIXED_BUFFER_COUNT);
+	}
+	::close(signal_fd);
+	::close(wake_fd);
+}
+
+bool UringEventPort::setupRing() {
+	struct ::io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int fd = static_cast<int>(
+		::syscall(__NR_io_uring_setup, URING_ENTRIES, &params));
+	if (fd < 0) {
+		return false;
+	}
+	ring_fd = fd;
+	features = params.features;
+
+	// Timed waits are passed directly to io_uring_enter (since 5.11)
+	if (!(features & IORING_FEAT_EXT_ARG)) {
+		return false;
+	}
+
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_size = params.cq_off.cqes +
+				   params.cq_entries * sizeof(struct ::io_uring_cqe);
+	if (features & IORING_FEAT_SINGLE_MMAP) {
+		sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+		cq_ring_size = sq_ring_size;
+	}
+
+	sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+					 MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		return false;
+	}
+
+	if (features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ring = sq_ring;
+	} else {
+		cq_ring =
+			::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			return false;
+		}
+	}
+
+	sqes_size = params.sq_entries * sizeof(struct ::io_uring_sqe);
+	void *sqes_ptr =
+		::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqes_ptr == MAP_FAILED) {
+		return false;
+	}
+	sqes = static_cast<struct ::io_uring_sqe *>(sqes_ptr);
+
+	uint8_t *sq = static_cast<uint8_t *>(sq_ring);
+	sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+	sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+	sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+	sq_entries = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+	sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+	sq_local_tail = *sq_tail;
+
+	uint8_t *cq = static_cast<uint8_t *>(cq_ring);
+	cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+	cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+	cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<struct ::io_uring_cqe *>(cq + params.cq_off.cqes);
+
+	return true;
+}
+
+bool UringEventPort::isValid() const {
+	return ring_fd >= 0 && sqes != MAP_FAILED && signal_fd >= 0 &&
+		   wake_fd >= 0;
+}
+
+bool UringEventPort::submissionRingFull() const {
+	unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	return sq_local_tail - head >= sq_entries;
+}
+
+struct ::io_uring_sqe *UringEventPort::ringSqe() {
+	unsigned index = sq_local_tail & sq_mask;
+	struct ::io_uring_sqe *sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[index] = index;
+
+	++sq_local_tail;
+	++to_submit;
+
+	return sqe;
+}
+
+void UringEventPort::moveOverflow() {
+	while (!overflow_sqes.empty() && !submissionRingFull()) {
+		*ringSqe() = overflow_sqes.front();
+		overflow_sqes.pop_front();
+	}
+}
+
+struct ::io_uring_sqe *UringEventPort::nextSqe() {
+	if (overflow_sqes.empty() && submissionRingFull()) {
+		// The submission ring is full, so hand it to the kernel right away
+		keepError(submitAndWait(false, nullptr));
+	}
+	if (overflow_sqes.empty() && !submissionRingFull()) {
+		return ringSqe();
+	}
+
+	// Queued behind earlier overflow, so submissions keep their order
+	struct ::io_uring_sqe &sqe = overflow_sqes.emplace_back();
+	memset(&sqe, 0, sizeof(sqe));
+	return &sqe;
+}
+
+struct ::io_uring_sqe *
+UringEventPort::prepare(UringRequest &request, uint8_t opcode, int fd) {
+	struct ::io_uring_sqe *sqe = nextSqe();
+
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = reinterpret_cast<uint64_t>(&request);
+
+	request.opcode = opcode;
+	request.in_flight = true;
+
+	return sqe;
+}
+
+void UringEventPort::flushSubmissions() {
+	__atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+}
+
+ErrorOr<void>
+UringEventPort::submitAndWait(bool wait_for_completion,
+							  const struct ::__kernel_timespec *timeout) {
+	flushSubmissions();
+	if (to_submit == 0 && !wait_for_completion) {
+		return Void{};
+	}
+
+	unsigned flags = 0;
+	unsigned min_complete = 0;
+	struct ::io_uring_getevents_arg arg;
+	void *arg_ptr = nullptr;
+	size_t arg_size = 0;
+
+	if (wait_for_completion) {
+		flags |= IORING_ENTER_GETEVENTS;
+		min_complete = 1;
+		if (timeout) {
+			memset(&arg, 0, sizeof(arg));
+			arg.ts = reinterpret_cast<uint64_t>(timeout);
+			flags |= IORING_ENTER_EXT_ARG;
+			arg_ptr = &arg;
+			arg_size = sizeof(arg);
+		}
+	}
+
+	long rc = ::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+						flags, arg_ptr, arg_size);
+	if (rc >= 0) {
+		to_submit -= std::min(static_cast<unsigned>(rc), to_submit);
+		return Void{};
+	}
+
+	switch (errno) {
+	case EINTR:
+	case ETIME:
+		// Interrupted by a signal or timed out, which only ends this turn
+		return Void{};
+	case EBUSY:
+	case EAGAIN:
+		/*
+		 * The completion ring is full or the kernel is short on memory.
+		 * Reaping makes room and unsubmitted entries go in next time.
+		 */
+		return Void{};
+	default:
+		return criticalError("io_uring_enter failed");
+	}
+}
+
+ErrorOr<void>
+UringEventPort::enter(bool wait_for_completion,
+					  const struct ::__kernel_timespec *timeout) {
+	// Overflow is submitted first, so waiting doesn't hold it back
+	moveOverflow();
+	while (!overflow_sqes.empty()) {
+		unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+		ErrorOr<void> submitted = submitAndWait(false, nullptr);
+		if (submitted.isError()) {
+			return submitted;
+		}
+		if (__atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == head) {
+			// The kernel is busy, the rest goes in next turn
+			break;
+		}
+		moveOverflow();
+	}
+
+	return submitAndWait(wait_for_completion, timeout);
+}
+
+void UringEventPort::keepError(ErrorOr<void> &&result) {
+	if (result.isError() && !ring_error) {
+		ring_error = std::move(result.error());
+	}
+}
+
+const Maybe<Error> &UringEventPort::ringError() const { return ring_error; }
+
+void UringEventPort::reapCompletions() {
+	unsigned head = *cq_head;
+	while (true) {
+		unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			break;
+		}
+
+		struct ::io_uring_cqe &cqe = cqes[head & cq_mask];
+		uint64_t user_data = cqe.user_data;
+		int32_t result = cqe.res;
+		uint32_t flags = cqe.flags;
+
+		++head;
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+		// Cancel requests carry no request
+		if (user_data == 0) {
+			continue;
+		}
+
+		UringRequest *request = reinterpret_cast<UringRequest *>(user_data);
+		if (!(flags & IORING_CQE_F_MORE)) {
+			request->in_flight = false;
+		}
+
+		if (request->owner) {
+			request->owner->complete(*request, result, flags);
+		} else if (!request->in_flight) {
+			orphaned_requests.erase(request);
+		}
+	}
+}
+
+void UringEventPort::notifySignalListener(int sig) {
+	Signal signal = Signal::Terminate;
+	if (sig == SIGUSR1) {
+		signal = Signal::User1;
+	}
+
+	auto equal_range = signal_conveyors.equal_range(signal);
+	for (auto iter = equal_range.first; iter != equal_range.second; ++iter) {
+		if (iter->second) {
+			if (iter->second->space() > 0) {
+				iter->second->feed();
+			}
+		}
+	}
+}
+
+Conveyor<void> UringEventPort::onSignal(Signal signal) {
+	auto caf = newConveyorAndFeeder<void>();
+
+	signal_conveyors.insert(std::make_pair(signal, std::move(caf.feeder)));
+
+	std::vector<int> sig;
+	switch (signal) {
+	case Signal::User1:
+		sig = {SIGUSR1};
+		break;
+	case Signal::Terminate:
+	default:
+		sig = {SIGTERM, SIGQUIT, SIGINT};
+		break;
+	}
+
+	for (auto iter = sig.begin(); iter != sig.end(); ++iter) {
+		::sigaddset(&signal_fd_set, *iter);
+	}
+	::sigprocmask(SIG_BLOCK, &signal_fd_set, nullptr);
+	::signalfd(signal_fd, &signal_fd_set, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	if (signal_request && !signal_request->in_flight) {
+		submitPoll(*signal_request, signal_fd, POLLIN, true);
+	}
+
+	auto node_and_storage =
+		Conveyor<void>::fromConveyor(std::move(caf.conveyor));
+	return Conveyor<void>::toConveyor(std::move(node_and_storage.first),
+									  node_and_storage.second);
+}
+
+void UringEventPort::poll() {
+	keepError(enter(false, nullptr));
+	reapCompletions();
+}
+
+void UringEventPort::wait() {
+	keepError(enter(true, nullptr));
+	reapCompletions();
+}
+
+void UringEventPort::wait(const std::chrono::steady_clock::duration &duration) {
+	auto nanoseconds =
+		std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	if (nanoseconds <= 0) {
+		poll();
+		return;
+	}
+
+	struct ::__kernel_timespec timeout;
+	timeout.tv_sec = nanoseconds / 1000000000;
+	timeout.tv_nsec = nanoseconds % 1000000000;
+
+	keepError(enter(true, &timeout));
+	reapCompletions();
+}
+
+void UringEventPort::wait(
+	const std::chrono::steady_clock::time_point &time_point) {
+	auto now = std::chrono::steady_clock::now();
+	if (time_point <= now) {
+		poll();
+	} else {
+		wait(time_point - now);
+	}
+}
+
+void UringEventPort::wake() {
+	if (wake_fd < 0) {
+		return;
+	}
+	// The eventfd counter only saturates, so every write wakes the loop
+	uint64_t value = 1;
+	::write(wake_fd, &value, sizeof(value));
+}
+
+void UringEventPort::complete(UringRequest &request, int32_t result,
+							  uint32_t flags) {
+	if (result < 0) {
+		return;
+	}
+
+	if (&request == signal_request.get()) {
+		while (1) {
+			struct ::signalfd_siginfo siginfo;
+			ssize_t n = ::read(signal_fd, &siginfo, sizeof(siginfo));
+			if (n < 0) {
+				break;
+			}
+			assert(n == sizeof(siginfo));
+
+			notifySignalListener(siginfo.ssi_signo);
+		}
+		if (!(flags & IORING_CQE_F_MORE)) {
+			submitPoll(request, signal_fd, POLLIN, true);
+		}
+	} else if (&request == wake_request.get()) {
+		uint64_t value;
+		::read(wake_fd, &value, sizeof(value));
+		if (!(flags & IORING_CQE_F_MORE)) {
+			submitPoll(request, wake_fd, POLLIN, true);
+		}
+	}
+}
+
+bool UringEventPort::acquireBuffer(UringRequest &request) {
+	if (!free_fixed_buffers.empty()) {
+		int index = free_fixed_buffers.back();
+		free_fixed_buffers.pop_back();
+
+		request.buffer = fixed_buffers + index * URING_BUFFER_SIZE;
+		request.buffer_index = index;
+	} else {
+		request.buffer = new uint8_t[URING_BUFFER_SIZE];
+		request.buffer_index = -1;
+	}
+	request.buffer_size = URING_BUFFER_SIZE;
+	return request.buffer_index >= 0;
+}
+
+void UringEventPort::releaseBuffer(UringRequest &request) {
+	if (!request.buffer) {
+		return;
+	}
+	if (request.buffer_index >= 0) {
+		free_fixed_buffers.push_back(request.buffer_index);
+	} else {
+		delete[] request.buffer;
+	}
+	request.buffer = nullptr;
+	request.buffer_size = 0;
+	request.buffer_index = -1;
+}
+
+void UringEventPort::submitRead(UringRequest &request, int fd, size_t offset,
+								size_t length) {
+	assert(offset + length <= request.buffer_size);
+	bool fixed = request.buffer_index >= 0;
+	struct ::io_uring_sqe *sqe =
+		prepare(request, fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, fd);
+	sqe->addr = reinterpret_cast<uint64_t>(request.buffer + offset);
+	sqe->len = static_cast<uint32_t>(length);
+	// Read from the current position, which sockets and pipes ignore
+	sqe->off = static_cast<uint64_t>(-1);
+	if (fixed) {
+		sqe->buf_index = static_cast<uint16_t>(request.buffer_index);
+	}
+}
+
+void UringEventPort::submitWrite(UringRequest &request, int fd, size_t offset,
+								 size_t length) {
+	assert(offset + length <= request.buffer_size);
+	bool fixed = request.buffer_index >= 0;
+	struct ::io_uring_sqe *sqe =
+		prepare(request, fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd);
+	sqe->addr = reinterpret_cast<uint64_t>(request.buffer + offset);
+	sqe->len = static_cast<uint32_t>(length);
+	sqe->off = static_cast<uint64_t>(-1);
+	if (fixed) {
+		sqe->buf_index = static_cast<uint16_t>(request.buffer_index);
+	}
+}
+
+void UringEventPort::submitAccept(UringRequest &request, int fd,
+								  bool multishot) {
+	struct ::io_uring_sqe *sqe = prepare(request, IORING_OP_ACCEPT, fd);
+	request.address_length = sizeof(request.address);
+	sqe->addr = reinterpret_cast<uint64_t>(&request.address);
+	sqe->addr2 = reinterpret_cast<uint64_t>(&request.address_length);
+	sqe->accept_flags = SOCK_CLOEXEC;
+	if (multishot) {
+		sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+	}
+}
+
+void UringEventPort::submitConnect(UringRequest &request, int fd) {
+	struct ::io_uring_sqe *sqe = prepare(request, IORING_OP_CONNECT, fd);
+	sqe->addr = reinterpret_cast<uint64_t>(&request.address);
+	sqe->off = request.address_length;
+}
+
+void UringEventPort::submitPoll(UringRequest &request, int fd,
+								uint32_t poll_mask, bool multishot) {
+	struct ::io_uring_sqe *sqe = prepare(request, IORING_OP_POLL_ADD, fd);
+	sqe->poll32_events = poll_mask;
+	if (multishot) {
+		sqe->len = IORING_POLL_ADD_MULTI;
+	}
+}
+
+void UringEventPort::submitCancel(UringRequest &request) {
+	struct ::io_uring_sqe *sqe = nextSqe();
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = reinterpret_cast<uint64_t>(&request);
+	sqe->user_data = 0;
+}
+
+void UringEventPort::orphan(Own<UringRequest> request) {
+	if (!request || !request->in_flight) {
+		return;
+	}
+
+	request->owner = nullptr;
+	submitCancel(*request);
+
+	UringRequest *request_ptr = request.get();
+	orphaned_requests.emplace(request_ptr, std::move(request));
+}
+
+UringIoStream::UringIoStream(UringEventPort &event_port, int file_descriptor)
+	: event_port{event_port}, file_descriptor{file_descriptor},
+	  read_request{heap<UringRequest>(event_port, *this, true)} {
+	// Data is pulled in as soon as it arrives instead of waiting for readiness
+	submitRead();
+}
+
+UringIoStream::~UringIoStream() {
+	event_port.orphan(std::move(read_request));
+	event_port.orphan(std::move(write_request));
+	::close(file_descriptor);
+}
+
+void UringIoStream::submitRead() {
+	if (read_request->in_flight || read_disconnected || read_failed) {
+		return;
+	}
+
+	read_begin = 0;
+	read_end = 0;
+	event_port.submitRead(*read_request, file_descriptor, 0,
+						  read_request->buffer_size);
+}
+
+void UringIoStream::submitWrite() {
+	write_submitted = write_end;
+	event_port.submitWrite(*write_request, file_descriptor, write_begin,
+						   write_submitted - write_begin);
+}
+
+void UringIoStream::setQuickAck(bool enabled) {
+	quick_ack = enabled && unixSetQuickAck(file_descriptor);
+}
+
+void UringIoStream::completeRead(int32_t result) {
+	if (result > 0) {
+		if (quick_ack) {
+			unixSetQuickAck(file_descriptor);
+		}
+		read_begin = 0;
+		read_end = static_cast<size_t>(result);
+	} else if (result == -EAGAIN) {
+		// Non blocking descriptors need an explicit readiness request
+		event_port.submitPoll(*read_request, file_descriptor, POLLIN, false);
+		return;
+	} else if (result == -EINTR) {
+		submitRead();
+		return;
+	} else {
+		if (result == 0) {
+			read_disconnected = true;
+		} else {
+			read_failed = true;
+		}
+
+		if (on_read_disconnect) {
+			on_read_disconnect->feed();
+		}
+	}
+
+	if (read_ready) {
+		read_ready->feed();
+	}
+}
+
+void UringIoStream::completeWrite(int32_t result) {
+	if (result > 0) {
+		write_begin += static_cast<size_t>(result);
+		assert(write_begin <= write_submitted);
+
+		if (write_begin == write_end) {
+			write_begin = 0;
+			write_submitted = 0;
+			write_end = 0;
+		} else {
+			// Nothing is in flight, so the remainder can move to the front
+			size_t remaining = write_end - write_begin;
+			memmove(write_request->buffer, write_request->buffer + write_begin,
+					remaining);
+			write_begin = 0;
+			write_end = remaining;
+			submitWrite();
+		}
+	} else if (result == -EAGAIN) {
+		event_port.submitPoll(*write_request, file_descriptor, POLLOUT, false);
+		return;
+	} else if (result == -EINTR) {
+		submitWrite();
+		return;
+	} else {
+		write_failed = true;
+	}
+
+	if (write_ready) {
+		write_ready->feed();
+	}
+}
+
+ErrorOr<size_t> UringIoStream::read(void *buffer, size_t length) {
+	if (read_begin < read_end) {
+		size_t n = std::min(length, read_end - read_begin);
+		memcpy(buffer, read_request->buffer + read_begin, n);
+		read_begin += n;
+
+		if (read_begin == read_end) {
+			submitRead();
+		}
+		return n;
+	}
+
+	if (read_disconnected) {
+		return criticalError("Disconnected", Error::Code::Disconnected);
+	}
+	if (read_failed) {
+		return criticalError("Read failed", Error::Code::Disconnected);
+	}
+
+	submitRead();
+	return recoverableError("Currently busy");
+}
+
+Conveyor<void> UringIoStream::readReady() {
+	auto caf = newConveyorAndFeeder<void>();
+	read_ready = std::move(caf.feeder);
+	if (read_begin < read_end || read_disconnected || read_failed) {
+		read_ready->feed();
+	}
+	return std::move(caf.conveyor);
+}
+
+Conveyor<void> UringIoStream::onReadDisconnected() {
+	auto caf = newConveyorAndFeeder<void>();
+	on_read_disconnect = std::move(caf.feeder);
+	if (read_disconnected || read_failed) {
+		on_read_disconnect->feed();
+	}
+	return std::move(caf.conveyor);
+}
+
+ErrorOr<size_t> UringIoStream::write(const void *buffer, size_t length) {
+	IoVector segment{const_cast<void *>(buffer), length};
+	return writev(std::span<const IoVector>{&segment, 1});
+}
+
+ErrorOr<size_t> UringIoStream::writev(std::span<const IoVector> segments) {
+	if (write_failed) {
+		return criticalError("Disconnected", Error::Code::Disconnected);
+	}
+
+	if (!write_request) {
+		write_request = heap<UringRequest>(event_port, *this, true);
+	}
+
+	size_t staged = 0;
+	for (const IoVector &segment : segments) {
+		size_t space = write_request->buffer_size - write_end;
+		size_t n = std::min(segment.length, space);
+		memcpy(write_request->buffer + write_end, segment.data, n);
+		write_end += n;
+		staged += n;
+
+		if (n < segment.length) {
+			break;
+		}
+	}
+
+	if (staged == 0) {
+		return recoverableError("Currently busy");
+	}
+
+	if (!write_request->in_flight) {
+		submitWrite();
+	}
+
+	return staged;
+}
+
+Conveyor<void> UringIoStream::writeReady() {
+	auto caf = newConveyorAndFeeder<void>();
+	write_ready = std::move(caf.feeder);
+	return std::move(caf.conveyor);
+}
+
+void UringIoStream::complete(UringRequest &request, int32_t result,
+							 uint32_t flags) {
+	(void)flags;
+	bool readiness = request.opcode == IORING_OP_POLL_ADD;
+
+	if (&request == read_request.get()) {
+		if (readiness && result >= 0) {
+			submitRead();
+		} else {
+			completeRead(result);
+		}
+	} else if (&request == write_request.get()) {
+		if (readiness && result >= 0) {
+			submitWrite();
+		} else {
+			completeWrite(result);
+		}
+	}
+}
+
+UringServer::RetryEvent::RetryEvent(UringServer &server) : server{server} {}
+
+void UringServer::RetryEvent::fire() {
+	if (!server.paused) {
+		server.resume();
+	}
+}
+
+UringServer::UringServer(UringEventPort &event_port, int file_descriptor,
+						 const SocketOptions &options)
+	: event_port{event_port}, file_descriptor{file_descriptor},
+	  accept_request{heap<UringRequest>(event_port, *this, false)},
+	  quick_ack{options.quick_ack} {}
+
+UringServer::~UringServer() {
+	event_port.orphan(std::move(accept_request));
+	::close(file_descriptor);
+}
+
+Conveyor<Own<IoStream>> UringServer::accept() {
+	auto caf = newConveyorAndFeeder<Own<IoStream>>();
+	accept_feeder = std::move(caf.feeder);
+	accept_feeder->onTaken([this]() {
+		if (paused && accept_feeder->queued() < max_pending_accepts) {
+			resume();
+		}
+	});
+
+	paused = false;
+	resume();
+	return std::move(caf.conveyor);
+}
+
+void UringServer::setMaxPendingAccepts(size_t limit) {
+	max_pending_accepts = std::max<size_t>(limit, 1);
+	if (paused && accept_feeder &&
+		accept_feeder->queued() < max_pending_accepts) {
+		resume();
+	}
+}
+
+const ServerMetrics &UringServer::metrics() const { return server_metrics; }
+
+Maybe<int> UringServer::listenFd() const { return file_descriptor; }
+
+void UringServer::resume() {
+	paused = false;
+	// A cancelled request is resubmitted by its final completion
+	if (!accept_request->in_flight) {
+		event_port.submitAccept(*accept_request, file_descriptor, multishot);
+	}
+}
+
+void UringServer::complete(UringRequest &request, int32_t result,
+						   uint32_t flags) {
+	if (result >= 0) {
+		if (accept_feeder) {
+			Own<UringIoStream> stream = heap<UringIoStream>(event_port, result);
+			if (quick_ack) {
+				stream->setQuickAck(true);
+			}
+			accept_feeder->feed(std::move(stream));
+			++server_metrics.accepted;
+
+			if (!paused && accept_feeder->queued() >= max_pending_accepts) {
+				// Further connections stay in the kernel backlog
+				paused = true;
+				++server_metrics.pauses;
+				if (flags & IORING_CQE_F_MORE) {
+					event_port.submitCancel(request);
+				}
+			}
+		} else {
+			::close(result);
+		}
+	} else if (result == -EINVAL && multishot) {
+		// Multishot accepts exist since 5.19
+		multishot = false;
+	} else if (result != -EINTR && result != -EAGAIN &&
+			   result != -ECONNABORTED && result != -ECANCELED) {
+		// EMFILE, ENFILE, ENOMEM and the like fail again right away
+		++server_metrics.accept_errors;
+		if (!(flags & IORING_CQE_F_MORE)) {
+			if (!retry_event) {
+				retry_event = heap<RetryEvent>(*this);
+			}
+			if (!retry_event->isScheduled()) {
+				retry_event->armAfter(UNIX_ACCEPT_RETRY_DELAY);
+			}
+		}
+		return;
+	}
+
+	if (!(flags & IORING_CQE_F_MORE) && !paused) {
+		event_port.submitAccept(request, file_descriptor, multishot);
+	}
+}
+
+UringConnectOperation::UringConnectOperation(
+	UringEventPort &event_port, std::vector<SocketAddress> &&addresses,
+	const SocketOptions &options, Own<ConveyorFeeder<Own<IoStream>>> feeder)
+	: event_port{event_port}, addresses{std::move(addresses)},
+	  options{options},
+	  connect_request{heap<UringRequest>(event_port, *this, false)},
+	  feeder{std::move(feeder)} {}
+
+UringConnectOperation::~UringConnectOperation() {
+	event_port.orphan(std::move(connect_request));
+	if (file_descriptor >= 0) {
+		::close(file_descriptor);
+	}
+}
+
+void UringConnectOperation::start() { connectNext(); }
+
+void UringConnectOperation::connectNext() {
+	while (next_address < addresses.size()) {
+		SocketAddress &address = addresses[next_address++];
+
+		/*
+		 * The socket stays blocking. io_uring only waits in the kernel for
+		 * blocking descriptors instead of reporting EAGAIN.
+		 */
+		int family = address.getRaw()->sa_family;
+		file_descriptor = ::socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (file_descriptor < 0) {
+			continue;
+		}
+		if (!unixApplySocketOptions(file_descriptor, family, SOCK_STREAM,
+									options)) {
+			::close(file_descriptor);
+			file_descriptor = -1;
+			continue;
+		}
+
+		memcpy(&connect_request->address, address.getRaw(),
+			   address.getRawLength());
+		connect_request->address_length = address.getRawLength();
+
+		event_port.submitConnect(*connect_request, file_descriptor);
+		return;
+	}
+
+	if (feeder) {
+		feeder->fail(criticalError("Couldn't connect"));
+	}
+}
+
+void UringConnectOperation::complete(UringRequest &request, int32_t result,
+									 uint32_t flags) {
+	(void)request;
+	(void)flags;
+
+	if (result == 0) {
+		if (feeder) {
+			Own<UringIoStream> stream =
+				heap<UringIoStream>(event_port, file_descriptor);
+			if (options.quick_ack) {
+				stream->setQuickAck(true);
+			}
+			feeder->feed(std::move(stream));
+		} else {
+			::close(file_descriptor);
+		}
+		file_descriptor = -1;
+		return;
+	}
+
+	::close(file_descriptor);
+	file_descriptor = -1;
+	connectNext();
+}
+
+UringDatagram::UringDatagram(UringEventPort &event_port, int file_descriptor)
+	: event_port{event_port}, file_descriptor{file_descriptor},
+	  read_poll{heap<UringRequest>(event_port, *this, false)},
+	  write_poll{heap<UringRequest>(event_port, *this, false)} {}
+
+UringDatagram::~UringDatagram() {
+	event_port.orphan(std::move(read_poll));
+	event_port.orphan(std::move(write_poll));
+	::close(file_descriptor);
+}
+
+void UringDatagram::armReadPoll() {
+	if (!read_poll->in_flight) {
+		event_port.submitPoll(*read_poll, file_descriptor, POLLIN, false);
+	}
+}
+
+void UringDatagram::armWritePoll() {
+	if (!write_poll->in_flight) {
+		event_port.submitPoll(*write_poll, file_descriptor, POLLOUT, false);
+	}
+}
+
+ErrorOr<size_t> UringDatagram::read(void *buffer, size_t length) {
+	ssize_t read_bytes = ::recv(file_descriptor, buffer, length, 0);
+	if (read_bytes > 0) {
+		return static_cast<size_t>(read_bytes);
+	}
+
+	armReadPoll();
+	return recoverableError("Currently busy");
+}
+
+ErrorOr<size_t> UringDatagram::read(void *buffer, size_t length,
+									NetworkAddress *&source) {
+	ErrorOr<size_t> read_bytes =
+		unixReadFrom(file_descriptor, buffer, length, source_address);
+	if (read_bytes.isValue()) {
+		source = &source_address;
+	} else {
+		armReadPoll();
+	}
+	return read_bytes;
+}
+
+Conveyor<void> UringDatagram::readReady() {
+	auto caf = newConveyorAndFeeder<void>();
+	read_ready = std::move(caf.feeder);
+	armReadPoll();
+	return std::move(caf.conveyor);
+}
+
+ErrorOr<size_t> UringDatagram::write(const void *buffer, size_t length,
+									 NetworkAddress &dest) {
+	UnixNetworkAddress &unix_dest = static_cast<UnixNetworkAddress &>(dest);
+	SocketAddress &sock_addr = unix_dest.unixAddress();
+	ssize_t write_bytes =
+		::sendto(file_descriptor, buffer, length, 0, sock_addr.getRaw(),
+				 sock_addr.getRawLength());
+	if (write_bytes > 0) {
+		return static_cast<size_t>(write_bytes);
+	}
+
+	armWritePoll();
+	return recoverableError("Currently busy");
+}
+
+ErrorOr<size_t> UringDatagram::write(const void *buffer, size_t length) {
+	ssize_t write_bytes = ::send(file_descriptor, buffer, length, 0);
+	if (write_bytes > 0) {
+		return static_cast<size_t>(write_bytes);
+	}
+
+	armWritePoll();
+	return recoverableError("Currently busy");
+}
+
+Conveyor<void> UringDatagram::writeReady() {
+	auto caf = newConveyorAndFeeder<void>();
+	write_ready = std::move(caf.feeder);
+	return std::move(caf.conveyor);
+}
+
+ErrorOr<void> UringDatagram::connect(NetworkAddress &peer) {
+	return unixConnectDatagram(file_descriptor, peer);
+}
+
+Own<DatagramBatch> UringDatagram::newBatch(size_t count, size_t packet_size) {
+	return heap<UnixDatagramBatch>(count, packet_size);
+}
+
+ErrorOr<size_t> UringDatagram::readBatch(DatagramBatch &batch) {
+	ErrorOr<size_t> received = unixReadBatch(
+		file_descriptor, static_cast<UnixDatagramBatch &>(batch));
+	if (received.isError() && received.error().isRecoverable()) {
+		armReadPoll();
+	}
+	return received;
+}
+
+ErrorOr<size_t> UringDatagram::writeBatch(DatagramBatch &batch, size_t count) {
+	ErrorOr<size_t> sent = unixWriteBatch(
+		file_descriptor, static_cast<UnixDatagramBatch &>(batch), count);
+	if (sent.isError() && sent.error().isRecoverable()) {
+		armWritePoll();
+	}
+	return sent;
+}
+
+bool UringDatagram::setReceiveOffload(bool enabled) {
+	return unixSetReceiveOffload(file_descriptor, enabled);
+}
+
+void UringDatagram::complete(UringRequest &request, int32_t result,
+							 uint32_t flags) {
+	(void)flags;
+	if (result < 0) {
+		return;
+	}
+
+	if (&request == read_poll.get()) {
+		if (read_ready) {
+			read_ready->feed();
+		}
+	} else if (&request == write_poll.get()) {
+		if (write_ready) {
+			write_ready->feed();
+		}
+	}
+}
+
+UringNetwork::UringNetwork(UringEventPort &event_port, EventLoop &event_loop)
+	: event_port{event_port}, resolver{event_loop} {}
+
+Conveyor<Own<NetworkAddress>>
+UringNetwork::parseAddress(const std::string &path, uint16_t port_hint) {
+	return resolver.resolve(path, port_hint);
+}
+
+Own<Server> UringNetwork::listen(NetworkAddress &addr) {
+	return listen(addr, ListenOptions{});
+}
+
+Own<Server> UringNetwork::listen(NetworkAddress &addr,
+								 const ListenOptions &options) {
+	auto unix_addr_storage = translateNetworkAddressToUnixNetworkAddress(addr);
+	UnixNetworkAddress &address = translateToUnixAddressRef(unix_addr_storage);
+
+	// Names have to be resolved with parseAddress first
+	if (address.unixAddressSize() == 0) {
+		return nullptr;
+	}
+
+	SocketAddress &sock_addr = address.unixAddress(0);
+	int family = sock_addr.getRaw()->sa_family;
+	int fd = ::socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return nullptr;
+	}
+
+	if (!unixApplySocketOptions(fd, family, SOCK_STREAM, options.socket) ||
+		!unixListenSocket(fd, sock_addr, options)) {
+		::close(fd);
+		return nullptr;
+	}
+
+	return heap<UringServer>(event_port, fd, options.socket);
+}
+
+Conveyor<Own<IoStream>> UringNetwork::connect(NetworkAddress &addr) {
+	return connect(addr, SocketOptions{});
+}
+
+Conveyor<Own<IoStream>> UringNetwork::connect(NetworkAddress &addr,
+											  const SocketOptions &options) {
+	return unixConnectResolving(
+		resolver, addr,
+		[this, options](
+			UnixNetworkAddress &address) -> Conveyor<Own<IoStream>> {
+			if (address.unixAddressSize() == 0) {
+				return Conveyor<Own<IoStream>>{
+					criticalError("No address found")};
+			}
+
+			std::vector<SocketAddress> addresses;
+			for (size_t i = 0; i < address.unixAddressSize(); ++i) {
+				addresses.push_back(address.unixAddress(i));
+			}
+
+			auto caf = newConveyorAndFeeder<Own<IoStream>>();
+			Own<UringConnectOperation> operation = heap<UringConnectOperation>(
+				event_port, interleaveAddressFamilies(std::move(addresses)),
+				options, std::move(caf.feeder));
+			operation->start();
+
+			return caf.conveyor.attach(std::move(operation));
+		});
+}
+
+Own<Datagram> UringNetwork::datagram(NetworkAddress &addr) {
+	return datagram(addr, SocketOptions{});
+}
+
+Own<Datagram> UringNetwork::datagram(NetworkAddress &addr,
+									 const SocketOptions &options) {
+	auto unix_addr_storage = translateNetworkAddressToUnixNetworkAddress(addr);
+	UnixNetworkAddress &address = translateToUnixAddressRef(unix_addr_storage);
+
+	// Names have to be resolved with parseAddress first
+	if (address.unixAddressSize() == 0) {
+		return nullptr;
+	}
+
+	int fd = address.unixAddress(0).socket(SOCK_DGRAM, options);
+	if (fd < 0) {
+		return nullptr;
+	}
+
+	int optval = 1;
+	int rc =
+		::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+	if (rc < 0) {
+		::close(fd);
+		return nullptr;
+	}
+
+	bool failed = address.unixAddress(0).bind(fd);
+	if (failed) {
+		::close(fd);
+		return nullptr;
+	}
+
+	return heap<UringDatagram>(event_port, fd);
+}
+
+UringIoProvider::UringIoProvider(UringEventPort &port_ref, Own<EventPort> port)
+	: event_port{port_ref}, event_loop{std::move(port)},
+	  uring_network{port_ref, event_loop}, file_workers{event_loop} {}
+
+Network &UringIoProvider::network() {
+	return static_cast<Network &>(uring_network);
+}
+
+Own<InputStream> UringIoProvider::wrapInputFd(int fd) {
+	return heap<UringIoStream>(event_port, fd);
+}
+
+ErrorOr<Own<AsyncFileStream>>
+UringIoProvider::openFile(const std::string &path, FileMode mode,
+						  const FileOptions &options) {
+	return unixOpenFile(file_workers, path, mode, options);
+}
+
+Own<Server> UringIoProvider::wrapListenFd(int fd,
+										  const ListenOptions &options) {
+	return heap<UringServer>(event_port, fd, options.socket);
+}
+
+EventLoop &UringIoProvider::eventLoop() { return event_loop; }
+
+ErrorOr<AsyncIoContext> setupUringAsyncIo() {
+	try {
+		Own<UringEventPort> prt = heap<UringEventPort>();
+		if (!prt->isValid()) {
+			return criticalError("Couldn't set up io_uring");
+		}
+		UringEventPort &prt_ref = *prt;
+
+		Own<UringIoProvider> io_provider =
+			heap<UringIoProvider>(prt_ref, std::move(prt));
+
+		EventLoop &loop_ref = io_provider->eventLoop();
+
+		return {{std::move(io_provider), loop_ref, prt_ref,
+				 AsyncIoBackend::Uring}};
+	} catch (std::bad_alloc &) {
+		return criticalError("Out of memory");
+	}
+}
+} // namespace unix
+} // namespace saw
@@ -0,0 +1,443 @@
+#pragma once
+
+#ifndef SAW_UNIX
+#error "Don't include this"
+#endif
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "driver/io-unix.h"
+
+namespace saw {
+namespace unix {
+constexpr unsigned URING_ENTRIES = 256;
+constexpr size_t URING_BUFFER_SIZE = 16 * 1024;
+/**
+ * Amount of buffers registered with the kernel. Streams beyond this count use
+ * plain heap buffers.
+ */
+constexpr size_t URING_FIXED_BUFFER_COUNT = 64;
+
+class UringEventPort;
+class UringRequest;
+
+class IUringOwner {
+public:
+	virtual ~IUringOwner() = default;
+
+	/**
+	 * Called for every completion of a request submitted by this owner.
+	 * flags contains IORING_CQE_F_MORE if a multishot request stays active.
+	 */
+	virtual void complete(UringRequest &request, int32_t result,
+						  uint32_t flags) = 0;
+};
+
+/**
+ * State of a single submitted operation. The kernel may access the request
+ * until its final completion is posted, so requests of destroyed owners are
+ * handed over to the event port with UringEventPort::orphan.
+ */
+class UringRequest {
+private:
+	UringEventPort &event_port;
+
+public:
+	IUringOwner *owner;
+	bool in_flight = false;
+	uint8_t opcode = IORING_OP_NOP;
+
+	uint8_t *buffer = nullptr;
+	size_t buffer_size = 0;
+	/// Index of the registered buffer or -1 if it is heap allocated
+	int buffer_index = -1;
+
+	struct ::sockaddr_storage address;
+	socklen_t address_length = 0;
+
+	UringRequest(UringEventPort &event_port, IUringOwner &owner,
+				 bool with_buffer);
+	~UringRequest();
+
+	SAW_FORBID_COPY(UringRequest);
+	SAW_FORBID_MOVE(UringRequest);
+};
+
+/**
+ * Completion based event port. Operations are only queued on the submission
+ * ring and handed to the kernel in the same io_uring_enter call which waits
+ * for completions.
+ */
+class UringEventPort final : public EventPort, public IUringOwner {
+private:
+	int ring_fd;
+	unsigned features;
+
+	void *sq_ring = MAP_FAILED;
+	size_t sq_ring_size = 0;
+	void *cq_ring = MAP_FAILED;
+	size_t cq_ring_size = 0;
+	struct ::io_uring_sqe *sqes = static_cast<::io_uring_sqe *>(MAP_FAILED);
+	size_t sqes_size = 0;
+
+	unsigned *sq_head = nullptr;
+	unsigned *sq_tail = nullptr;
+	unsigned sq_mask = 0;
+	unsigned sq_entries = 0;
+	unsigned *sq_array = nullptr;
+	unsigned sq_local_tail = 0;
+	unsigned to_submit = 0;
+
+	unsigned *cq_head = nullptr;
+	unsigned *cq_tail = nullptr;
+	unsigned cq_mask = 0;
+	struct ::io_uring_cqe *cqes = nullptr;
+
+	int signal_fd;
+	sigset_t signal_fd_set;
+	std::unordered_multimap<Signal, Own<ConveyorFeeder<void>>> signal_conveyors;
+	Own<UringRequest> signal_request;
+
+	int wake_fd;
+	Own<UringRequest> wake_request;
+
+	uint8_t *fixed_buffers = nullptr;
+	std::vector<int> free_fixed_buffers;
+
+	std::unordered_map<UringRequest *, Own<UringRequest>> orphaned_requests;
+
+	/**
+	 * Submissions prepared while the submission ring was full. They move to
+	 * the ring in order once the kernel took earlier entries.
+	 */
+	std::deque<struct ::io_uring_sqe> overflow_sqes;
+
+	/// First io_uring_enter failure which can't be retried
+	Maybe<Error> ring_error;
+
+	bool setupRing();
+
+	bool submissionRingFull() const;
+	struct ::io_uring_sqe *ringSqe();
+	void moveOverflow();
+
+	struct ::io_uring_sqe *nextSqe();
+	struct ::io_uring_sqe *prepare(UringRequest &request, uint8_t opcode,
+								   int fd);
+	void flushSubmissions();
+	ErrorOr<void> submitAndWait(bool wait_for_completion,
+								const struct ::__kernel_timespec *timeout);
+	ErrorOr<void> enter(bool wait_for_completion,
+						const struct ::__kernel_timespec *timeout);
+	void keepError(ErrorOr<void> &&result);
+	void reapCompletions();
+
+	void notifySignalListener(int sig);
+
+public:
+	UringEventPort();
+	~UringEventPort();
+
+	SAW_FORBID_COPY(UringEventPort);
+	SAW_FORBID_MOVE(UringEventPort);
+
+	/**
+	 * False if the kernel refused to set up a ring
+	 */
+	bool isValid() const;
+
+	/**
+	 * Set once io_uring_enter failed for a reason other than an interrupted
+	 * or timed out wait or a busy kernel. No further completions arrive then.
+	 */
+	const Maybe<Error> &ringError() const;
+
+	Conveyor<void> onSignal(Signal signal) override;
+
+	void poll() override;
+	void wait() override;
+	void wait(const std::chrono::steady_clock::duration &) override;
+	void wait(const std::chrono::steady_clock::time_point &) override;
+
+	void wake() override;
+
+	void complete(UringRequest &request, int32_t result,
+				  uint32_t flags) override;
+
+	bool acquireBuffer(UringRequest &request);
+	void releaseBuffer(UringRequest &request);
+
+	/**
+	 * Queue a read into request.buffer[offset, offset+length).
+	 * Uses the registered buffer variant if the request owns one.
+	 */
+	void submitRead(UringRequest &request, int fd, size_t offset,
+					size_t length);
+	void submitWrite(UringRequest &request, int fd, size_t offset,
+					 size_t length);
+	void submitAccept(UringRequest &request, int fd, bool multishot);
+	void submitConnect(UringRequest &request, int fd);
+	void submitPoll(UringRequest &request, int fd, uint32_t poll_mask,
+					bool multishot);
+	void submitCancel(UringRequest &request);
+
+	/**
+	 * Takes over a request whose owner is about to be destroyed. In flight
+	 * requests are cancelled and freed after their final completion.
+	 */
+	void orphan(Own<UringRequest> request);
+};
+
+class UringIoStream final : public IoStream, public IUringOwner {
+private:
+	UringEventPort &event_port;
+	int file_descriptor;
+
+	Own<UringRequest> read_request;
+	size_t read_begin = 0;
+	size_t read_end = 0;
+	bool read_disconnected = false;
+	bool read_failed = false;
+
+	/**
+	 * [write_begin, write_submitted) is owned by the kernel,
+	 * [write_submitted, write_end) is staged for the next submission.
+	 */
+	Own<UringRequest> write_request;
+	size_t write_begin = 0;
+	size_t write_submitted = 0;
+	size_t write_end = 0;
+	bool write_failed = false;
+
+	Own<ConveyorFeeder<void>> read_ready = nullptr;
+	Own<ConveyorFeeder<void>> on_read_disconnect = nullptr;
+	Own<ConveyorFeeder<void>> write_ready = nullptr;
+
+	/// TCP_QUICKACK is set again after each read, since the kernel clears it
+	bool quick_ack = false;
+
+	void submitRead();
+	void submitWrite();
+
+	void completeRead(int32_t result);
+	void completeWrite(int32_t result);
+
+public:
+	UringIoStream(UringEventPort &event_port, int file_descriptor);
+	~UringIoStream();
+
+	/**
+	 * See SocketOptions::quick_ack. Stays off if the socket doesn't
+	 * support it.
+	 */
+	void setQuickAck(bool enabled);
+
+	ErrorOr<size_t> read(void *buffer, size_t length) override;
+
+	Conveyor<void> readReady() override;
+
+	Conveyor<void> onReadDisconnected() override;
+
+	ErrorOr<size_t> write(const void *buffer, size_t length) override;
+
+	/**
+	 * Stages all segments before submitting, so they go out in one write
+	 */
+	using OutputStream::writev;
+	ErrorOr<size_t> writev(std::span<const IoVector> segments) override;
+
+	Conveyor<void> writeReady() override;
+
+	void complete(UringRequest &request, int32_t result,
+				  uint32_t flags) override;
+};
+
+class UringServer final : public Server, public IUringOwner {
+private:
+	/**
+	 * Resubmits the accept request a while after it failed, so a listener
+	 * out of descriptors or memory doesn't spin on immediate failures
+	 */
+	class RetryEvent final : public TimerEvent {
+	private:
+		UringServer &server;
+
+	public:
+		RetryEvent(UringServer &server);
+
+		void fire() override;
+	};
+
+	UringEventPort &event_port;
+	int file_descriptor;
+
+	Own<UringRequest> accept_request;
+	bool multishot = true;
+
+	Own<ConveyorFeeder<Own<IoStream>>> accept_feeder = nullptr;
+
+	size_t max_pending_accepts = SERVER_DEFAULT_MAX_PENDING_ACCEPTS;
+	/// Set while the accept request is cancelled because of pending accepts
+	bool paused = false;
+
+	ServerMetrics server_metrics;
+
+	/// Not inherited from the listener, so it's set on each connection
+	bool quick_ack;
+
+	Own<RetryEvent> retry_event = nullptr;
+
+	void resume();
+
+public:
+	UringServer(UringEventPort &event_port, int file_descriptor,
+				const SocketOptions &options = {});
+	~UringServer();
+
+	Conveyor<Own<IoStream>> accept() override;
+
+	Maybe<int> listenFd() const override;
+
+	void setMaxPendingAccepts(size_t limit) override;
+
+	const ServerMetrics &metrics() const override;
+
+	void complete(UringRequest &request, int32_t result,
+				  uint32_t flags) override;
+};
+
+/**
+ * Tries the resolved addresses in order until one connects
+ */
+class UringConnectOperation final : public IUringOwner {
+private:
+	UringEventPort &event_port;
+	std::vector<SocketAddress> addresses;
+	SocketOptions options;
+	size_t next_address = 0;
+	int file_descriptor = -1;
+
+	Own<UringRequest> connect_request;
+	Own<ConveyorFeeder<Own<IoStream>>> feeder;
+
+	void connectNext();
+
+public:
+	UringConnectOperation(UringEventPort &event_port,
+						  std::vector<SocketAddress> &&addresses,
+						  const SocketOptions &options,
+						  Own<ConveyorFeeder<Own<IoStream>>> feeder);
+	~UringConnectOperation();
+
+	void start();
+
+	void complete(UringRequest &request, int32_t result,
+				  uint32_t flags) override;
+};
+
+/**
+ * Datagrams keep the readiness model, since every message carries its own
+ * address. Readiness is requested with poll operations on the ring.
+ */
+class UringDatagram final : public Datagram, public IUringOwner {
+private:
+	UringEventPort &event_port;
+	int file_descriptor;
+
+	Own<UringRequest> read_poll;
+	Own<UringRequest> write_poll;
+
+	Own<ConveyorFeeder<void>> read_ready = nullptr;
+	Own<ConveyorFeeder<void>> write_ready = nullptr;
+
+	UnixNetworkAddress source_address;
+
+	void armReadPoll();
+	void armWritePoll();
+
+public:
+	UringDatagram(UringEventPort &event_port, int file_descriptor);
+	~UringDatagram();
+
+	ErrorOr<size_t> read(void *buffer, size_t length) override;
+	ErrorOr<size_t> read(void *buffer, size_t length,
+						 NetworkAddress *&source) override;
+	Conveyor<void> readReady() override;
+
+	ErrorOr<size_t> write(const void *buffer, size_t length,
+						  NetworkAddress &dest) override;
+	ErrorOr<size_t> write(const void *buffer, size_t length) override;
+	Conveyor<void> writeReady() override;
+
+	ErrorOr<void> connect(NetworkAddress &peer) override;
+
+	Own<DatagramBatch> newBatch(size_t count, size_t packet_size) override;
+	ErrorOr<size_t> readBatch(DatagramBatch &batch) override;
+	ErrorOr<size_t> writeBatch(DatagramBatch &batch, size_t count) override;
+	bool setReceiveOffload(bool enabled) override;
+
+	void complete(UringRequest &request, int32_t result,
+				  uint32_t flags) override;
+};
+
+class UringNetwork final : public Network {
+private:
+	UringEventPort &event_port;
+	UnixResolver resolver;
+
+public:
+	UringNetwork(UringEventPort &event_port, EventLoop &event_loop);
+
+	Conveyor<Own<NetworkAddress>> parseAddress(const std::string &address,
+											   uint16_t port_hint = 0) override;
+
+	Own<Server> listen(NetworkAddress &addr) override;
+	Own<Server> listen(NetworkAddress &addr,
+					   const ListenOptions &options) override;
+
+	Conveyor<Own<IoStream>> connect(NetworkAddress &addr) override;
+	Conveyor<Own<IoStream>> connect(NetworkAddress &addr,
+									const SocketOptions &options) override;
+
+	Own<Datagram> datagram(NetworkAddress &addr) override;
+	Own<Datagram> datagram(NetworkAddress &addr,
+						   const SocketOptions &options) override;
+};
+
+class UringIoProvider final : public IoProvider {
+private:
+	UringEventPort &event_port;
+	EventLoop event_loop;
+
+	UringNetwork uring_network;
+	UnixFileWorkers file_workers;
+
+public:
+	UringIoProvider(UringEventPort &port_ref, Own<EventPort> port);
+
+	Network &network() override;
+
+	Own<InputStream> wrapInputFd(int fd) override;
+
+	/**
+	 * File io runs on worker threads as with the readiness based provider
+	 */
+	ErrorOr<Own<AsyncFileStream>>
+	openFile(const std::string &path, FileMode mode,
+			 const FileOptions &options) override;
+
+	/**
+	 * Exclusive wakeups don't apply, every connection completes only one
+	 * accept request anyway.
+	 */
+	Own<Server> wrapListenFd(int fd, const ListenOptions &options) override;
+
+	EventLoop &eventLoop();
+};
+
+ErrorOr<AsyncIoContext> setupUringAsyncIo();
+} // namespace unix
+} // namespace saw
@@ -2,6 +2,8 @@
 
 #include <algorithm>
 #include <cassert>
+#include <thread>
+#include <typeinfo>
 
 namespace saw {
 namespace {
@@ -156,6 +158,58 @@ void Event::disarm() {
 
 bool Event::isArmed() const { return prev != nullptr; }
 
+CrossThreadEvent::CrossThreadEvent() : Event{} {}
+
+CrossThreadEvent::CrossThreadEvent(EventLoop &loop) : Event{loop} {}
+
+CrossThreadEvent::~CrossThreadEvent() {
+	std::lock_guard<std::mutex> lock{loop.cross_thread_mutex};
+	auto &events = loop.cross_thread_events;
+	events.erase(std::remove(events.begin(), events.end(), this),
+				 events.end());
+}
+
+void CrossThreadEvent::armCrossThread() {
+	if (local_loop == &loop) {
+		armLater();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock{loop.cross_thread_mutex};
+		loop.cross_thread_events.push_back(this);
+	}
+
+	if (loop.event_port) {
+		loop.event_port->wake();
+	}
+}
+
+TimerEvent::TimerEvent() : Event{} {}
+
+TimerEvent::TimerEvent(EventLoop &loop) : Event{loop} {}
+
+TimerEvent::~TimerEvent() { cancel(); }
+
+void TimerEvent::armAt(const std::chrono::steady_clock::time_point &deadline) {
+	cancel();
+	entry = loop.timers.emplace(deadline, this);
+	scheduled = true;
+}
+
+void TimerEvent::armAfter(const std::chrono::steady_clock::duration &delay) {
+	armAt(std::chrono::steady_clock::now() + delay);
+}
+
+void TimerEvent::cancel() {
+	if (scheduled) {
+		loop.timers.erase(entry);
+		scheduled = false;
+	}
+}
+
+bool TimerEvent::isScheduled() const { return scheduled; }
+
 SinkConveyor::SinkConveyor() : node{nullptr} {}
 
 SinkConveyor::SinkConveyor(Own<ConveyorNode> &&node_p)
@@ -180,15 +234,105 @@ void EventLoop::leaveScope() {
 	local_loop = nullptr;
 }
 
+void EventLoop::armCrossThreadEvents() {
+	std::vector<CrossThreadEvent *> events;
+	{
+		std::lock_guard<std::mutex> lock{cross_thread_mutex};
+		if (cross_thread_events.empty()) {
+			return;
+		}
+		std::swap(events, cross_thread_events);
+	}
+
+	for (CrossThreadEvent *event : events) {
+		event->armLater();
+	}
+}
+
+void EventLoop::armTimers() {
+	if (timers.empty()) {
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	while (!timers.empty() && timers.begin()->first <= now) {
+		TimerEvent *event = timers.begin()->second;
+		timers.erase(timers.begin());
+		event->scheduled = false;
+		event->armLater();
+	}
+}
+
+std::chrono::steady_clock::time_point EventLoop::nextDeadline(
+	const std::chrono::steady_clock::time_point &deadline) const {
+	if (timers.empty()) {
+		return deadline;
+	}
+	return std::min(deadline, timers.begin()->first);
+}
+
 bool EventLoop::turnLoop() {
+	armCrossThreadEvents();
+	armTimers();
+
+	auto begin = std::chrono::steady_clock::now();
+
 	size_t turn_step = 0;
+	bool result = true;
 	while (head && turn_step < 65536) {
 		if (!turn()) {
-			return false;
+			result = false;
+			break;
 		}
 		++turn_step;
 	}
-	return true;
+
+	if (turn_step > 0) {
+		auto turn_time = std::chrono::steady_clock::now() - begin;
+
+		++loop_metrics.turns;
+		loop_metrics.events += turn_step;
+		loop_metrics.max_events_per_turn =
+			std::max<uint64_t>(loop_metrics.max_events_per_turn, turn_step);
+		loop_metrics.turn_time += turn_time;
+		loop_metrics.max_turn_time =
+			std::max(loop_metrics.max_turn_time, turn_time);
+	}
+
+	return result;
+}
+
+void EventLoop::fireWatched(Event &event) {
+	auto begin = std::chrono::steady_clock::now();
+
+	// Read before fire() since the event might destroy itself
+	const char *event_type = typeid(event).name();
+
+	event.fire();
+
+	auto end = std::chrono::steady_clock::now();
+	auto duration = end - begin;
+	if (duration < stall_threshold) {
+		return;
+	}
+
+	++loop_metrics.stalls;
+
+	EventLoopStall stall{event_type, duration, begin};
+	if (stall_history > 0) {
+		if (stall_records.size() >= stall_history) {
+			stall_records.pop_front();
+		}
+		stall_records.push_back(stall);
+	}
+
+	if (stall_handler) {
+		stall_handler(stall);
+	}
+}
+
+void EventLoop::recordWait(const std::chrono::steady_clock::time_point &begin) {
+	loop_metrics.wait_time += std::chrono::steady_clock::now() - begin;
 }
 
 bool EventLoop::turn() {
@@ -216,14 +360,27 @@ bool EventLoop::turn() {
 
 	next_insert_point = &head;
 
-	event->fire();
+	if (stall_threshold.count() > 0) {
+		fireWatched(*event);
+	} else {
+		event->fire();
+	}
 
 	return true;
 }
 
 bool EventLoop::wait(const std::chrono::steady_clock::duration &duration) {
 	if (event_port) {
-		event_port->wait(duration);
+		auto begin = std::chrono::steady_clock::now();
+		if (timers.empty()) {
+			event_port->wait(duration);
+		} else {
+			event_port->wait(nextDeadline(begin + duration));
+		}
+		recordWait(begin);
+	} else if (!head && !timers.empty()) {
+		std::this_thread::sleep_until(
+			nextDeadline(std::chrono::steady_clock::now() + duration));
 	}
 
 	return turnLoop();
@@ -231,7 +388,11 @@ bool EventLoop::wait(const std::chrono::steady_clock::duration &duration) {
 
 bool EventLoop::wait(const std::chrono::steady_clock::time_point &time_point) {
 	if (event_port) {
-		event_port->wait(time_point);
+		auto begin = std::chrono::steady_clock::now();
+		event_port->wait(nextDeadline(time_point));
+		recordWait(begin);
+	} else if (!head && !timers.empty()) {
+		std::this_thread::sleep_until(nextDeadline(time_point));
 	}
 
 	return turnLoop();
@@ -239,7 +400,16 @@ bool EventLoop::wait(const std::chrono::steady_clock::time_point &time_point) {
 
 bool EventLoop::wait() {
 	if (event_port) {
-		event_port->wait();
+		auto begin = std::chrono::steady_clock::now();
+		if (timers.empty()) {
+			event_port->wait();
+		} else {
+			event_port->wait(timers.begin()->first);
+		}
+		recordWait(begin);
+	} else if (!head && !timers.empty()) {
+		// Without a port only timers can make progress
+		std::this_thread::sleep_until(timers.begin()->first);
 	}
 
 	return turnLoop();
@@ -262,6 +432,27 @@ ConveyorSinks &EventLoop::daemon() {
 	return *daemon_sink;
 }
 
+const EventLoopMetrics &EventLoop::metrics() const { return loop_metrics; }
+
+void EventLoop::resetMetrics() { loop_metrics = EventLoopMetrics{}; }
+
+void EventLoop::setStallThreshold(
+	const std::chrono::steady_clock::duration &threshold, size_t history) {
+	stall_threshold = threshold;
+	stall_history = history;
+	while (stall_records.size() > stall_history) {
+		stall_records.pop_front();
+	}
+}
+
+void EventLoop::onStall(std::function<void(const EventLoopStall &)> handler) {
+	stall_handler = std::move(handler);
+}
+
+const std::deque<EventLoopStall> &EventLoop::stalls() const {
+	return stall_records;
+}
+
 WaitScope::WaitScope(EventLoop &loop) : loop{loop} { loop.enterScope(); }
 
 WaitScope::~WaitScope() { loop.leaveScope(); }
@@ -284,6 +475,9 @@ ImmediateConveyorNodeBase::ImmediateConveyorNodeBase()
 MergeConveyorNodeBase::MergeConveyorNodeBase()
 	: ConveyorEventStorage{nullptr} {}
 
+OrderedMergeConveyorNodeBase::OrderedMergeConveyorNodeBase()
+	: ConveyorEventStorage{nullptr} {}
+
 void ConveyorSinks::destroySinkConveyorNode(ConveyorNode &node) {
 	if (!isArmed()) {
 		armLast();
@@ -339,6 +533,156 @@ void AttachConveyorNodeBase::getResult(ErrorOrValue &err_or_val) noexcept {
 	}
 }
 
+AsyncSemaphore::Permit::Permit() : semaphore{nullptr} {}
+
+AsyncSemaphore::Permit::Permit(AsyncSemaphore &sem) : semaphore{&sem} {}
+
+AsyncSemaphore::Permit::~Permit() { release(); }
+
+AsyncSemaphore::Permit::Permit(Permit &&rhs) : semaphore{rhs.semaphore} {
+	rhs.semaphore = nullptr;
+}
+
+AsyncSemaphore::Permit &AsyncSemaphore::Permit::operator=(Permit &&rhs) {
+	if (this != &rhs) {
+		release();
+		semaphore = rhs.semaphore;
+		rhs.semaphore = nullptr;
+	}
+	return *this;
+}
+
+void AsyncSemaphore::Permit::release() {
+	if (semaphore) {
+		AsyncSemaphore *sem = semaphore;
+		semaphore = nullptr;
+		sem->release();
+	}
+}
+
+AsyncSemaphore::AsyncSemaphore(size_t permits) : available_permits{permits} {}
+
+AsyncSemaphore::~AsyncSemaphore() {
+	while (waiter_head) {
+		SemaphoreConveyorNode *waiter = waiter_head;
+		unlinkWaiter(*waiter);
+		waiter->fail(criticalError("Semaphore destroyed"));
+	}
+}
+
+void AsyncSemaphore::release() {
+	if (waiter_head) {
+		// The permit is passed on directly to keep the FIFO order
+		SemaphoreConveyorNode *waiter = waiter_head;
+		unlinkWaiter(*waiter);
+		waiter->grant(Permit{*this});
+	} else {
+		++available_permits;
+	}
+}
+
+void AsyncSemaphore::unlinkWaiter(SemaphoreConveyorNode &waiter) {
+	SAW_ASSERT(waiter.prev_waiter) { return; }
+
+	*waiter.prev_waiter = waiter.next_waiter;
+	if (waiter.next_waiter) {
+		waiter.next_waiter->prev_waiter = waiter.prev_waiter;
+	} else {
+		waiter_tail = waiter.prev_waiter;
+	}
+
+	waiter.next_waiter = nullptr;
+	waiter.prev_waiter = nullptr;
+	waiter.semaphore = nullptr;
+	--waiter_count;
+}
+
+Conveyor<AsyncSemaphore::Permit> AsyncSemaphore::acquire() {
+	Own<SemaphoreConveyorNode> node = heap<SemaphoreConveyorNode>(*this);
+	ConveyorStorage *storage_ptr = static_cast<ConveyorStorage *>(node.get());
+
+	if (available_permits > 0 && !waiter_head) {
+		--available_permits;
+		node->grant(Permit{*this});
+	} else {
+		node->prev_waiter = waiter_tail;
+		*waiter_tail = node.get();
+		waiter_tail = &node->next_waiter;
+		++waiter_count;
+	}
+
+	return Conveyor<Permit>::toConveyor(std::move(node), storage_ptr);
+}
+
+Maybe<AsyncSemaphore::Permit> AsyncSemaphore::tryAcquire() {
+	if (available_permits > 0 && !waiter_head) {
+		--available_permits;
+		return Permit{*this};
+	}
+	return std::nullopt;
+}
+
+size_t AsyncSemaphore::available() const { return available_permits; }
+
+size_t AsyncSemaphore::waiting() const { return waiter_count; }
+
+SemaphoreConveyorNode::SemaphoreConveyorNode(AsyncSemaphore &sem)
+	: ConveyorEventStorage{nullptr}, semaphore{&sem} {}
+
+SemaphoreConveyorNode::~SemaphoreConveyorNode() {
+	if (semaphore && prev_waiter) {
+		semaphore->unlinkWaiter(*this);
+	}
+}
+
+void SemaphoreConveyorNode::grant(AsyncSemaphore::Permit &&permit) {
+	semaphore = nullptr;
+	result = ErrorOr<AsyncSemaphore::Permit>{std::move(permit)};
+	armLater();
+}
+
+void SemaphoreConveyorNode::fail(Error &&error) {
+	semaphore = nullptr;
+	result = ErrorOr<AsyncSemaphore::Permit>{std::move(error)};
+	armLater();
+}
+
+void SemaphoreConveyorNode::getResult(ErrorOrValue &err_or_val) noexcept {
+	ErrorOr<AsyncSemaphore::Permit> &eov =
+		err_or_val.as<AsyncSemaphore::Permit>();
+	if (result.has_value()) {
+		eov = std::move(result.value());
+		result = std::nullopt;
+	} else {
+		eov = criticalError("No permit granted yet");
+	}
+}
+
+size_t SemaphoreConveyorNode::space() const { return 0; }
+
+size_t SemaphoreConveyorNode::queued() const {
+	return result.has_value() ? 1 : 0;
+}
+
+void SemaphoreConveyorNode::childHasFired() {
+	// Semaphore node has no children
+	assert(false);
+}
+
+void SemaphoreConveyorNode::parentHasFired() {
+	SAW_ASSERT(parent) { return; }
+
+	if (queued() > 0 && parent->space() > 0) {
+		armLater();
+	}
+}
+
+void SemaphoreConveyorNode::fire() {
+	if (parent && parent->space() > 0) {
+		parent->childHasFired();
+	}
+}
+
 void detachConveyor(Conveyor<void> &&conveyor) {
 	EventLoop &loop = currentEventLoop();
 	ConveyorSinks &sink = loop.daemon();
@@ -2,13 +2,18 @@
 
 #include "common.h"
 #include "error.h"
+#include "histogram.h"
 #include "timer.h"
 
+#include <deque>
 #include <functional>
 #include <limits>
 #include <list>
+#include <map>
+#include <mutex>
 #include <queue>
 #include <type_traits>
+#include <vector>
 
 namespace saw {
 class ConveyorNode {
@@ -31,6 +36,8 @@ private:
 	Event *next = nullptr;
 
 	friend class EventLoop;
+	friend class CrossThreadEvent;
+	friend class TimerEvent;
 
 public:
 	Event();
@@ -47,6 +54,55 @@ public:
 	bool isArmed() const;
 };
 
+/**
+ * Event which may additionally be armed from a different thread. The event is
+ * queued on its own loop and armed there during the next turn.
+ * The owner has to guarantee that the event isn't destroyed while another
+ * thread calls armCrossThread().
+ */
+class CrossThreadEvent : public Event {
+public:
+	CrossThreadEvent();
+	CrossThreadEvent(EventLoop &loop);
+	virtual ~CrossThreadEvent();
+
+	/**
+	 * Thread safe. Wakes the EventPort of the owning loop.
+	 */
+	void armCrossThread();
+};
+
+/**
+ * Event which is armed by its loop once the scheduled point in time has
+ * passed. Waiting on the loop doesn't block beyond the earliest deadline.
+ */
+class TimerEvent : public Event {
+private:
+	std::multimap<std::chrono::steady_clock::time_point,
+				  TimerEvent *>::iterator entry;
+	bool scheduled = false;
+
+	friend class EventLoop;
+
+public:
+	TimerEvent();
+	TimerEvent(EventLoop &loop);
+	virtual ~TimerEvent();
+
+	/**
+	 * Replaces a previously scheduled deadline
+	 */
+	void armAt(const std::chrono::steady_clock::time_point &deadline);
+	void armAfter(const std::chrono::steady_clock::duration &delay);
+
+	/**
+	 * Removes the deadline. An event which is already armed stays armed.
+	 */
+	void cancel();
+
+	bool isScheduled() const;
+};
+
 class ConveyorStorage {
 protected:
 	ConveyorStorage *parent = nullptr;
@@ -109,6 +165,11 @@ using ChainedConveyors = decltype(chainedConveyorType((T *)nullptr));
 template <typename Func, typename T>
 using ConveyorResult = ChainedConveyors<RemoveErrorOr<ReturnType<Func, T>>>;
 
+template <typename T> T removeConveyorType(Conveyor<T> *);
+
+template <typename T>
+using RemoveConveyor = decltype(removeConveyorType((T *)nullptr));
+
 struct PropagateError {
 public:
 	Error operator()(const Error &error) const;
@@ -127,6 +188,8 @@ public:
 	SinkConveyor &operator=(SinkConveyor &&) = default;
 };
 
+template <typename T> class ConveyorFeeder;
+
 template <typename T> class MergeConveyorNodeData;
 
 template <typename T> class MergeConveyor {
@@ -140,6 +203,19 @@ public:
 	void attach(Conveyor<T> conveyor);
 };
 
+template <typename T> class OrderedMergeConveyorNodeData;
+
+template <typename T> class OrderedMergeConveyor {
+private:
+	Lent<OrderedMergeConveyorNodeData<T>> data;
+
+public:
+	OrderedMergeConveyor(Lent<OrderedMergeConveyorNodeData<T>> d);
+	~OrderedMergeConveyor();
+
+	void attach(Conveyor<T> conveyor);
+};
+
 /**
  * Main interface for async operations.
  */
@@ -193,11 +269,64 @@ public:
 	 */
 	[[nodiscard]] Conveyor<T> limit(size_t val = 1);
 
+	/**
+	 * Passes every element to func which starts a sub chain and returns its
+	 * Conveyor. At most val elements are in flight at the same time. An
+	 * element counts as in flight until the first result of its sub chain has
+	 * been taken out of this node. Results are passed on in completion order.
+	 */
+	template <typename Func>
+	[[nodiscard]] Conveyor<RemoveConveyor<ReturnType<Func, T>>>
+	limitConcurrency(size_t val, Func &&func);
+
 	/**
 	 *
 	 */
 	[[nodiscard]] std::pair<Conveyor<T>, MergeConveyor<T>> merge();
 
+	/**
+	 * Merges conveyors whose elements are already sorted by the key returned
+	 * from key_func into one sorted stream. An element is only passed on once
+	 * every open input has an element queued. An input is closed by a
+	 * critical error. Errors are passed on immediately except for
+	 * Error::Code::Exhausted which only closes the input. Once every input
+	 * is closed and drained, the merged conveyor reports Exhausted itself.
+	 */
+	template <typename Func>
+	[[nodiscard]] std::pair<Conveyor<T>, OrderedMergeConveyor<T>>
+	mergeOrdered(Func &&key_func);
+
+	/**
+	 * Routes every element to one of n returned conveyors chosen by
+	 * hash_func(element) % n, so equal keys always end up in the same branch.
+	 * Each branch stores up to limit elements. Errors are passed to every
+	 * branch.
+	 */
+	template <typename Func>
+	[[nodiscard]] std::vector<Conveyor<T>>
+	partition(size_t n, Func &&hash_func,
+			  size_t limit = std::numeric_limits<size_t>::max());
+
+	/**
+	 * Routes every element into one of the provided feeders chosen by
+	 * hash_func(element) % feeders.size(). Together with feeders from
+	 * newCrossThreadConveyorAndFeeder() this hands each partition to a
+	 * different event loop.
+	 */
+	template <typename Func>
+	[[nodiscard]] SinkConveyor
+	partition(std::vector<Own<ConveyorFeeder<T>>> feeders, Func &&hash_func);
+
+	/**
+	 * Builds the sub chain with sub_chain(Conveyor<T>) and records the time
+	 * between an element entering and leaving it into histogram. The sub
+	 * chain has to pass on exactly one element or error per element and keep
+	 * their order. The histogram has to outlive the chain.
+	 */
+	template <typename Func>
+	[[nodiscard]] ReturnType<Func, Conveyor<T>>
+	measure(LatencyHistogram &histogram, Func &&sub_chain);
+
 	/**
 	 * Moves the conveyor chain into a thread local storage point which drops
 	 * every element. Use sink() if you want to control the lifetime of a
@@ -250,6 +379,22 @@ public:
 
 	virtual size_t space() const = 0;
 	virtual size_t queued() const = 0;
+
+	/**
+	 * Calls callback each time the consumer took a value, so producers which
+	 * stop feeding at a queued() limit can resume without polling. Feeders
+	 * without a queue ignore it.
+	 */
+	virtual void onTaken(std::function<void()> callback) { (void)callback; }
+
+	/**
+	 * Calls callback once the consumer conveyor was destroyed, so producers
+	 * can stop waiting for events nobody takes anymore. The feeder has no
+	 * space left from then on. Feeders without a queue ignore it.
+	 */
+	virtual void onDropped(std::function<void()> callback) {
+		(void)callback;
+	}
 };
 
 template <> class ConveyorFeeder<void> {
@@ -261,6 +406,12 @@ public:
 
 	virtual size_t space() const = 0;
 	virtual size_t queued() const = 0;
+
+	virtual void onTaken(std::function<void()> callback) { (void)callback; }
+
+	virtual void onDropped(std::function<void()> callback) {
+		(void)callback;
+	}
 };
 
 template <typename T> struct ConveyorAndFeeder {
@@ -272,6 +423,13 @@ template <typename T> ConveyorAndFeeder<T> newConveyorAndFeeder();
 
 template <typename T> ConveyorAndFeeder<T> oneTimeConveyorAndFeeder();
 
+/**
+ * Creates a conveyor on the current event loop whose feeder may be used from
+ * any thread. Elements arrive during the next turn of the loop after it has
+ * been woken.
+ */
+template <typename T> ConveyorAndFeeder<T> newCrossThreadConveyorAndFeeder();
+
 enum class Signal : uint8_t { Terminate, User1 };
 
 /**
@@ -293,6 +451,67 @@ public:
 	virtual void wake() = 0;
 };
 
+class SemaphoreConveyorNode;
+
+/**
+ * Counting semaphore for the async processing graph. Waiters are served in
+ * FIFO order. The semaphore has to outlive every Permit it hands out.
+ */
+class AsyncSemaphore {
+public:
+	/**
+	 * Returns its permit to the semaphore on destruction
+	 */
+	class Permit {
+	private:
+		AsyncSemaphore *semaphore;
+
+	public:
+		Permit();
+		Permit(AsyncSemaphore &semaphore);
+		~Permit();
+
+		Permit(Permit &&);
+		Permit &operator=(Permit &&);
+
+		SAW_FORBID_COPY(Permit);
+
+		void release();
+	};
+
+private:
+	friend class SemaphoreConveyorNode;
+
+	size_t available_permits;
+
+	SemaphoreConveyorNode *waiter_head = nullptr;
+	SemaphoreConveyorNode **waiter_tail = &waiter_head;
+	size_t waiter_count = 0;
+
+	void release();
+	void unlinkWaiter(SemaphoreConveyorNode &waiter);
+
+public:
+	AsyncSemaphore(size_t permits);
+	~AsyncSemaphore();
+
+	SAW_FORBID_COPY(AsyncSemaphore);
+	SAW_FORBID_MOVE(AsyncSemaphore);
+
+	/**
+	 * Returns a Conveyor which is fulfilled as soon as a permit is available
+	 */
+	Conveyor<Permit> acquire();
+
+	/**
+	 * Only returns a permit if it is available without waiting
+	 */
+	Maybe<Permit> tryAcquire();
+
+	size_t available() const;
+	size_t waiting() const;
+};
+
 class SinkConveyorNode;
 
 class ConveyorSinks final : public Event {
@@ -340,6 +559,33 @@ public:
 	void fire() override;
 };
 
+/**
+ * Measurements collected by an EventLoop. A turn is one pass over the armed
+ * events after the EventPort has been polled or waited on.
+ */
+struct EventLoopMetrics {
+	uint64_t turns = 0;
+	uint64_t events = 0;
+	uint64_t max_events_per_turn = 0;
+
+	std::chrono::steady_clock::duration turn_time{0};
+	std::chrono::steady_clock::duration max_turn_time{0};
+	/// Time spent blocked in EventPort::wait
+	std::chrono::steady_clock::duration wait_time{0};
+
+	uint64_t stalls = 0;
+};
+
+/**
+ * A single fire() call which took longer than the stall threshold
+ */
+struct EventLoopStall {
+	/// Implementation defined name of the event type as given by typeid
+	const char *event_type;
+	std::chrono::steady_clock::duration duration;
+	std::chrono::steady_clock::time_point time;
+};
+
 /*
  * EventLoop class similar to capn'proto.
  * https://github.com/capnproto/capnproto
@@ -347,6 +593,8 @@ public:
 class EventLoop {
 private:
 	friend class Event;
+	friend class CrossThreadEvent;
+	friend class TimerEvent;
 	Event *head = nullptr;
 	Event **tail = &head;
 	Event **next_insert_point = &head;
@@ -358,9 +606,33 @@ private:
 
 	Own<ConveyorSinks> daemon_sink = nullptr;
 
+	std::mutex cross_thread_mutex;
+	std::vector<CrossThreadEvent *> cross_thread_events;
+
+	std::multimap<std::chrono::steady_clock::time_point, TimerEvent *> timers;
+
+	EventLoopMetrics loop_metrics;
+
+	std::chrono::steady_clock::duration stall_threshold{0};
+	size_t stall_history = 0;
+	std::deque<EventLoopStall> stall_records;
+	std::function<void(const EventLoopStall &)> stall_handler;
+
 	// functions
 	void setRunnable(bool runnable);
 
+	void armCrossThreadEvents();
+	void armTimers();
+
+	/**
+	 * Earliest of the given deadline and the next timer
+	 */
+	std::chrono::steady_clock::time_point
+	nextDeadline(const std::chrono::steady_clock::time_point &deadline) const;
+
+	void fireWatched(Event &event);
+	void recordWait(const std::chrono::steady_clock::time_point &begin);
+
 	friend class WaitScope;
 	void enterScope();
 	void leaveScope();
@@ -373,8 +645,8 @@ public:
 	EventLoop(Own<EventPort> &&port);
 	~EventLoop();
 
-	EventLoop(EventLoop &&) = default;
-	EventLoop &operator=(EventLoop &&) = default;
+	SAW_FORBID_COPY(EventLoop);
+	SAW_FORBID_MOVE(EventLoop);
 
 	bool wait();
 	bool wait(const std::chrono::steady_clock::duration &);
@@ -384,6 +656,24 @@ public:
 	EventPort *eventPort();
 
 	ConveyorSinks &daemon();
+
+	const EventLoopMetrics &metrics() const;
+	void resetMetrics();
+
+	/**
+	 * Opt-in watchdog. Every fire() which takes longer than threshold is
+	 * recorded and the last history records are kept. A zero threshold
+	 * disables the watchdog and the per event time measurement.
+	 */
+	void setStallThreshold(const std::chrono::steady_clock::duration &threshold,
+						   size_t history = 64);
+
+	/**
+	 * Called for every recorded stall on the thread of this loop
+	 */
+	void onStall(std::function<void(const EventLoopStall &)> handler);
+
+	const std::deque<EventLoopStall> &stalls() const;
 };
 
 /*
@@ -450,6 +740,9 @@ class AdaptConveyorFeeder final : public ConveyorFeeder<UnfixVoid<T>> {
 private:
 	AdaptConveyorNode<T> *feedee = nullptr;
 
+	std::function<void()> taken_callback;
+	std::function<void()> dropped_callback;
+
 public:
 	~AdaptConveyorFeeder();
 
@@ -460,6 +753,18 @@ public:
 
 	size_t space() const override;
 	size_t queued() const override;
+
+	void onTaken(std::function<void()> callback) override;
+	void onDropped(std::function<void()> callback) override;
+
+	/**
+	 * Called by the node after a value was retrieved
+	 */
+	void taken();
+	/**
+	 * Called by the node when it is destroyed
+	 */
+	void dropped();
 };
 
 template <typename T>
@@ -848,6 +1153,314 @@ public:
 	void governingNodeDestroyed();
 };
 
+/*
+ * Collects the heads of every attached conveyor and passes on the smallest
+ * one as soon as each open input has an element queued. Once every input
+ * ended and the remaining heads were taken, Exhausted is passed on.
+ */
+class OrderedMergeConveyorNodeBase : public ConveyorNode,
+									 public ConveyorEventStorage {
+public:
+	OrderedMergeConveyorNodeBase();
+
+	virtual ~OrderedMergeConveyorNodeBase() = default;
+};
+
+template <typename T>
+class OrderedMergeConveyorNode final : public OrderedMergeConveyorNodeBase {
+private:
+	class Appendage final : public ConveyorStorage {
+	public:
+		Own<ConveyorNode> child;
+		OrderedMergeConveyorNode *merger;
+
+		Maybe<ErrorOr<FixVoid<T>>> error_or_value;
+		bool closed;
+
+	public:
+		Appendage(ConveyorStorage *child_store, Own<ConveyorNode> n,
+				  OrderedMergeConveyorNode &m)
+			: ConveyorStorage{child_store}, child{std::move(n)}, merger{&m},
+			  error_or_value{std::nullopt}, closed{false} {}
+
+		void takeHead(ErrorOr<FixVoid<T>> &err_or_val);
+
+		size_t space() const override;
+
+		size_t queued() const override;
+
+		void childHasFired() override;
+
+		void parentHasFired() override;
+
+		void setParent(ConveyorStorage *par) override;
+	};
+
+	friend class OrderedMergeConveyorNodeData<T>;
+	friend class Appendage;
+
+	Our<OrderedMergeConveyorNodeData<T>> data;
+	std::function<bool(const FixVoid<T> &, const FixVoid<T> &)> less;
+
+	/// Min heap over the appendages which currently hold a value
+	std::vector<Appendage *> value_heads;
+	/// Appendages holding an error which is passed on before any value
+	std::queue<Appendage *> error_heads;
+	size_t open_appendages = 0;
+	/// Set once the last input ended, until Exhausted was passed on
+	bool exhaustion_pending = false;
+
+	bool heapCompare(const Appendage *lhs, const Appendage *rhs) const;
+
+	void headQueued(Appendage &appendage);
+
+public:
+	OrderedMergeConveyorNode(
+		Our<OrderedMergeConveyorNodeData<T>> data,
+		std::function<bool(const FixVoid<T> &, const FixVoid<T> &)> less);
+	~OrderedMergeConveyorNode();
+
+	// ConveyorNode
+	void getResult(ErrorOrValue &err_or_val) noexcept override;
+
+	// Event
+	void fire() override;
+
+	// ConveyorStorage
+	size_t space() const override;
+	size_t queued() const override;
+	void childHasFired() override;
+	void parentHasFired() override;
+};
+
+template <typename T> class OrderedMergeConveyorNodeData {
+public:
+	std::vector<Own<typename OrderedMergeConveyorNode<T>::Appendage>>
+		appendages;
+
+	OrderedMergeConveyorNode<T> *merger = nullptr;
+
+public:
+	void attach(Conveyor<T> conv);
+
+	void governingNodeDestroyed();
+};
+
+class SemaphoreConveyorNode final : public ConveyorNode,
+									public ConveyorEventStorage {
+private:
+	friend class AsyncSemaphore;
+
+	AsyncSemaphore *semaphore;
+	// Intrusive waiter queue of the semaphore
+	SemaphoreConveyorNode *next_waiter = nullptr;
+	SemaphoreConveyorNode **prev_waiter = nullptr;
+
+	Maybe<ErrorOr<AsyncSemaphore::Permit>> result = std::nullopt;
+
+	void grant(AsyncSemaphore::Permit &&permit);
+	void fail(Error &&error);
+
+public:
+	SemaphoreConveyorNode(AsyncSemaphore &semaphore);
+	~SemaphoreConveyorNode();
+
+	// ConveyorNode
+	void getResult(ErrorOrValue &err_or_val) noexcept override;
+
+	// ConveyorStorage
+	size_t space() const override;
+	size_t queued() const override;
+
+	void childHasFired() override;
+	void parentHasFired() override;
+
+	// Event
+	void fire() override;
+};
+
+/*
+ * Starts a sub chain for every element and keeps the amount of unfinished sub
+ * chains and unretrieved results below the limit
+ */
+template <typename T, typename U, typename Func>
+class ConcurrencyLimitConveyorNode final : public ConveyorNode,
+										   public ConveyorEventStorage {
+private:
+	class Appendage final : public ConveyorStorage {
+	public:
+		Own<ConveyorNode> child;
+		ConcurrencyLimitConveyorNode *limiter;
+
+	public:
+		Appendage(ConveyorStorage *child_store, Own<ConveyorNode> n,
+				  ConcurrencyLimitConveyorNode &l)
+			: ConveyorStorage{child_store}, child{std::move(n)},
+			  limiter{&l} {}
+
+		size_t space() const override;
+		size_t queued() const override;
+
+		void childHasFired() override;
+		void parentHasFired() override;
+
+		void setParent(ConveyorStorage *par) override;
+	};
+
+	friend class Appendage;
+
+	Own<ConveyorNode> child;
+	Func func;
+
+	std::list<Own<Appendage>> running;
+	std::vector<Own<Appendage>> finished;
+
+	std::queue<ErrorOr<FixVoid<U>>> results;
+	size_t max_in_flight;
+
+	void appendageHasFinished(Appendage &appendage,
+							  ErrorOr<FixVoid<U>> &&eov);
+
+public:
+	ConcurrencyLimitConveyorNode(ConveyorStorage *child_store,
+								 Own<ConveyorNode> dep, Func &&func,
+								 size_t max_in_flight);
+
+	size_t inFlight() const;
+
+	// Event
+	void fire() override;
+	// ConveyorNode
+	void getResult(ErrorOrValue &eov) noexcept override;
+
+	// ConveyorStorage
+	size_t space() const override;
+	size_t queued() const override;
+
+	void childHasFired() override;
+	void parentHasFired() override;
+};
+
+template <typename T> class PartitionConveyorNode;
+
+/*
+ * Shared by every branch of a partition. It is the parent storage of the
+ * partitioned conveyor and lives as long as one branch exists.
+ */
+template <typename T>
+class PartitionConveyorNodeData final : public ConveyorStorage {
+private:
+	Own<ConveyorNode> child;
+	std::function<size_t(const FixVoid<T> &)> hash;
+
+public:
+	std::vector<PartitionConveyorNode<T> *> branches;
+
+public:
+	PartitionConveyorNodeData(ConveyorStorage *child_store,
+							  Own<ConveyorNode> dep,
+							  std::function<size_t(const FixVoid<T> &)> hash,
+							  size_t n);
+	~PartitionConveyorNodeData();
+
+	void branchDestroyed(size_t index);
+	void branchHasSpace();
+
+	// ConveyorStorage
+	size_t space() const override;
+	size_t queued() const override;
+
+	void childHasFired() override;
+	void parentHasFired() override;
+
+	void setParent(ConveyorStorage *par) override;
+};
+
+template <typename T>
+class PartitionConveyorNode final : public ConveyorNode,
+									public ConveyorEventStorage {
+private:
+	Our<PartitionConveyorNodeData<T>> data;
+	size_t index;
+
+	std::queue<ErrorOr<FixVoid<T>>> storage;
+	size_t max_store;
+
+public:
+	PartitionConveyorNode(Our<PartitionConveyorNodeData<T>> data,
+						  size_t index, size_t max_size);
+	~PartitionConveyorNode();
+
+	void push(ErrorOr<FixVoid<T>> &&eov);
+
+	// Event
+	void fire() override;
+	// ConveyorNode
+	void getResult(ErrorOrValue &eov) noexcept override;
+
+	// ConveyorStorage
+	size_t space() const override;
+	size_t queued() const override;
+
+	void childHasFired() override;
+	void parentHasFired() override;
+};
+
+template <typename T> class CrossThreadConveyorNode;
+
+template <typename T> class CrossThreadConveyorChannel {
+public:
+	std::mutex mutex;
+	std::queue<ErrorOr<UnfixVoid<T>>> storage;
+	CrossThreadConveyorNode<T> *receiver = nullptr;
+	bool notified = false;
+
+public:
+	void push(ErrorOr<UnfixVoid<T>> &&eov);
+};
+
+template <typename T>
+class CrossThreadConveyorFeeder final : public ConveyorFeeder<UnfixVoid<T>> {
+private:
+	Our<CrossThreadConveyorChannel<T>> channel;
+
+public:
+	CrossThreadConveyorFeeder(Our<CrossThreadConveyorChannel<T>> channel);
+
+	void feed(T &&value) override;
+	void fail(Error &&error) override;
+
+	size_t space() const override;
+	size_t queued() const override;
+};
+
+template <typename T>
+class CrossThreadConveyorNode final : public ConveyorNode,
+									  public ConveyorStorage,
+									  public CrossThreadEvent {
+private:
+	Our<CrossThreadConveyorChannel<T>> channel;
+
+public:
+	CrossThreadConveyorNode(Our<CrossThreadConveyorChannel<T>> channel);
+	~CrossThreadConveyorNode();
+
+	// ConveyorNode
+	void getResult(ErrorOrValue &err_or_val) override;
+
+	// ConveyorStorage
+	size_t space() const override;
+	size_t queued() const override;
+
+	void childHasFired() override;
+	void parentHasFired() override;
+
+	void setParent(ConveyorStorage *parent) override;
+
+	// Event
+	void fire() override;
+};
+
 /*
 class JoinConveyorNodeBase : public ConveyorNode, public ConveyorEventStorage {
 private:
@@ -2,6 +2,7 @@
 
 #include "common.h"
 
+#include <algorithm>
 #include <cassert>
 // Template inlining
 
@@ -79,6 +80,72 @@ Conveyor<T> Conveyor<T>::attach(Args &&...args) {
 	return Conveyor<T>{std::move(attach_node), storage};
 }
 
+template <typename T>
+template <typename Func>
+Conveyor<RemoveConveyor<ReturnType<Func, T>>>
+Conveyor<T>::limitConcurrency(size_t val, Func &&func) {
+	using U = RemoveConveyor<ReturnType<Func, T>>;
+
+	SAW_ASSERT(val > 0) { return Conveyor<U>{nullptr, nullptr}; }
+
+	Own<ConcurrencyLimitConveyorNode<FixVoid<T>, U, Func>> limit_node =
+		heap<ConcurrencyLimitConveyorNode<FixVoid<T>, U, Func>>(
+			storage, std::move(node), std::move(func), val);
+	ConveyorStorage *storage_ptr =
+		static_cast<ConveyorStorage *>(limit_node.get());
+
+	SAW_ASSERT(storage) { return Conveyor<U>{nullptr, nullptr}; }
+
+	storage->setParent(storage_ptr);
+	return Conveyor<U>{std::move(limit_node), storage_ptr};
+}
+
+template <typename T>
+template <typename Func>
+ReturnType<Func, Conveyor<T>>
+Conveyor<T>::measure(LatencyHistogram &histogram, Func &&sub_chain) {
+	using OutConveyor = ReturnType<Func, Conveyor<T>>;
+	using U = RemoveConveyor<OutConveyor>;
+	static_assert(!std::is_void_v<T> && !std::is_void_v<U>,
+				  "measure() needs conveyors which carry values");
+
+	Our<std::queue<std::chrono::steady_clock::time_point>> entered =
+		share<std::queue<std::chrono::steady_clock::time_point>>();
+
+	auto stamp = [entered]() {
+		entered->push(std::chrono::steady_clock::now());
+	};
+	auto record = [entered, &histogram]() {
+		if (!entered->empty()) {
+			histogram.record(std::chrono::steady_clock::now() -
+							 entered->front());
+			entered->pop();
+		}
+	};
+
+	Conveyor<T> entry = then(
+		[stamp](FixVoid<T> &&value) -> FixVoid<T> {
+			stamp();
+			return std::move(value);
+		},
+		[stamp](Error &&error) -> Error {
+			stamp();
+			return std::move(error);
+		});
+
+	OutConveyor out = sub_chain(std::move(entry));
+
+	return out.then(
+		[record](FixVoid<U> &&value) -> FixVoid<U> {
+			record();
+			return std::move(value);
+		},
+		[record](Error &&error) -> Error {
+			record();
+			return std::move(error);
+		});
+}
+
 template <typename T>
 std::pair<Conveyor<T>, MergeConveyor<T>> Conveyor<T>::merge() {
 	Our<MergeConveyorNodeData<T>> data = share<MergeConveyorNodeData<T>>();
@@ -96,6 +163,89 @@ std::pair<Conveyor<T>, MergeConveyor<T>> Conveyor<T>::merge() {
 						  std::move(node_ref));
 }
 
+template <typename T>
+template <typename Func>
+std::pair<Conveyor<T>, OrderedMergeConveyor<T>>
+Conveyor<T>::mergeOrdered(Func &&key_func) {
+	Our<OrderedMergeConveyorNodeData<T>> data =
+		share<OrderedMergeConveyorNodeData<T>>();
+
+	Own<OrderedMergeConveyorNode<T>> merge_node =
+		heap<OrderedMergeConveyorNode<T>>(
+			data, [key_func = std::move(key_func)](const FixVoid<T> &lhs,
+												   const FixVoid<T> &rhs) {
+				return key_func(lhs) < key_func(rhs);
+			});
+
+	data->attach(Conveyor<T>::toConveyor(std::move(node), storage));
+
+	OrderedMergeConveyor<T> node_ref{data};
+
+	ConveyorStorage *merge_storage =
+		static_cast<ConveyorStorage *>(merge_node.get());
+
+	return std::make_pair(Conveyor<T>{std::move(merge_node), merge_storage},
+						  std::move(node_ref));
+}
+
+template <typename T>
+template <typename Func>
+std::vector<Conveyor<T>> Conveyor<T>::partition(size_t n, Func &&hash_func,
+												size_t limit) {
+	SAW_ASSERT(n > 0) { return {}; }
+
+	Our<PartitionConveyorNodeData<T>> data =
+		share<PartitionConveyorNodeData<T>>(storage, std::move(node),
+											std::move(hash_func), n);
+	if (storage) {
+		storage->setParent(data.get());
+	}
+
+	std::vector<Conveyor<T>> branches;
+	branches.reserve(n);
+	for (size_t i = 0; i < n; ++i) {
+		Own<PartitionConveyorNode<T>> branch_node =
+			heap<PartitionConveyorNode<T>>(data, i, limit);
+		ConveyorStorage *branch_storage =
+			static_cast<ConveyorStorage *>(branch_node.get());
+
+		branches.push_back(
+			Conveyor<T>{std::move(branch_node), branch_storage});
+	}
+
+	return branches;
+}
+
+template <typename T>
+template <typename Func>
+SinkConveyor
+Conveyor<T>::partition(std::vector<Own<ConveyorFeeder<T>>> feeders,
+					   Func &&hash_func) {
+	SAW_ASSERT(!feeders.empty()) { return SinkConveyor{}; }
+
+	Our<std::vector<Own<ConveyorFeeder<T>>>> shared_feeders =
+		share<std::vector<Own<ConveyorFeeder<T>>>>(std::move(feeders));
+
+	return then(
+			   [shared_feeders,
+				hash_func = std::move(hash_func)](FixVoid<T> &&value) {
+				   auto &targets = *shared_feeders;
+				   size_t index = hash_func(value) % targets.size();
+				   if (targets[index]) {
+					   targets[index]->feed(std::move(value));
+				   }
+			   },
+			   [shared_feeders](Error &&error) -> Error {
+				   for (auto &target : *shared_feeders) {
+					   if (target) {
+						   target->fail(error.copyError());
+					   }
+				   }
+				   return std::move(error);
+			   })
+		.sink();
+}
+
 template <>
 template <typename ErrorFunc>
 SinkConveyor Conveyor<void>::sink(ErrorFunc &&error_func) {
@@ -167,6 +317,22 @@ template <typename T> ConveyorAndFeeder<T> newConveyorAndFeeder() {
 		Conveyor<T>::toConveyor(std::move(node), storage_ptr)};
 }
 
+template <typename T> ConveyorAndFeeder<T> newCrossThreadConveyorAndFeeder() {
+	Our<CrossThreadConveyorChannel<FixVoid<T>>> channel =
+		share<CrossThreadConveyorChannel<FixVoid<T>>>();
+
+	Own<CrossThreadConveyorFeeder<FixVoid<T>>> feeder =
+		heap<CrossThreadConveyorFeeder<FixVoid<T>>>(channel);
+	Own<CrossThreadConveyorNode<FixVoid<T>>> node =
+		heap<CrossThreadConveyorNode<FixVoid<T>>>(channel);
+
+	ConveyorStorage *storage_ptr = static_cast<ConveyorStorage *>(node.get());
+
+	return ConveyorAndFeeder<T>{
+		std::move(feeder),
+		Conveyor<T>::toConveyor(std::move(node), storage_ptr)};
+}
+
 // QueueBuffer
 template <typename T> void QueueBufferConveyorNode<T>::fire() {
 	if (child) {
@@ -315,16 +481,14 @@ void MergeConveyorNode<T>::getResult(ErrorOrValue &eov) noexcept {
 
 	for (size_t i = next_appendage; i < appendages.size(); ++i) {
 		if (appendages[i]->queued() > 0) {
-			err_or_val = std::move(appendages[i]->error_or_value.value());
-			appendages[i]->error_or_value = std::nullopt;
+			appendages[i]->getAppendageResult(eov);
 			next_appendage = i + 1;
 			return;
 		}
 	}
 	for (size_t i = 0; i < next_appendage; ++i) {
 		if (appendages[i]->queued() > 0) {
-			err_or_val = std::move(appendages[i]->error_or_value.value());
-			appendages[i]->error_or_value = std::nullopt;
+			appendages[i]->getAppendageResult(eov);
 			next_appendage = i + 1;
 			return;
 		}
@@ -404,10 +568,16 @@ void MergeConveyorNode<T>::Appendage::getAppendageResult(ErrorOrValue &eov) {
 
 	err_or_val = std::move(error_or_value.value());
 	error_or_value = std::nullopt;
+
+	if (child_storage) {
+		child_storage->parentHasFired();
+	}
 }
 
 template <typename T> void MergeConveyorNode<T>::Appendage::childHasFired() {
-	SAW_ASSERT(!error_or_value.has_value()) { return; }
+	if (error_or_value.has_value()) {
+		return;
+	}
 	ErrorOr<FixVoid<T>> eov;
 	child->getResult(eov);
 
@@ -452,6 +622,696 @@ template <typename T> void MergeConveyorNodeData<T>::governingNodeDestroyed() {
 	merger = nullptr;
 }
 
+template <typename T>
+OrderedMergeConveyor<T>::OrderedMergeConveyor(
+	Lent<OrderedMergeConveyorNodeData<T>> d)
+	: data{std::move(d)} {}
+
+template <typename T> OrderedMergeConveyor<T>::~OrderedMergeConveyor() {}
+
+template <typename T>
+void OrderedMergeConveyor<T>::attach(Conveyor<T> conveyor) {
+	auto sp = data.lock();
+	SAW_ASSERT(sp) { return; }
+
+	sp->attach(std::move(conveyor));
+}
+
+template <typename T>
+OrderedMergeConveyorNode<T>::OrderedMergeConveyorNode(
+	Our<OrderedMergeConveyorNodeData<T>> d,
+	std::function<bool(const FixVoid<T> &, const FixVoid<T> &)> l)
+	: data{d}, less{std::move(l)} {
+	SAW_ASSERT(data) { return; }
+
+	data->merger = this;
+}
+
+template <typename T> OrderedMergeConveyorNode<T>::~OrderedMergeConveyorNode() {
+	if (data) {
+		data->governingNodeDestroyed();
+	}
+}
+
+template <typename T>
+bool OrderedMergeConveyorNode<T>::heapCompare(const Appendage *lhs,
+											  const Appendage *rhs) const {
+	// std::push_heap builds a max heap, so invert the order
+	return less(rhs->error_or_value.value().value(),
+				lhs->error_or_value.value().value());
+}
+
+template <typename T>
+void OrderedMergeConveyorNode<T>::headQueued(Appendage &appendage) {
+	SAW_ASSERT(appendage.error_or_value.has_value()) { return; }
+
+	ErrorOr<FixVoid<T>> &eov = appendage.error_or_value.value();
+	if (eov.isError()) {
+		if (eov.error().isCritical()) {
+			appendage.closed = true;
+			--open_appendages;
+			exhaustion_pending = open_appendages == 0;
+		}
+		if (eov.error().code() == Error::Code::Exhausted) {
+			// Exhausted inputs are only closed, not passed on
+			appendage.error_or_value = std::nullopt;
+		} else {
+			error_heads.push(&appendage);
+		}
+	} else {
+		value_heads.push_back(&appendage);
+		std::push_heap(value_heads.begin(), value_heads.end(),
+					   [this](const Appendage *lhs, const Appendage *rhs) {
+						   return heapCompare(lhs, rhs);
+					   });
+	}
+
+	if (queued() > 0 && !isArmed()) {
+		armLater();
+	}
+}
+
+template <typename T>
+void OrderedMergeConveyorNode<T>::getResult(ErrorOrValue &eov) noexcept {
+	ErrorOr<FixVoid<T>> &err_or_val = eov.as<FixVoid<T>>();
+
+	Appendage *appendage = nullptr;
+	if (!error_heads.empty()) {
+		appendage = error_heads.front();
+		error_heads.pop();
+	} else if (exhaustion_pending && value_heads.empty()) {
+		exhaustion_pending = false;
+		err_or_val = criticalError("Ordered Merge inputs ended",
+								   Error::Code::Exhausted);
+		return;
+	} else if (queued() > 0) {
+		std::pop_heap(value_heads.begin(), value_heads.end(),
+					  [this](const Appendage *lhs, const Appendage *rhs) {
+						  return heapCompare(lhs, rhs);
+					  });
+		appendage = value_heads.back();
+		value_heads.pop_back();
+	} else {
+		err_or_val = criticalError("No value in Ordered Merge Appendages");
+		return;
+	}
+
+	appendage->takeHead(err_or_val);
+}
+
+template <typename T> void OrderedMergeConveyorNode<T>::fire() {
+	SAW_ASSERT(queued() > 0) { return; }
+
+	if (parent) {
+		parent->childHasFired();
+
+		if (queued() > 0 && parent->space() > 0) {
+			armLater();
+		}
+	}
+}
+
+template <typename T> size_t OrderedMergeConveyorNode<T>::space() const {
+	return 0;
+}
+
+template <typename T> size_t OrderedMergeConveyorNode<T>::queued() const {
+	/*
+	 * The smallest value may only be passed on if no open input could still
+	 * deliver a smaller one
+	 */
+	bool value_ready =
+		!value_heads.empty() && value_heads.size() >= open_appendages;
+	bool exhausted =
+		exhaustion_pending && value_heads.empty() && error_heads.empty();
+
+	return error_heads.size() + (value_ready || exhausted ? 1 : 0);
+}
+
+template <typename T> void OrderedMergeConveyorNode<T>::childHasFired() {
+	/// This can never happen
+	assert(false);
+}
+
+template <typename T> void OrderedMergeConveyorNode<T>::parentHasFired() {
+	SAW_ASSERT(parent) { return; }
+	if (queued() > 0) {
+		if (parent->space() > 0) {
+			armLater();
+		}
+	}
+}
+
+template <typename T>
+void OrderedMergeConveyorNode<T>::Appendage::takeHead(
+	ErrorOr<FixVoid<T>> &err_or_val) {
+	SAW_ASSERT(error_or_value.has_value()) {
+		err_or_val = criticalError("No element queued in Merge Appendage Node");
+		return;
+	}
+
+	err_or_val = std::move(error_or_value.value());
+	error_or_value = std::nullopt;
+
+	if (!closed && child_storage) {
+		child_storage->parentHasFired();
+	}
+}
+
+template <typename T>
+size_t OrderedMergeConveyorNode<T>::Appendage::space() const {
+	SAW_ASSERT(merger) { return 0; }
+
+	if (closed || error_or_value.has_value()) {
+		return 0;
+	}
+
+	return 1;
+}
+
+template <typename T>
+size_t OrderedMergeConveyorNode<T>::Appendage::queued() const {
+	SAW_ASSERT(merger) { return 0; }
+
+	if (error_or_value.has_value()) {
+		return 1;
+	}
+
+	return 0;
+}
+
+template <typename T>
+void OrderedMergeConveyorNode<T>::Appendage::childHasFired() {
+	if (closed || error_or_value.has_value() || !child) {
+		return;
+	}
+
+	ErrorOr<FixVoid<T>> eov;
+	child->getResult(eov);
+
+	error_or_value = std::move(eov);
+
+	merger->headQueued(*this);
+}
+
+template <typename T>
+void OrderedMergeConveyorNode<T>::Appendage::parentHasFired() {
+	if (child_storage) {
+		child_storage->parentHasFired();
+	}
+}
+
+template <typename T>
+void OrderedMergeConveyorNode<T>::Appendage::setParent(ConveyorStorage *par) {
+	SAW_ASSERT(merger) { return; }
+
+	SAW_ASSERT(child) { return; }
+
+	parent = par;
+}
+
+template <typename T>
+void OrderedMergeConveyorNodeData<T>::attach(Conveyor<T> conveyor) {
+	SAW_ASSERT(merger) { return; }
+
+	auto nas = Conveyor<T>::fromConveyor(std::move(conveyor));
+
+	auto merge_node_appendage =
+		heap<typename OrderedMergeConveyorNode<T>::Appendage>(
+			nas.second, std::move(nas.first), *merger);
+
+	++merger->open_appendages;
+	// An input attached before Exhausted was taken keeps the merge open
+	merger->exhaustion_pending = false;
+
+	auto *appendage_ptr = merge_node_appendage.get();
+	appendages.push_back(std::move(merge_node_appendage));
+
+	if (nas.second) {
+		nas.second->setParent(appendage_ptr);
+	}
+}
+
+template <typename T>
+void OrderedMergeConveyorNodeData<T>::governingNodeDestroyed() {
+	appendages.clear();
+	merger = nullptr;
+}
+
+template <typename T, typename U, typename Func>
+ConcurrencyLimitConveyorNode<T, U, Func>::ConcurrencyLimitConveyorNode(
+	ConveyorStorage *child_store, Own<ConveyorNode> dep, Func &&f,
+	size_t max_size)
+	: ConveyorEventStorage{child_store}, child{std::move(dep)},
+	  func{std::move(f)}, max_in_flight{max_size} {}
+
+template <typename T, typename U, typename Func>
+size_t ConcurrencyLimitConveyorNode<T, U, Func>::inFlight() const {
+	return running.size() + results.size();
+}
+
+template <typename T, typename U, typename Func>
+void ConcurrencyLimitConveyorNode<T, U, Func>::appendageHasFinished(
+	Appendage &appendage, ErrorOr<FixVoid<U>> &&eov) {
+	results.push(std::move(eov));
+
+	/*
+	 * The appendage is still on the call stack of its child, so it is only
+	 * moved out of the running list and destroyed on the next fire()
+	 */
+	for (auto iter = running.begin(); iter != running.end(); ++iter) {
+		if (iter->get() == &appendage) {
+			finished.push_back(std::move(*iter));
+			running.erase(iter);
+			break;
+		}
+	}
+
+	if (!isArmed()) {
+		armLater();
+	}
+}
+
+template <typename T, typename U, typename Func>
+void ConcurrencyLimitConveyorNode<T, U, Func>::fire() {
+	finished.clear();
+
+	if (parent) {
+		if (!results.empty() && parent->space() > 0) {
+			parent->childHasFired();
+		}
+		if (!results.empty() && parent->space() > 0) {
+			armLater();
+		}
+	}
+
+	if (child_storage && space() > 0) {
+		child_storage->parentHasFired();
+	}
+}
+
+template <typename T, typename U, typename Func>
+void ConcurrencyLimitConveyorNode<T, U, Func>::getResult(
+	ErrorOrValue &eov) noexcept {
+	ErrorOr<FixVoid<U>> &err_or_val = eov.as<FixVoid<U>>();
+	if (results.empty()) {
+		err_or_val = criticalError("No result in Concurrency Limit Node");
+		return;
+	}
+
+	bool has_space_before = space() > 0;
+
+	err_or_val = std::move(results.front());
+	results.pop();
+
+	// Without a parent this is retrieved by take()
+	if (!parent && !has_space_before && child_storage) {
+		child_storage->parentHasFired();
+	}
+}
+
+template <typename T, typename U, typename Func>
+size_t ConcurrencyLimitConveyorNode<T, U, Func>::space() const {
+	return max_in_flight > inFlight() ? max_in_flight - inFlight() : 0;
+}
+
+template <typename T, typename U, typename Func>
+size_t ConcurrencyLimitConveyorNode<T, U, Func>::queued() const {
+	return results.size();
+}
+
+template <typename T, typename U, typename Func>
+void ConcurrencyLimitConveyorNode<T, U, Func>::childHasFired() {
+	if (!child || space() == 0) {
+		return;
+	}
+
+	ErrorOr<T> dep_eov;
+	child->getResult(dep_eov);
+
+	if (dep_eov.isError()) {
+		if (dep_eov.error().isCritical()) {
+			child_storage = nullptr;
+		}
+		results.push(std::move(dep_eov.error()));
+		if (!isArmed()) {
+			armLater();
+		}
+		return;
+	}
+
+	try {
+		Conveyor<U> sub_conveyor = FixVoidCaller<Conveyor<U>, T>::apply(
+			func, std::move(dep_eov.value()));
+
+		auto nas = Conveyor<U>::fromConveyor(std::move(sub_conveyor));
+
+		auto appendage =
+			heap<Appendage>(nas.second, std::move(nas.first), *this);
+		Appendage *appendage_ptr = appendage.get();
+		running.push_back(std::move(appendage));
+
+		if (nas.second) {
+			nas.second->setParent(appendage_ptr);
+		}
+	} catch (const std::bad_alloc &) {
+		results.push(criticalError("Out of memory"));
+	} catch (const std::exception &) {
+		results.push(criticalError(
+			"Exception in chain occured. Return ErrorOr<T> if you "
+			"want to handle errors which are recoverable"));
+	}
+
+	if (!results.empty() && !isArmed()) {
+		armLater();
+	}
+}
+
+template <typename T, typename U, typename Func>
+void ConcurrencyLimitConveyorNode<T, U, Func>::parentHasFired() {
+	SAW_ASSERT(parent) { return; }
+
+	if (parent->space() == 0) {
+		return;
+	}
+
+	if (queued() > 0 && !isArmed()) {
+		armLater();
+	}
+}
+
+template <typename T, typename U, typename Func>
+size_t ConcurrencyLimitConveyorNode<T, U, Func>::Appendage::space() const {
+	return limiter ? 1 : 0;
+}
+
+template <typename T, typename U, typename Func>
+size_t ConcurrencyLimitConveyorNode<T, U, Func>::Appendage::queued() const {
+	return 0;
+}
+
+template <typename T, typename U, typename Func>
+void ConcurrencyLimitConveyorNode<T, U, Func>::Appendage::childHasFired() {
+	if (!child || !limiter) {
+		return;
+	}
+
+	ErrorOr<FixVoid<U>> eov;
+	child->getResult(eov);
+
+	// Only the first result of a sub chain is used
+	ConcurrencyLimitConveyorNode *lim = limiter;
+	limiter = nullptr;
+	lim->appendageHasFinished(*this, std::move(eov));
+}
+
+template <typename T, typename U, typename Func>
+void ConcurrencyLimitConveyorNode<T, U, Func>::Appendage::parentHasFired() {
+	if (child_storage) {
+		child_storage->parentHasFired();
+	}
+}
+
+template <typename T, typename U, typename Func>
+void ConcurrencyLimitConveyorNode<T, U, Func>::Appendage::setParent(
+	ConveyorStorage *par) {
+	parent = par;
+}
+
+template <typename T>
+PartitionConveyorNodeData<T>::PartitionConveyorNodeData(
+	ConveyorStorage *child_store, Own<ConveyorNode> dep,
+	std::function<size_t(const FixVoid<T> &)> h, size_t n)
+	: ConveyorStorage{child_store}, child{std::move(dep)}, hash{std::move(h)},
+	  branches(n, nullptr) {}
+
+template <typename T>
+PartitionConveyorNodeData<T>::~PartitionConveyorNodeData() {}
+
+template <typename T>
+void PartitionConveyorNodeData<T>::branchDestroyed(size_t index) {
+	SAW_ASSERT(index < branches.size()) { return; }
+
+	branches[index] = nullptr;
+	// Elements for this branch are dropped from now on
+	branchHasSpace();
+}
+
+template <typename T> void PartitionConveyorNodeData<T>::branchHasSpace() {
+	if (child_storage && space() > 0) {
+		child_storage->parentHasFired();
+	}
+}
+
+template <typename T> size_t PartitionConveyorNodeData<T>::space() const {
+	/*
+	 * The target branch is only known after the element has been retrieved.
+	 * So every branch has to be able to take at least one more element.
+	 */
+	size_t min_space = std::numeric_limits<size_t>::max();
+	for (auto *branch : branches) {
+		if (branch) {
+			min_space = std::min(min_space, branch->space());
+		}
+	}
+	return min_space;
+}
+
+template <typename T> size_t PartitionConveyorNodeData<T>::queued() const {
+	return 0;
+}
+
+template <typename T> void PartitionConveyorNodeData<T>::childHasFired() {
+	if (!child || space() == 0) {
+		return;
+	}
+
+	ErrorOr<FixVoid<T>> eov;
+	child->getResult(eov);
+
+	if (eov.isError()) {
+		if (eov.error().isCritical()) {
+			child_storage = nullptr;
+		}
+		for (auto *branch : branches) {
+			if (branch) {
+				branch->push(eov.error().copyError());
+			}
+		}
+		return;
+	}
+
+	size_t index = hash(eov.value()) % branches.size();
+	if (branches[index]) {
+		branches[index]->push(std::move(eov));
+	}
+}
+
+template <typename T> void PartitionConveyorNodeData<T>::parentHasFired() {
+	branchHasSpace();
+}
+
+template <typename T>
+void PartitionConveyorNodeData<T>::setParent(ConveyorStorage *par) {
+	parent = par;
+}
+
+template <typename T>
+PartitionConveyorNode<T>::PartitionConveyorNode(
+	Our<PartitionConveyorNodeData<T>> d, size_t i, size_t max_size)
+	: ConveyorEventStorage{nullptr}, data{std::move(d)}, index{i},
+	  max_store{max_size} {
+	SAW_ASSERT(data && index < data->branches.size()) { return; }
+
+	data->branches[index] = this;
+}
+
+template <typename T> PartitionConveyorNode<T>::~PartitionConveyorNode() {
+	if (data) {
+		data->branchDestroyed(index);
+	}
+}
+
+template <typename T>
+void PartitionConveyorNode<T>::push(ErrorOr<FixVoid<T>> &&eov) {
+	storage.push(std::move(eov));
+	if (!isArmed()) {
+		armLater();
+	}
+}
+
+template <typename T> void PartitionConveyorNode<T>::fire() {
+	bool has_space_before_fire = space() > 0;
+
+	if (parent) {
+		parent->childHasFired();
+		if (!storage.empty() && parent->space() > 0) {
+			armLater();
+		}
+	}
+
+	if (data && !has_space_before_fire) {
+		data->branchHasSpace();
+	}
+}
+
+template <typename T>
+void PartitionConveyorNode<T>::getResult(ErrorOrValue &eov) noexcept {
+	ErrorOr<FixVoid<T>> &err_or_val = eov.as<FixVoid<T>>();
+	if (storage.empty()) {
+		err_or_val = criticalError("No element queued in Partition Node");
+		return;
+	}
+
+	bool has_space_before = space() > 0;
+
+	err_or_val = std::move(storage.front());
+	storage.pop();
+
+	// Without a parent this is retrieved by take()
+	if (!parent && !has_space_before && data) {
+		data->branchHasSpace();
+	}
+}
+
+template <typename T> size_t PartitionConveyorNode<T>::space() const {
+	return max_store - storage.size();
+}
+
+template <typename T> size_t PartitionConveyorNode<T>::queued() const {
+	return storage.size();
+}
+
+template <typename T> void PartitionConveyorNode<T>::childHasFired() {
+	/// Elements are pushed by PartitionConveyorNodeData
+	assert(false);
+}
+
+template <typename T> void PartitionConveyorNode<T>::parentHasFired() {
+	SAW_ASSERT(parent) { return; }
+
+	if (parent->space() == 0) {
+		return;
+	}
+
+	if (queued() > 0 && !isArmed()) {
+		armLater();
+	}
+}
+
+template <typename T>
+void CrossThreadConveyorChannel<T>::push(ErrorOr<UnfixVoid<T>> &&eov) {
+	std::lock_guard<std::mutex> lock{mutex};
+	storage.push(std::move(eov));
+
+	if (receiver && !notified) {
+		notified = true;
+		receiver->armCrossThread();
+	}
+}
+
+template <typename T>
+CrossThreadConveyorFeeder<T>::CrossThreadConveyorFeeder(
+	Our<CrossThreadConveyorChannel<T>> c)
+	: channel{std::move(c)} {}
+
+template <typename T> void CrossThreadConveyorFeeder<T>::feed(T &&value) {
+	channel->push(std::move(value));
+}
+
+template <typename T> void CrossThreadConveyorFeeder<T>::fail(Error &&error) {
+	channel->push(std::move(error));
+}
+
+template <typename T> size_t CrossThreadConveyorFeeder<T>::space() const {
+	std::lock_guard<std::mutex> lock{channel->mutex};
+	return std::numeric_limits<size_t>::max() - channel->storage.size();
+}
+
+template <typename T> size_t CrossThreadConveyorFeeder<T>::queued() const {
+	std::lock_guard<std::mutex> lock{channel->mutex};
+	return channel->storage.size();
+}
+
+template <typename T>
+CrossThreadConveyorNode<T>::CrossThreadConveyorNode(
+	Our<CrossThreadConveyorChannel<T>> c)
+	: ConveyorStorage{nullptr}, channel{std::move(c)} {
+	std::lock_guard<std::mutex> lock{channel->mutex};
+	channel->receiver = this;
+}
+
+template <typename T> CrossThreadConveyorNode<T>::~CrossThreadConveyorNode() {
+	std::lock_guard<std::mutex> lock{channel->mutex};
+	channel->receiver = nullptr;
+}
+
+template <typename T>
+void CrossThreadConveyorNode<T>::getResult(ErrorOrValue &err_or_val) {
+	std::lock_guard<std::mutex> lock{channel->mutex};
+	if (!channel->storage.empty()) {
+		err_or_val.as<T>() = std::move(channel->storage.front());
+		channel->storage.pop();
+	} else {
+		err_or_val.as<T>() =
+			criticalError("Signal for retrieval of storage sent even though no "
+						  "data is present");
+	}
+}
+
+template <typename T> size_t CrossThreadConveyorNode<T>::space() const {
+	std::lock_guard<std::mutex> lock{channel->mutex};
+	return std::numeric_limits<size_t>::max() - channel->storage.size();
+}
+
+template <typename T> size_t CrossThreadConveyorNode<T>::queued() const {
+	std::lock_guard<std::mutex> lock{channel->mutex};
+	return channel->storage.size();
+}
+
+template <typename T> void CrossThreadConveyorNode<T>::childHasFired() {
+	// Cross thread node has no children
+	assert(false);
+}
+
+template <typename T> void CrossThreadConveyorNode<T>::parentHasFired() {
+	SAW_ASSERT(parent) { return; }
+
+	if (parent->space() > 0 && queued() > 0 && !isArmed()) {
+		armLater();
+	}
+}
+
+template <typename T>
+void CrossThreadConveyorNode<T>::setParent(ConveyorStorage *p) {
+	if (p && !isArmed() && queued() > 0) {
+		if (p->space() > 0) {
+			armLater();
+		}
+	}
+
+	parent = p;
+}
+
+template <typename T> void CrossThreadConveyorNode<T>::fire() {
+	{
+		std::lock_guard<std::mutex> lock{channel->mutex};
+		channel->notified = false;
+	}
+
+	if (parent) {
+		if (parent->space() == 0) {
+			return;
+		}
+
+		parent->childHasFired();
+
+		if (queued() > 0 && parent->space() > 0) {
+			armLater();
+		}
+	}
+}
+
 template <typename T> AdaptConveyorFeeder<T>::~AdaptConveyorFeeder() {
 	if (feedee) {
 		feedee->setFeeder(nullptr);
@@ -490,13 +1350,37 @@ template <typename T> size_t AdaptConveyorFeeder<T>::space() const {
 	return 0;
 }
 
+template <typename T>
+void AdaptConveyorFeeder<T>::onTaken(std::function<void()> callback) {
+	taken_callback = std::move(callback);
+}
+
+template <typename T> void AdaptConveyorFeeder<T>::taken() {
+	if (taken_callback) {
+		taken_callback();
+	}
+}
+
+template <typename T>
+void AdaptConveyorFeeder<T>::onDropped(std::function<void()> callback) {
+	dropped_callback = std::move(callback);
+}
+
+template <typename T> void AdaptConveyorFeeder<T>::dropped() {
+	feedee = nullptr;
+	if (dropped_callback) {
+		dropped_callback();
+	}
+}
+
 template <typename T>
 AdaptConveyorNode<T>::AdaptConveyorNode() : ConveyorEventStorage{nullptr} {}
 
 template <typename T> AdaptConveyorNode<T>::~AdaptConveyorNode() {
 	if (feeder) {
-		feeder->setFeedee(nullptr);
+		AdaptConveyorFeeder<T> *dropping = feeder;
 		feeder = nullptr;
+		dropping->dropped();
 	}
 }
 
@@ -528,6 +1412,9 @@ void AdaptConveyorNode<T>::getResult(ErrorOrValue &err_or_val) {
 	if (!storage.empty()) {
 		err_or_val.as<T>() = std::move(storage.front());
 		storage.pop();
+		if (feeder) {
+			feeder->taken();
+		}
 	} else {
 		err_or_val.as<T>() =
 			criticalError("Signal for retrieval of storage sent even though no "
@@ -546,13 +1433,22 @@ template <typename T> void AdaptConveyorNode<T>::parentHasFired() {
 	if (parent->space() == 0) {
 		return;
 	}
+
+	if (storage.size() > 0 && !isArmed()) {
+		armLater();
+	}
 }
 
 template <typename T> void AdaptConveyorNode<T>::fire() {
 	if (parent) {
+		if (parent->space() == 0) {
+			// parentHasFired() rearms this node once the parent has space
+			return;
+		}
+
 		parent->childHasFired();
 
-		if (storage.size() > 0) {
+		if (storage.size() > 0 && parent->space() > 0) {
 			armLater();
 		}
 	}
@@ -6,6 +6,13 @@
 #include <iomanip>
 #include <sstream>
 
+#ifdef SAW_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace saw {
 Error Buffer::push(const uint8_t &value) {
 	size_t write_remain = writeCompositeLength();
@@ -429,4 +436,176 @@ Error ArrayBuffer::writeRequireLength(size_t bytes) {
 	return noError();
 }
 
+MappedFileBuffer::MappedFileBuffer(uint8_t *data, size_t mapped_length,
+								   size_t content_length, int file_descriptor,
+								   bool writable)
+	: data{data}, mapped_length{mapped_length},
+	  file_descriptor{file_descriptor}, writable{writable}, read_position{0},
+	  write_position{content_length} {}
+
+MappedFileBuffer::~MappedFileBuffer() {
+#ifdef SAW_UNIX
+	if (data) {
+		::munmap(data, mapped_length);
+	}
+	if (file_descriptor >= 0) {
+		if (writable) {
+			// Drops the unused capacity
+			int rc = ::ftruncate(file_descriptor,
+								 static_cast<off_t>(write_position));
+			(void)rc;
+		}
+		::close(file_descriptor);
+	}
+#endif
+}
+
+size_t MappedFileBuffer::readPosition() const { return read_position; }
+
+size_t MappedFileBuffer::readCompositeLength() const {
+	return write_position - read_position;
+}
+
+size_t MappedFileBuffer::readSegmentLength(size_t offset) const {
+	size_t read_composite = readCompositeLength();
+	assert(offset <= read_composite);
+
+	offset = std::min(read_composite, offset);
+	return read_composite - offset;
+}
+
+void MappedFileBuffer::readAdvance(size_t bytes) {
+	assert(bytes <= readCompositeLength());
+	read_position += bytes;
+}
+
+uint8_t &MappedFileBuffer::read(size_t i) {
+	assert(i < readCompositeLength());
+	return data[i + read_position];
+}
+
+const uint8_t &MappedFileBuffer::read(size_t i) const {
+	assert(i < readCompositeLength());
+	return data[i + read_position];
+}
+
+size_t MappedFileBuffer::writePosition() const { return write_position; }
+
+size_t MappedFileBuffer::writeCompositeLength() const {
+	return writable ? mapped_length - write_position : 0;
+}
+
+size_t MappedFileBuffer::writeSegmentLength(size_t offset) const {
+	size_t write_composite = writeCompositeLength();
+	assert(offset <= write_composite);
+
+	offset = std::min(write_composite, offset);
+	return write_composite - offset;
+}
+
+void MappedFileBuffer::writeAdvance(size_t bytes) {
+	assert(bytes <= writeCompositeLength());
+	write_position += bytes;
+}
+
+uint8_t &MappedFileBuffer::write(size_t i) {
+	assert(i < writeCompositeLength());
+	return data[i + write_position];
+}
+
+const uint8_t &MappedFileBuffer::write(size_t i) const {
+	assert(i < writeCompositeLength());
+	return data[i + write_position];
+}
+
+Error MappedFileBuffer::writeRequireLength(size_t bytes) {
+	if (bytes > writeCompositeLength()) {
+		return recoverableError("Buffer too small");
+	}
+	return noError();
+}
+
+Error MappedFileBuffer::sync() {
+#ifdef SAW_UNIX
+	if (!writable || !data) {
+		return noError();
+	}
+	if (::msync(data, mapped_length, MS_SYNC) < 0) {
+		return criticalError("Couldn't sync mapped file");
+	}
+	return noError();
+#else
+	return criticalError("Mapping files isn't supported on this platform");
+#endif
+}
+
+ErrorOr<Own<MappedFileBuffer>> mapFile(const std::string &path,
+									   MappedFileMode mode,
+									   const MappedFileOptions &options) {
+#ifdef SAW_UNIX
+	bool writable = mode == MappedFileMode::ReadWrite;
+
+	int flags = writable ? O_RDWR | O_CREAT : O_RDONLY;
+	int fd = ::open(path.c_str(), flags | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		return criticalError("Couldn't open file");
+	}
+
+	struct ::stat file_stat;
+	if (::fstat(fd, &file_stat) < 0) {
+		::close(fd);
+		return criticalError("Couldn't stat file");
+	}
+	size_t content_length = static_cast<size_t>(file_stat.st_size);
+
+	size_t mapped_length = content_length;
+	if (writable && options.capacity > content_length) {
+		if (::ftruncate(fd, static_cast<off_t>(options.capacity)) < 0) {
+			::close(fd);
+			return criticalError("Couldn't grow file");
+		}
+		mapped_length = options.capacity;
+	}
+
+	// Empty mappings aren't allowed
+	uint8_t *data = nullptr;
+	if (mapped_length > 0) {
+		int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+		int map_flags = writable ? MAP_SHARED : MAP_PRIVATE;
+		if (options.populate) {
+			map_flags |= MAP_POPULATE;
+		}
+
+		void *mapping =
+			::mmap(nullptr, mapped_length, protection, map_flags, fd, 0);
+		if (mapping == MAP_FAILED) {
+			::close(fd);
+			return criticalError("Couldn't map file");
+		}
+		data = static_cast<uint8_t *>(mapping);
+
+		// Only hints, failing to apply them isn't an error
+		if (options.sequential) {
+			::madvise(mapping, mapped_length, MADV_SEQUENTIAL);
+		}
+		if (options.will_need) {
+			::madvise(mapping, mapped_length, MADV_WILLNEED);
+		}
+	}
+
+	// Read-only mappings don't need the descriptor anymore
+	if (!writable) {
+		::close(fd);
+		fd = -1;
+	}
+
+	return Own<MappedFileBuffer>{new MappedFileBuffer{
+		data, mapped_length, content_length, fd, writable}};
+#else
+	(void)path;
+	(void)mode;
+	(void)options;
+	return criticalError("Mapping files isn't supported on this platform");
+#endif
+}
 } // namespace saw
@@ -189,4 +189,81 @@ public:
 
 	Error writeRequireLength(size_t bytes) override;
 };
+
+enum class MappedFileMode : uint8_t { ReadOnly, ReadWrite };
+
+struct MappedFileOptions {
+	/// Lets the kernel read ahead aggressively and drop pages behind reads
+	bool sequential = true;
+	/// Starts reading the whole file into the page cache in the background
+	bool will_need = false;
+	/// Faults in all pages while mapping, so parsing never waits on the disk
+	bool populate = false;
+	/**
+	 * Read-write files are grown to at least this size to make room for
+	 * writes behind the current content
+	 */
+	size_t capacity = 0;
+};
+
+/*
+ * Buffer over a memory mapped file. Codecs can decode straight from the
+ * file without copying it into memory first.
+ * The content of the file is readable. With read-write mappings the room up
+ * to the capacity is writable and on destruction the file is cut to the
+ * written length.
+ */
+class MappedFileBuffer final : public Buffer {
+private:
+	uint8_t *data;
+	size_t mapped_length;
+	int file_descriptor;
+	bool writable;
+
+	size_t read_position;
+	size_t write_position;
+
+	MappedFileBuffer(uint8_t *data, size_t mapped_length, size_t content_length,
+					 int file_descriptor, bool writable);
+
+	friend ErrorOr<Own<MappedFileBuffer>>
+	mapFile(const std::string &path, MappedFileMode mode,
+			const MappedFileOptions &options);
+
+public:
+	~MappedFileBuffer();
+
+	SAW_FORBID_COPY(MappedFileBuffer);
+	SAW_FORBID_MOVE(MappedFileBuffer);
+
+	size_t readPosition() const override;
+	size_t readCompositeLength() const override;
+	size_t readSegmentLength(size_t offset = 0) const override;
+	void readAdvance(size_t bytes) override;
+
+	uint8_t &read(size_t i = 0) override;
+	const uint8_t &read(size_t i = 0) const override;
+
+	size_t writePosition() const override;
+	size_t writeCompositeLength() const override;
+	size_t writeSegmentLength(size_t offset = 0) const override;
+	void writeAdvance(size_t bytes) override;
+
+	uint8_t &write(size_t i = 0) override;
+	const uint8_t &write(size_t i = 0) const override;
+
+	/**
+	 * The mapping has a fixed size
+	 */
+	Error writeRequireLength(size_t bytes) override;
+
+	/**
+	 * Writes modified pages back to the file
+	 */
+	Error sync();
+};
+
+ErrorOr<Own<MappedFileBuffer>>
+mapFile(const std::string &path, MappedFileMode mode,
+		const MappedFileOptions &options = {});
 } // namespace saw
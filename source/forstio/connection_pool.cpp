@@ -0,0 +1,349 @@
+#include "connection_pool.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace saw {
+/**
+ * Pending acquire(). Attached to the returned conveyor, so dropping the
+ * conveyor removes the request from the queue or aborts its connect.
+ */
+class ConnectionPool::Request {
+public:
+	ConnectionPool &pool;
+	std::string key;
+	Own<ConveyorFeeder<ConnectionLease>> feeder;
+
+	bool waiting = true;
+	/// Set while a connect for this request occupies a connection slot
+	bool has_slot = false;
+	/// Set while the destination is resolved for this request
+	bool resolving = false;
+	SinkConveyor resolution;
+	Own<NetworkAddress> address = nullptr;
+	SinkConveyor connecting;
+
+	Request(ConnectionPool &pool, const std::string &key,
+			Own<ConveyorFeeder<ConnectionLease>> feeder)
+		: pool{pool}, key{key}, feeder{std::move(feeder)} {}
+
+	~Request() { pool.cancel(*this); }
+};
+
+ConnectionLease::ConnectionLease(ConnectionPool &pool, const std::string &key,
+								 Own<IoStream> connection)
+	: pool{&pool}, key{key}, connection{std::move(connection)} {}
+
+ConnectionLease::~ConnectionLease() { release(); }
+
+ConnectionLease::ConnectionLease(ConnectionLease &&other)
+	: pool{other.pool}, key{std::move(other.key)},
+	  connection{std::move(other.connection)} {
+	other.pool = nullptr;
+}
+
+ConnectionLease &ConnectionLease::operator=(ConnectionLease &&other) {
+	if (this != &other) {
+		release();
+		pool = other.pool;
+		key = std::move(other.key);
+		connection = std::move(other.connection);
+		other.pool = nullptr;
+	}
+	return *this;
+}
+
+void ConnectionLease::release() {
+	if (!pool) {
+		return;
+	}
+	ConnectionPool *releasing = pool;
+	pool = nullptr;
+	releasing->release(key, std::move(connection));
+}
+
+IoStream &ConnectionLease::stream() {
+	assert(connection);
+	return *connection;
+}
+
+IoStream *ConnectionLease::operator->() { return connection.get(); }
+
+void ConnectionLease::discard() {
+	connection = nullptr;
+	release();
+}
+
+ConnectionPool::Destination::Destination(const std::string &address,
+										 uint16_t port)
+	: address{address}, port{port} {}
+
+ConnectionPool::SweepEvent::SweepEvent(ConnectionPool &pool) : pool{pool} {}
+
+void ConnectionPool::SweepEvent::fire() { pool.sweep(); }
+
+ConnectionPool::EvictEvent::EvictEvent(ConnectionPool &pool) : pool{pool} {}
+
+void ConnectionPool::EvictEvent::fire() { pool.evictClosed(); }
+
+ConnectionPool::ConnectionPool(Network &network,
+							   const ConnectionPoolOptions &options)
+	: network{network}, options{options} {
+	assert(options.max_connections_per_destination > 0);
+}
+
+ConnectionPool::~ConnectionPool() {
+	assert(std::all_of(destinations.begin(), destinations.end(),
+					   [](const auto &iter) {
+						   return iter.second.open == iter.second.idle.size() &&
+								  iter.second.waiting.empty();
+					   }));
+}
+
+Conveyor<ConnectionLease> ConnectionPool::acquire(NetworkAddress &address) {
+	std::string key = address.address() + ":" + std::to_string(address.port());
+
+	auto find = destinations.find(key);
+	if (find == destinations.end()) {
+		find = destinations
+				   .try_emplace(key, address.address(), address.port())
+				   .first;
+	}
+
+	auto caf = newConveyorAndFeeder<ConnectionLease>();
+	Own<Request> request = heap<Request>(*this, key, std::move(caf.feeder));
+
+	find->second.waiting.push_back(request.get());
+	dispatch(key);
+
+	return caf.conveyor.attach(std::move(request));
+}
+
+void ConnectionPool::dispatch(const std::string &key) {
+	auto find = destinations.find(key);
+	if (find == destinations.end()) {
+		return;
+	}
+	Destination &destination = find->second;
+
+	while (!destination.waiting.empty()) {
+		Request &request = *destination.waiting.front();
+
+		if (!destination.idle.empty()) {
+			Own<IdleConnection> idle = std::move(destination.idle.back());
+			destination.idle.pop_back();
+			if (idle->closed) {
+				--destination.open;
+				continue;
+			}
+			Own<IoStream> connection = std::move(idle->connection);
+
+			destination.waiting.pop_front();
+			request.waiting = false;
+			request.feeder->feed(
+				ConnectionLease{*this, key, std::move(connection)});
+		} else if (destination.open <
+				   options.max_connections_per_destination) {
+			++destination.open;
+
+			destination.waiting.pop_front();
+			request.waiting = false;
+			connect(destination, request);
+		} else {
+			break;
+		}
+	}
+
+	if (destination.open == 0 && destination.waiting.empty()) {
+		destinations.erase(find);
+	}
+}
+
+void ConnectionPool::connect(Destination &destination, Request &request) {
+	request.has_slot = true;
+
+	// Resolved for each connect, so the resolver cache decides how long an
+	// address is reused and changed records are picked up
+	request.resolving = true;
+	request.resolution =
+		network.parseAddress(destination.address, destination.port)
+			.then(
+				[this, &request](Own<NetworkAddress> address) {
+					request.resolving = false;
+					request.address = std::move(address);
+					connectResolved(request, *request.address);
+				},
+				[this, &request](Error &&error) {
+					// Immediate conveyors report exhaustion after their value
+					if (!request.resolving) {
+						return std::move(error);
+					}
+					request.resolving = false;
+					request.has_slot = false;
+					request.feeder->fail(error.copyError());
+					release(request.key, nullptr);
+					return std::move(error);
+				})
+			.sink();
+}
+
+void ConnectionPool::connectResolved(Request &request,
+									 NetworkAddress &address) {
+	request.connecting =
+		network.connect(address)
+			.then(
+				[this, &request](Own<IoStream> connection) {
+					request.has_slot = false;
+					request.feeder->feed(ConnectionLease{
+						*this, request.key, std::move(connection)});
+				},
+				[this, &request](Error &&error) {
+					// Immediate conveyors report exhaustion after their value
+					if (!request.has_slot) {
+						return std::move(error);
+					}
+					request.has_slot = false;
+					request.feeder->fail(error.copyError());
+					release(request.key, nullptr);
+					return std::move(error);
+				})
+			.sink();
+}
+
+void ConnectionPool::release(const std::string &key,
+							 Own<IoStream> connection) {
+	auto find = destinations.find(key);
+	assert(find != destinations.end());
+	if (find == destinations.end()) {
+		return;
+	}
+	Destination &destination = find->second;
+
+	if (connection) {
+		Own<IdleConnection> idle = heap<IdleConnection>();
+		IdleConnection *watched = idle.get();
+		idle->since = std::chrono::steady_clock::now();
+		idle->disconnected = connection->onReadDisconnected()
+								 .then([this, watched]() {
+									 watched->closed = true;
+									 scheduleEviction();
+								 })
+								 .sink();
+		idle->connection = std::move(connection);
+		destination.idle.push_back(std::move(idle));
+		scheduleSweep();
+	} else {
+		assert(destination.open > 0);
+		--destination.open;
+	}
+
+	dispatch(key);
+}
+
+void ConnectionPool::cancel(Request &request) {
+	if (request.waiting) {
+		auto find = destinations.find(request.key);
+		assert(find != destinations.end());
+		auto &waiting = find->second.waiting;
+		waiting.erase(std::remove(waiting.begin(), waiting.end(), &request),
+					  waiting.end());
+		dispatch(request.key);
+	} else if (request.has_slot) {
+		request.has_slot = false;
+		request.resolving = false;
+		request.resolution = SinkConveyor{};
+		request.connecting = SinkConveyor{};
+		release(request.key, nullptr);
+	}
+}
+
+void ConnectionPool::scheduleSweep() {
+	if (!sweep_event) {
+		sweep_event = heap<SweepEvent>(*this);
+	}
+	if (!sweep_event->isScheduled()) {
+		sweep_event->armAfter(options.idle_timeout);
+	}
+}
+
+void ConnectionPool::sweep() {
+	auto now = std::chrono::steady_clock::now();
+	bool has_idle = false;
+	std::chrono::steady_clock::time_point oldest;
+
+	for (auto iter = destinations.begin(); iter != destinations.end();) {
+		Destination &destination = iter->second;
+
+		auto expired = std::find_if(destination.idle.begin(),
+									destination.idle.end(),
+									[&](const Own<IdleConnection> &idle) {
+										return idle->since +
+												   options.idle_timeout >
+											   now;
+									});
+		destination.open -= static_cast<size_t>(
+			std::distance(destination.idle.begin(), expired));
+		destination.idle.erase(destination.idle.begin(), expired);
+
+		if (!destination.idle.empty()) {
+			auto since = destination.idle.front()->since;
+			oldest = has_idle ? std::min(oldest, since) : since;
+			has_idle = true;
+		}
+
+		if (destination.open == 0 && destination.waiting.empty()) {
+			iter = destinations.erase(iter);
+		} else {
+			++iter;
+		}
+	}
+
+	if (has_idle) {
+		sweep_event->armAt(oldest + options.idle_timeout);
+	}
+}
+
+void ConnectionPool::scheduleEviction() {
+	if (!evict_event) {
+		evict_event = heap<EvictEvent>(*this);
+	}
+	if (!evict_event->isArmed()) {
+		evict_event->armLater();
+	}
+}
+
+void ConnectionPool::evictClosed() {
+	std::vector<std::string> keys;
+	for (auto &iter : destinations) {
+		Destination &destination = iter.second;
+		auto closed = std::remove_if(
+			destination.idle.begin(), destination.idle.end(),
+			[](const Own<IdleConnection> &idle) { return idle->closed; });
+		destination.open -= static_cast<size_t>(
+			std::distance(closed, destination.idle.end()));
+		destination.idle.erase(closed, destination.idle.end());
+		keys.push_back(iter.first);
+	}
+
+	// Frees slots for queued requests and drops unused destinations
+	for (auto &key : keys) {
+		dispatch(key);
+	}
+}
+
+size_t ConnectionPool::idleConnections() const {
+	size_t count = 0;
+	for (auto &iter : destinations) {
+		count += iter.second.idle.size();
+	}
+	return count;
+}
+
+size_t ConnectionPool::openConnections() const {
+	size_t count = 0;
+	for (auto &iter : destinations) {
+		count += iter.second.open;
+	}
+	return count;
+}
+} // namespace saw
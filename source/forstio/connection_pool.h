@@ -0,0 +1,156 @@
+#pragma once
+
+#include "async.h"
+#include "common.h"
+#include "io.h"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace saw {
+struct ConnectionPoolOptions {
+	/// Cap of open connections to one destination, idle and leased ones
+	size_t max_connections_per_destination = 8;
+	/// Idle connections are closed once they weren't used for this long
+	std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds{30};
+};
+
+class ConnectionPool;
+
+/**
+ * Exclusive use of a pooled connection. The connection returns to the pool
+ * once the lease is destroyed, unless it was discarded.
+ */
+class ConnectionLease {
+private:
+	ConnectionPool *pool = nullptr;
+	std::string key;
+	Own<IoStream> connection = nullptr;
+
+	friend class ConnectionPool;
+	ConnectionLease(ConnectionPool &pool, const std::string &key,
+					Own<IoStream> connection);
+
+	void release();
+
+public:
+	ConnectionLease() = default;
+	~ConnectionLease();
+
+	ConnectionLease(ConnectionLease &&);
+	ConnectionLease &operator=(ConnectionLease &&);
+
+	SAW_FORBID_COPY(ConnectionLease);
+
+	IoStream &stream();
+	IoStream *operator->();
+
+	/**
+	 * Closes the connection instead of handing it to the next user. Should be
+	 * called if the connection failed or its protocol state is unknown.
+	 */
+	void discard();
+};
+
+/**
+ * Client side connection cache on top of a Network. Connections are pooled
+ * per destination address and port and reused in LIFO order, so rarely used
+ * connections run into the idle timeout. Idle connections closed by the
+ * peer are evicted and never handed out.
+ * If a destination is at its connection cap, acquire() requests queue up and
+ * are served in FIFO order as soon as a lease ends.
+ *
+ * The pool has to outlive all leases and pending acquire() conveyors.
+ */
+class ConnectionPool {
+private:
+	class Request;
+
+	struct IdleConnection {
+		Own<IoStream> connection;
+		std::chrono::steady_clock::time_point since;
+		/// Watches for the peer closing the connection while it is idle
+		SinkConveyor disconnected;
+		bool closed = false;
+	};
+
+	struct Destination {
+		std::string address;
+		uint16_t port;
+		/// Ordered by since, the most recently returned connection is last
+		std::vector<Own<IdleConnection>> idle;
+		size_t open = 0;
+		std::deque<Request *> waiting;
+
+		Destination(const std::string &address, uint16_t port);
+	};
+
+	class SweepEvent final : public TimerEvent {
+	private:
+		ConnectionPool &pool;
+
+	public:
+		SweepEvent(ConnectionPool &pool);
+
+		void fire() override;
+	};
+
+	class EvictEvent final : public Event {
+	private:
+		ConnectionPool &pool;
+
+	public:
+		EvictEvent(ConnectionPool &pool);
+
+		void fire() override;
+	};
+
+	Network &network;
+	ConnectionPoolOptions options;
+
+	std::map<std::string, Destination> destinations;
+
+	Own<SweepEvent> sweep_event = nullptr;
+	Own<EvictEvent> evict_event = nullptr;
+
+	void dispatch(const std::string &key);
+	void connect(Destination &destination, Request &request);
+	void connectResolved(Request &request, NetworkAddress &address);
+
+	/**
+	 * Takes back a leased connection. A null connection frees its slot.
+	 */
+	void release(const std::string &key, Own<IoStream> connection);
+	void cancel(Request &request);
+
+	void scheduleSweep();
+	void sweep();
+
+	void scheduleEviction();
+	/**
+	 * Drops idle connections which were closed by the peer.
+	 */
+	void evictClosed();
+
+	friend class ConnectionLease;
+
+public:
+	ConnectionPool(Network &network, const ConnectionPoolOptions &options = {});
+	~ConnectionPool();
+
+	SAW_FORBID_COPY(ConnectionPool);
+	SAW_FORBID_MOVE(ConnectionPool);
+
+	/**
+	 * Hands out an idle connection or opens a new one. Dropping the returned
+	 * conveyor cancels the request.
+	 */
+	Conveyor<ConnectionLease> acquire(NetworkAddress &address);
+
+	size_t idleConnections() const;
+	size_t openConnections() const;
+};
+} // namespace saw
@@ -0,0 +1,143 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+
+namespace saw {
+LatencyHistogram::Snapshot::Snapshot()
+	: counts(LatencyHistogram::bucket_count, 0), total_count{0},
+	  total_sum{0}, max_value{0} {}
+
+void LatencyHistogram::Snapshot::merge(const Snapshot &other) {
+	for (size_t i = 0; i < counts.size(); ++i) {
+		counts[i] += other.counts[i];
+	}
+	total_count += other.total_count;
+	total_sum += other.total_sum;
+	max_value = std::max(max_value, other.max_value);
+}
+
+uint64_t LatencyHistogram::Snapshot::count() const { return total_count; }
+
+std::chrono::nanoseconds LatencyHistogram::Snapshot::max() const {
+	return std::chrono::nanoseconds{max_value};
+}
+
+std::chrono::nanoseconds LatencyHistogram::Snapshot::mean() const {
+	if (total_count == 0) {
+		return std::chrono::nanoseconds{0};
+	}
+	return std::chrono::nanoseconds{total_sum / total_count};
+}
+
+std::chrono::nanoseconds
+LatencyHistogram::Snapshot::percentile(double percentile) const {
+	if (total_count == 0) {
+		return std::chrono::nanoseconds{0};
+	}
+
+	percentile = std::clamp(percentile, 0.0, 100.0);
+	uint64_t rank = static_cast<uint64_t>(
+		std::ceil(percentile / 100.0 * static_cast<double>(total_count)));
+	rank = std::max<uint64_t>(rank, 1);
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < counts.size(); ++i) {
+		seen += counts[i];
+		if (seen >= rank) {
+			// The bucket bound may overshoot the largest recorded value
+			return std::chrono::nanoseconds{
+				std::min(LatencyHistogram::bucketUpperBound(i), max_value)};
+		}
+	}
+
+	return std::chrono::nanoseconds{max_value};
+}
+
+LatencyHistogram::LatencyHistogram() : total_sum{0}, max_value{0} {
+	for (auto &count : counts) {
+		count.store(0, std::memory_order_relaxed);
+	}
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value) {
+	if (value < 2 * half_sub_buckets) {
+		return static_cast<size_t>(value);
+	}
+
+	size_t msb = 63 - static_cast<size_t>(std::countl_zero(value));
+	size_t shift = msb - (LATENCY_HISTOGRAM_PRECISION_BITS - 1);
+	size_t mantissa = static_cast<size_t>(value >> shift);
+
+	return shift * half_sub_buckets + mantissa;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t index) {
+	if (index < 2 * half_sub_buckets) {
+		return index;
+	}
+
+	size_t shift = index / half_sub_buckets - 1;
+	uint64_t mantissa = index - shift * half_sub_buckets;
+
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(
+	const std::chrono::steady_clock::duration &duration) {
+	auto nanoseconds =
+		std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	recordNanoseconds(nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds)
+									  : 0);
+}
+
+void LatencyHistogram::recordNanoseconds(uint64_t value) {
+	size_t index = bucketIndex(value);
+	assert(index < bucket_count);
+
+	counts[index].fetch_add(1, std::memory_order_relaxed);
+	total_sum.fetch_add(value, std::memory_order_relaxed);
+
+	uint64_t current_max = max_value.load(std::memory_order_relaxed);
+	while (current_max < value &&
+		   !max_value.compare_exchange_weak(current_max, value,
+											std::memory_order_relaxed)) {
+	}
+}
+
+void LatencyHistogram::merge(const Snapshot &snapshot) {
+	for (size_t i = 0; i < bucket_count; ++i) {
+		if (snapshot.counts[i] > 0) {
+			counts[i].fetch_add(snapshot.counts[i], std::memory_order_relaxed);
+		}
+	}
+	total_sum.fetch_add(snapshot.total_sum, std::memory_order_relaxed);
+
+	uint64_t current_max = max_value.load(std::memory_order_relaxed);
+	while (current_max < snapshot.max_value &&
+		   !max_value.compare_exchange_weak(current_max, snapshot.max_value,
+											std::memory_order_relaxed)) {
+	}
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+	Snapshot snap;
+	for (size_t i = 0; i < bucket_count; ++i) {
+		snap.counts[i] = counts[i].load(std::memory_order_relaxed);
+		snap.total_count += snap.counts[i];
+	}
+	snap.total_sum = total_sum.load(std::memory_order_relaxed);
+	snap.max_value = max_value.load(std::memory_order_relaxed);
+	return snap;
+}
+
+void LatencyHistogram::reset() {
+	for (auto &count : counts) {
+		count.store(0, std::memory_order_relaxed);
+	}
+	total_sum.store(0, std::memory_order_relaxed);
+	max_value.store(0, std::memory_order_relaxed);
+}
+} // namespace saw
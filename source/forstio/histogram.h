@@ -0,0 +1,85 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace saw {
+/**
+ * Log linear latency histogram similar to HdrHistogram.
+ * Values are recorded in nanoseconds. Every power of two range is split into
+ * 2^(LATENCY_HISTOGRAM_PRECISION_BITS - 1) buckets, which bounds the
+ * relative error of a reported value to about 3%.
+ *
+ * Recording is lock free and may happen from any thread.
+ */
+constexpr size_t LATENCY_HISTOGRAM_PRECISION_BITS = 6;
+
+class LatencyHistogram {
+public:
+	static constexpr size_t half_sub_buckets =
+		size_t{1} << (LATENCY_HISTOGRAM_PRECISION_BITS - 1);
+	static constexpr size_t bucket_count =
+		(64 - LATENCY_HISTOGRAM_PRECISION_BITS + 2) * half_sub_buckets;
+
+	/**
+	 * Plain copy of the counters. Snapshots of different histograms can be
+	 * merged, e.g. to combine the histograms of multiple event loops.
+	 */
+	class Snapshot {
+	private:
+		std::vector<uint64_t> counts;
+		uint64_t total_count;
+		uint64_t total_sum;
+		uint64_t max_value;
+
+		friend class LatencyHistogram;
+
+	public:
+		Snapshot();
+
+		void merge(const Snapshot &other);
+
+		uint64_t count() const;
+
+		std::chrono::nanoseconds max() const;
+		std::chrono::nanoseconds mean() const;
+
+		/**
+		 * Returns the upper bound of the bucket containing the percentile.
+		 * percentile is expected in the range [0,100].
+		 */
+		std::chrono::nanoseconds percentile(double percentile) const;
+	};
+
+private:
+	std::array<std::atomic<uint64_t>, bucket_count> counts;
+	std::atomic<uint64_t> total_sum;
+	std::atomic<uint64_t> max_value;
+
+public:
+	LatencyHistogram();
+
+	SAW_FORBID_COPY(LatencyHistogram);
+	SAW_FORBID_MOVE(LatencyHistogram);
+
+	void record(const std::chrono::steady_clock::duration &duration);
+	void recordNanoseconds(uint64_t value);
+
+	/**
+	 * Adds the counts of a snapshot to this histogram
+	 */
+	void merge(const Snapshot &snapshot);
+
+	Snapshot snapshot() const;
+
+	void reset();
+
+	static size_t bucketIndex(uint64_t value);
+	static uint64_t bucketUpperBound(size_t index);
+};
+} // namespace saw
@@ -1,8 +1,169 @@
 #include "io.h"
 
+#include "buffer.h"
+
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <vector>
+
+#ifdef SAW_UNIX
+#include <errno.h>
+#include <unistd.h>
+#endif
 
 namespace saw {
+namespace {
+size_t
+bufferReadSegments(Buffer &buffer,
+				   std::array<IoVector, IO_VECTOR_MAX_SEGMENTS> &segments) {
+	size_t count = 0;
+	size_t offset = 0;
+	size_t length = buffer.readCompositeLength();
+	while (offset < length && count < segments.size()) {
+		size_t segment_length = buffer.readSegmentLength(offset);
+		if (segment_length == 0) {
+			break;
+		}
+		segments[count] = IoVector{&buffer.read(offset), segment_length};
+		offset += segment_length;
+		++count;
+	}
+	return count;
+}
+
+size_t
+bufferWriteSegments(Buffer &buffer,
+					std::array<IoVector, IO_VECTOR_MAX_SEGMENTS> &segments) {
+	size_t count = 0;
+	size_t offset = 0;
+	size_t length = buffer.writeCompositeLength();
+	while (offset < length && count < segments.size()) {
+		size_t segment_length = buffer.writeSegmentLength(offset);
+		if (segment_length == 0) {
+			break;
+		}
+		segments[count] = IoVector{&buffer.write(offset), segment_length};
+		offset += segment_length;
+		++count;
+	}
+	return count;
+}
+} // namespace
+
+ErrorOr<size_t> InputStream::readv(std::span<const IoVector> segments) {
+	size_t total = 0;
+	for (const IoVector &segment : segments) {
+		if (segment.length == 0) {
+			continue;
+		}
+
+		ErrorOr<size_t> n_err = read(segment.data, segment.length);
+		if (n_err.isError()) {
+			// Report the already read bytes first, the error repeats anyway
+			if (total > 0) {
+				return total;
+			}
+			return n_err;
+		}
+
+		size_t n = n_err.value();
+		total += n;
+		if (n < segment.length) {
+			break;
+		}
+	}
+	return total;
+}
+
+ErrorOr<size_t> InputStream::readv(Buffer &buffer) {
+	std::array<IoVector, IO_VECTOR_MAX_SEGMENTS> segments;
+	size_t count = bufferWriteSegments(buffer, segments);
+	if (count == 0) {
+		return recoverableError("Buffer is full");
+	}
+
+	ErrorOr<size_t> n_err =
+		readv(std::span<const IoVector>{segments.data(), count});
+	if (n_err.isValue()) {
+		buffer.writeAdvance(n_err.value());
+	}
+	return n_err;
+}
+
+ErrorOr<size_t> OutputStream::writev(std::span<const IoVector> segments) {
+	size_t total = 0;
+	for (const IoVector &segment : segments) {
+		if (segment.length == 0) {
+			continue;
+		}
+
+		ErrorOr<size_t> n_err = write(segment.data, segment.length);
+		if (n_err.isError()) {
+			if (total > 0) {
+				return total;
+			}
+			return n_err;
+		}
+
+		size_t n = n_err.value();
+		total += n;
+		if (n < segment.length) {
+			break;
+		}
+	}
+	return total;
+}
+
+ErrorOr<size_t> OutputStream::sendFile(int fd, uint64_t offset,
+									   size_t length) {
+#ifdef SAW_UNIX
+	/*
+	 * Only stages as much as one write is expected to take, since the rest
+	 * would be read again by the next call anyway
+	 */
+	constexpr size_t send_file_buffer_size = 16 * 1024;
+	thread_local std::vector<uint8_t> send_file_buffer(send_file_buffer_size);
+
+	size_t chunk = std::min(length, send_file_buffer.size());
+	if (chunk == 0) {
+		return size_t{0};
+	}
+
+	ssize_t read_bytes = ::pread(fd, send_file_buffer.data(), chunk,
+								 static_cast<off_t>(offset));
+	if (read_bytes == 0) {
+		return criticalError("End of file", Error::Code::Exhausted);
+	} else if (read_bytes < 0) {
+		if (errno == EINTR) {
+			return recoverableError("Interrupted");
+		}
+		return criticalError("Couldn't read file");
+	}
+
+	return write(send_file_buffer.data(), static_cast<size_t>(read_bytes));
+#else
+	(void)fd;
+	(void)offset;
+	(void)length;
+	return criticalError("Sending files isn't supported on this platform");
+#endif
+}
+
+ErrorOr<size_t> OutputStream::writev(Buffer &buffer) {
+	std::array<IoVector, IO_VECTOR_MAX_SEGMENTS> segments;
+	size_t count = bufferReadSegments(buffer, segments);
+	if (count == 0) {
+		return size_t{0};
+	}
+
+	ErrorOr<size_t> n_err =
+		writev(std::span<const IoVector>{segments.data(), count});
+	if (n_err.isValue()) {
+		buffer.readAdvance(n_err.value());
+	}
+	return n_err;
+}
 
 AsyncIoStream::AsyncIoStream(Own<IoStream> str)
 	: stream{std::move(str)}, read_ready{stream->readReady()
@@ -10,9 +171,6 @@ AsyncIoStream::AsyncIoStream(Own<IoStream> str)
 												 read_stepper.readStep(*stream);
 											 })
 											 .sink()},
-	  write_ready{stream->writeReady()
-					  .then([this]() { write_stepper.writeStep(*stream); })
-					  .sink()},
 	  read_disconnected{stream->onReadDisconnected()
 							.then([this]() {
 								if (read_stepper.on_read_disconnect) {
@@ -24,13 +182,83 @@ AsyncIoStream::AsyncIoStream(Own<IoStream> str)
 void AsyncIoStream::read(void *buffer, size_t min_length, size_t max_length) {
 	SAW_ASSERT(buffer && max_length >= min_length && min_length > 0) { return; }
 
-	SAW_ASSERT(!read_stepper.read_task.has_value()) { return; }
+	SAW_ASSERT(!read_stepper.read_task.has_value() &&
+			   !read_stepper.read_vector_task.has_value() &&
+			   !read_stepper.peek_task.has_value()) {
+		return;
+	}
 
 	read_stepper.read_task =
 		ReadTaskAndStepHelper::ReadIoTask{buffer, min_length, max_length, 0};
 	read_stepper.readStep(*stream);
 }
 
+void AsyncIoStream::setReadAhead(size_t capacity) {
+	SAW_ASSERT(!read_stepper.read_task.has_value() &&
+			   !read_stepper.read_vector_task.has_value() &&
+			   !read_stepper.peek_task.has_value() && buffered().empty()) {
+		return;
+	}
+
+	read_stepper.read_ahead = std::vector<uint8_t>(capacity);
+	read_stepper.read_ahead_begin = 0;
+	read_stepper.read_ahead_end = 0;
+}
+
+void AsyncIoStream::peek(size_t min_length) {
+	SAW_ASSERT(min_length > 0 &&
+			   min_length <= read_stepper.read_ahead.size()) {
+		return;
+	}
+
+	SAW_ASSERT(!read_stepper.read_task.has_value() &&
+			   !read_stepper.read_vector_task.has_value() &&
+			   !read_stepper.peek_task.has_value()) {
+		return;
+	}
+
+	read_stepper.peek_task = ReadTaskAndStepHelper::PeekIoTask{min_length};
+	read_stepper.readStep(*stream);
+}
+
+std::span<const uint8_t> AsyncIoStream::buffered() const {
+	return {read_stepper.read_ahead.data() + read_stepper.read_ahead_begin,
+			read_stepper.read_ahead_end - read_stepper.read_ahead_begin};
+}
+
+void AsyncIoStream::consume(size_t length) {
+	SAW_ASSERT(length <= buffered().size()) { return; }
+
+	read_stepper.read_ahead_begin += length;
+}
+
+void AsyncIoStream::readv(std::span<const IoVector> segments,
+						  size_t min_length) {
+	SAW_ASSERT(!segments.empty() && min_length > 0) { return; }
+
+	SAW_ASSERT(!read_stepper.read_task.has_value() &&
+			   !read_stepper.read_vector_task.has_value() &&
+			   !read_stepper.peek_task.has_value() && buffered().empty()) {
+		return;
+	}
+
+	read_stepper.read_vector_task = ReadTaskAndStepHelper::ReadVectorIoTask{
+		{segments.begin(), segments.end()}, 0, min_length, 0};
+	read_stepper.readStep(*stream);
+}
+
+void AsyncIoStream::readv(Buffer &buffer, size_t min_length) {
+	std::array<IoVector, IO_VECTOR_MAX_SEGMENTS> segments;
+	size_t count = bufferWriteSegments(buffer, segments);
+
+	readv(std::span<const IoVector>{segments.data(), count}, min_length);
+}
+
+void AsyncIoStream::matchReadLowWatermark(bool enabled) {
+	read_stepper.match_low_watermark = enabled;
+	read_stepper.readStep(*stream);
+}
+
 Conveyor<size_t> AsyncIoStream::readDone() {
 	auto caf = newConveyorAndFeeder<size_t>();
 	read_stepper.read_done = std::move(caf.feeder);
@@ -46,11 +274,114 @@ Conveyor<void> AsyncIoStream::onReadDisconnected() {
 void AsyncIoStream::write(const void *buffer, size_t length) {
 	SAW_ASSERT(buffer && length > 0) { return; }
 
-	SAW_ASSERT(!write_stepper.write_task.has_value()) { return; }
+	SAW_ASSERT(!write_stepper.write_vector_task.has_value() &&
+			   !write_stepper.send_file_task.has_value()) {
+		return;
+	}
+
+	write_stepper.write_queue.push_back(
+		WriteTaskAndStepHelper::WriteIoTask{buffer, length, 0});
+	if (length >= ASYNC_IO_STREAM_COALESCE_LIMIT) {
+		writeStep();
+	} else {
+		scheduleFlush();
+	}
+}
+
+void AsyncIoStream::cork() { write_stepper.corked = true; }
+
+void AsyncIoStream::uncork() {
+	write_stepper.corked = false;
+	writeStep();
+}
+
+void AsyncIoStream::scheduleFlush() {
+	if (!flush_event) {
+		flush_event = heap<FlushEvent>(*this);
+	}
+	flush_event->armLast();
+}
+
+AsyncIoStream::FlushEvent::FlushEvent(AsyncIoStream &stream)
+	: stream{stream} {}
+
+void AsyncIoStream::FlushEvent::fire() { stream.writeStep(); }
+
+bool AsyncIoStream::writePending() const {
+	return (!write_stepper.write_queue.empty() && !write_stepper.corked) ||
+		   write_stepper.write_vector_task.has_value() ||
+		   write_stepper.send_file_task.has_value();
+}
 
-	write_stepper.write_task =
-		WriteTaskAndStepHelper::WriteIoTask{buffer, length, 0};
+void AsyncIoStream::writeStep() {
 	write_stepper.writeStep(*stream);
+
+	if (writePending()) {
+		if (!waiting_for_write) {
+			subscribeWriteReady();
+		}
+	} else if (waiting_for_write) {
+		waiting_for_write = false;
+		write_ready = SinkConveyor{};
+	}
+}
+
+void AsyncIoStream::subscribeWriteReady() {
+	waiting_for_write = true;
+	write_ready = stream->writeReady()
+					  .then([this]() {
+						  write_stepper.writeStep(*stream);
+						  // The subscription can't be dropped from its own
+						  // callback, the flush releases it
+						  if (!writePending()) {
+							  scheduleFlush();
+						  }
+					  })
+					  .sink();
+}
+
+void AsyncIoStream::writev(std::span<const IoVector> segments) {
+	SAW_ASSERT(!segments.empty()) { return; }
+
+	SAW_ASSERT(write_stepper.write_queue.empty() &&
+			   !write_stepper.write_vector_task.has_value() &&
+			   !write_stepper.send_file_task.has_value()) {
+		return;
+	}
+
+	write_stepper.write_vector_task =
+		WriteTaskAndStepHelper::WriteVectorIoTask{
+			{segments.begin(), segments.end()}, 0, 0};
+	writeStep();
+}
+
+void AsyncIoStream::writev(Buffer &buffer) {
+	std::array<IoVector, IO_VECTOR_MAX_SEGMENTS> segments;
+	size_t count = bufferReadSegments(buffer, segments);
+
+	writev(std::span<const IoVector>{segments.data(), count});
+}
+
+void AsyncIoStream::sendFile(int fd, uint64_t offset, size_t length) {
+	SAW_ASSERT(fd >= 0 && length > 0) { return; }
+
+	SAW_ASSERT(write_stepper.write_queue.empty() &&
+			   !write_stepper.write_vector_task.has_value() &&
+			   !write_stepper.send_file_task.has_value()) {
+		return;
+	}
+
+	write_stepper.send_file_task =
+		WriteTaskAndStepHelper::SendFileIoTask{fd, offset, length, 0};
+	writeStep();
+}
+
+bool AsyncIoStream::setZeroCopyThreshold(size_t threshold) {
+	return stream->setZeroCopyThreshold(threshold);
+}
+
+bool AsyncIoStream::setWriteLowWatermark(size_t bytes) {
+	return stream->setWriteLowWatermark(bytes);
 }
 
 Conveyor<size_t> AsyncIoStream::writeDone() {
@@ -4,10 +4,18 @@
 #include "common.h"
 #include "io_helpers.h"
 
+#include <span>
 #include <string>
 #include <variant>
 
 namespace saw {
+class Buffer;
+
+/**
+ * Upper limit of segments the Buffer overloads gather in one call
+ */
+constexpr size_t IO_VECTOR_MAX_SEGMENTS = 16;
+
 /*
  * Input stream
  */
@@ -17,6 +25,33 @@ public:
 
 	virtual ErrorOr<size_t> read(void *buffer, size_t length) = 0;
 
+	/**
+	 * Scatter read. The default implementation reads segment after segment
+	 * until one isn't filled completely.
+	 */
+	virtual ErrorOr<size_t> readv(std::span<const IoVector> segments);
+
+	/**
+	 * Reads into the writable segments of the buffer and advances it
+	 */
+	ErrorOr<size_t> readv(Buffer &buffer);
+
+	/**
+	 * File descriptor the stream reads from directly, if there is one.
+	 * Allows helpers like pump to hand transfers to the kernel.
+	 */
+	virtual Maybe<int> inputFd() const { return std::nullopt; }
+
+	/**
+	 * readReady only fires once at least bytes can be read, so a reader
+	 * waiting for the rest of a frame isn't woken up for each fragment. 1
+	 * restores the default. Returns false if the stream doesn't support it.
+	 */
+	virtual bool setReadLowWatermark(size_t bytes) {
+		(void)bytes;
+		return false;
+	}
+
 	virtual Conveyor<void> readReady() = 0;
 
 	virtual Conveyor<void> onReadDisconnected() = 0;
@@ -31,6 +66,57 @@ public:
 
 	virtual ErrorOr<size_t> write(const void *buffer, size_t length) = 0;
 
+	/**
+	 * Gather write. The default implementation writes segment after segment
+	 * until one isn't written completely.
+	 */
+	virtual ErrorOr<size_t> writev(std::span<const IoVector> segments);
+
+	/**
+	 * Writes the readable segments of the buffer and advances it
+	 */
+	ErrorOr<size_t> writev(Buffer &buffer);
+
+	/**
+	 * Writes up to length bytes of the file fd starting at offset without
+	 * changing the file position. The default implementation copies the file
+	 * through a reused buffer with pread and write.
+	 * Returns a critical Exhausted error if offset is at the end of the file.
+	 */
+	virtual ErrorOr<size_t> sendFile(int fd, uint64_t offset, size_t length);
+
+	/**
+	 * File descriptor the stream writes to directly, if there is one
+	 */
+	virtual Maybe<int> outputFd() const { return std::nullopt; }
+
+	/**
+	 * Writes of at least threshold bytes are handed to the kernel without
+	 * copying. The written memory stays referenced until referencedBytes
+	 * drops, which is signaled by writeReady. 0 disables it.
+	 * Returns false if the stream can't write without copying.
+	 */
+	virtual bool setZeroCopyThreshold(size_t threshold) {
+		(void)threshold;
+		return false;
+	}
+
+	/**
+	 * Amount of already written bytes whose memory is still in use
+	 */
+	virtual size_t referencedBytes() const { return 0; }
+
+	/**
+	 * writeReady only fires once less than bytes of written data wait to be
+	 * sent. Keeps the kernel from queueing data which would delay later,
+	 * more urgent writes. 0 restores the default. Returns false if the
+	 * stream doesn't support it.
+	 */
+	virtual bool setWriteLowWatermark(size_t bytes) {
+		(void)bytes;
+		return false;
+	}
+
 	virtual Conveyor<void> writeReady() = 0;
 };
 
@@ -61,8 +147,24 @@ public:
 	virtual Conveyor<size_t> writeDone() = 0;
 };
 
+/**
+ * Writes of at least this size are started right away instead of waiting for
+ * the end of the loop turn to be coalesced with others
+ */
+constexpr size_t ASYNC_IO_STREAM_COALESCE_LIMIT = 64 * 1024;
+
 class AsyncIoStream final : public AsyncInputStream, public AsyncOutputStream {
 private:
+	class FlushEvent final : public Event {
+	private:
+		AsyncIoStream &stream;
+
+	public:
+		FlushEvent(AsyncIoStream &stream);
+
+		void fire() override;
+	};
+
 	Own<IoStream> stream;
 
 	SinkConveyor read_ready;
@@ -72,6 +174,21 @@ private:
 	ReadTaskAndStepHelper read_stepper;
 	WriteTaskAndStepHelper write_stepper;
 
+	Own<FlushEvent> flush_event = nullptr;
+
+	/// Set while write_ready is subscribed to the stream
+	bool waiting_for_write = false;
+
+	void scheduleFlush();
+
+	bool writePending() const;
+	/**
+	 * Steps the writes and keeps writeReady of the stream subscribed only
+	 * while a write is blocked, so idle streams aren't polled for it
+	 */
+	void writeStep();
+	void subscribeWriteReady();
+
 public:
 	AsyncIoStream(Own<IoStream> str);
 
@@ -80,23 +197,243 @@ public:
 
 	void read(void *buffer, size_t length, size_t max_length) override;
 
+	/**
+	 * Reads up to capacity bytes per call into an internal buffer, which
+	 * serves the following reads and peeks. 0 disables it. Only changed while
+	 * no read is pending and nothing is buffered.
+	 */
+	void setReadAhead(size_t capacity);
+
+	/**
+	 * Waits until at least min_length bytes are buffered without consuming
+	 * them. readDone reports the buffered amount. Needs a read-ahead capacity
+	 * of at least min_length.
+	 */
+	void peek(size_t min_length);
+
+	/**
+	 * Read-ahead data which wasn't consumed yet
+	 */
+	std::span<const uint8_t> buffered() const;
+
+	/**
+	 * Drops length bytes from the front of buffered()
+	 */
+	void consume(size_t length);
+
+	/**
+	 * Scatter read which is done once at least min_length bytes arrived or
+	 * all segments are filled. The segments have to stay valid until
+	 * readDone fires. Bypasses the read-ahead, which has to be empty.
+	 */
+	void readv(std::span<const IoVector> segments, size_t min_length);
+	/**
+	 * Reads into the writable segments of the buffer. The buffer isn't
+	 * advanced, the amount is reported by readDone.
+	 */
+	void readv(Buffer &buffer, size_t min_length);
+
+	/**
+	 * While enabled, a read which waits for more data sets the read low
+	 * watermark of the stream to the bytes it still needs. A parser which
+	 * read a length prefix is then woken up once the whole body arrived.
+	 */
+	void matchReadLowWatermark(bool enabled);
+
 	Conveyor<size_t> readDone() override;
 
 	Conveyor<void> onReadDisconnected() override;
 
+	/**
+	 * Queues the write. Small writes of one loop turn are gathered into one
+	 * writev at its end. writeDone fires for each write in order, with zero
+	 * copy writes once the kernel released the buffer. The buffer has to
+	 * stay valid until then.
+	 */
 	void write(const void *buffer, size_t length) override;
 
+	/**
+	 * Holds queued writes back until uncork, e.g. while a response is
+	 * assembled over several loop turns
+	 */
+	void cork();
+	void uncork();
+
+	/**
+	 * See OutputStream::setZeroCopyThreshold
+	 */
+	bool setZeroCopyThreshold(size_t threshold);
+
+	/**
+	 * See OutputStream::setWriteLowWatermark
+	 */
+	bool setWriteLowWatermark(size_t bytes);
+
+	/**
+	 * Gather write of all segments. The referenced data has to stay valid
+	 * until writeDone fires.
+	 */
+	void writev(std::span<const IoVector> segments);
+	/**
+	 * Writes the readable segments of the buffer. The buffer isn't advanced,
+	 * the amount is reported by writeDone.
+	 */
+	void writev(Buffer &buffer);
+
+	/**
+	 * Writes length bytes of the file fd starting at offset. Completion is
+	 * reported by writeDone. The file has to stay open until then.
+	 */
+	void sendFile(int fd, uint64_t offset, size_t length);
+
 	Conveyor<size_t> writeDone() override;
 };
 
+/**
+ * Moves data from input to output until input reaches its end and resolves to
+ * the amount of moved bytes. If both streams expose file descriptors the data
+ * is spliced through a kernel pipe, otherwise it is copied through a buffer.
+ * Reading pauses while output can't keep up.
+ *
+ * pump takes over the readiness conveyors of both streams. Both streams have
+ * to outlive the returned conveyor.
+ */
+Conveyor<size_t> pump(InputStream &input, OutputStream &output);
+
+/**
+ * Accepted connections which may wait in the accept conveyor by default
+ */
+constexpr size_t SERVER_DEFAULT_MAX_PENDING_ACCEPTS = 128;
+
+/**
+ * Counters of a listening socket. Rates are obtained by sampling them
+ * periodically.
+ */
+struct ServerMetrics {
+	uint64_t accepted = 0;
+	/**
+	 * Readiness notifications which accepted at least one connection. Only
+	 * counted by readiness based backends.
+	 */
+	uint64_t accept_batches = 0;
+	uint64_t max_accept_batch = 0;
+	/// Times accepting stopped because too many connections were pending
+	uint64_t pauses = 0;
+	uint64_t accept_errors = 0;
+};
+
+/**
+ * Tuning applied to sockets before they are bound or connected. Unset values
+ * keep the kernel defaults. TCP options are skipped for other protocols.
+ */
+struct SocketOptions {
+	/// Disables Nagle's algorithm, so small writes are sent right away
+	bool no_delay = false;
+	/**
+	 * Acknowledges right away instead of delaying acks. The kernel clears
+	 * TCP_QUICKACK after a few acks, so streams set it again after each
+	 * read, at the cost of a syscall per read.
+	 */
+	bool quick_ack = false;
+	/// SO_RCVBUF and SO_SNDBUF in bytes
+	Maybe<int> receive_buffer;
+	Maybe<int> send_buffer;
+	/// Microseconds to busy poll the device queue before sleeping
+	Maybe<int> busy_poll;
+	/**
+	 * Listeners accept data in the SYN of up to this many pending
+	 * connections (TCP Fast Open). 0 disables it.
+	 */
+	int fast_open = 0;
+	/**
+	 * Listeners wake up for a connection once it sent data, after at most
+	 * this many seconds. 0 disables it.
+	 */
+	int defer_accept = 0;
+	/// Listeners prefer connections processed on this cpu
+	Maybe<int> incoming_cpu;
+};
+
+/**
+ * Options for setting up a listening socket
+ */
+struct ListenOptions {
+	/**
+	 * Lets multiple sockets bind the same address, e.g. one per event loop.
+	 * The kernel balances incoming connections between them.
+	 */
+	bool reuse_port = false;
+	/**
+	 * For one listener shared between event loops with
+	 * IoProvider::wrapListenFd. Wakes only one of the loops per connection
+	 * instead of all of them.
+	 */
+	bool exclusive_wakeup = false;
+	/**
+	 * Applied to the listener. Accepted connections inherit them from the
+	 * kernel, quick_ack is set on each of them.
+	 */
+	SocketOptions socket;
+};
+
 class Server {
 public:
 	virtual ~Server() = default;
 
 	virtual Conveyor<Own<IoStream>> accept() = 0;
+
+	/**
+	 * Descriptor of the listening socket, so it can be shared with other
+	 * event loops. Returns nothing if there is no such descriptor.
+	 */
+	virtual Maybe<int> listenFd() const { return std::nullopt; }
+
+	/**
+	 * Stops accepting while this many accepted connections weren't taken out
+	 * of the accept conveyor yet. Further connections wait in the kernel
+	 * backlog until the consumer catches up. Completion based backends may
+	 * deliver connections the kernel accepted before the pause took effect.
+	 */
+	virtual void setMaxPendingAccepts(size_t limit) = 0;
+
+	virtual const ServerMetrics &metrics() const = 0;
 };
 
 class NetworkAddress;
+
+/**
+ * Descriptor of one packet inside a DatagramBatch
+ */
+struct DatagramPacket {
+	/// Payload storage owned by the batch. Holds DatagramBatch::packetSize()
+	uint8_t *data;
+	/// Received length or the length to send
+	size_t length;
+	/**
+	 * Source of a received packet, which stays valid until the next batch
+	 * read, or the destination of a packet to send
+	 */
+	NetworkAddress *address;
+	/**
+	 * If not 0 the packet is a train of segments of this size. Received
+	 * packets are coalesced by the kernel with receive offload enabled,
+	 * packets to send are split by the kernel.
+	 */
+	size_t segment_size;
+};
+
+/**
+ * Preallocated packet array for batched datagram io. Created by the datagram
+ * it is used with, so all per packet state is allocated only once.
+ */
+class DatagramBatch {
+public:
+	virtual ~DatagramBatch() = default;
+
+	virtual std::span<DatagramPacket> packets() = 0;
+	virtual size_t packetSize() const = 0;
+};
+
 /**
  * Datagram class. Bound to a local address it is able to receive inbound
  * datagram messages and send them as well as long as an address is provided as
@@ -107,11 +444,55 @@ public:
 	virtual ~Datagram() = default;
 
 	virtual ErrorOr<size_t> read(void *buffer, size_t length) = 0;
+
+	/**
+	 * Receives a message and points source at its sender. The address is
+	 * owned by the datagram and overwritten by the next read, so it can be
+	 * used to reply without any allocation.
+	 */
+	virtual ErrorOr<size_t> read(void *buffer, size_t length,
+								 NetworkAddress *&source) = 0;
 	virtual Conveyor<void> readReady() = 0;
 
 	virtual ErrorOr<size_t> write(const void *buffer, size_t length,
 								  NetworkAddress &dest) = 0;
+
+	/**
+	 * Sends to the peer set with connect
+	 */
+	virtual ErrorOr<size_t> write(const void *buffer, size_t length) = 0;
 	virtual Conveyor<void> writeReady() = 0;
+
+	/**
+	 * Fixes the peer of this datagram. Afterwards only messages from the peer
+	 * are received and write without an address sends to it. Names have to
+	 * be resolved with Network::parseAddress first.
+	 */
+	virtual ErrorOr<void> connect(NetworkAddress &peer) = 0;
+
+	/**
+	 * Creates a batch of count packets with packet_size bytes each. With
+	 * receive offload packet_size should be 64KiB.
+	 */
+	virtual Own<DatagramBatch> newBatch(size_t count, size_t packet_size) = 0;
+
+	/**
+	 * Receives up to packets().size() packets at once and returns the amount
+	 * of filled packets.
+	 */
+	virtual ErrorOr<size_t> readBatch(DatagramBatch &batch) = 0;
+
+	/**
+	 * Sends the first count packets at once and returns the amount of sent
+	 * packets.
+	 */
+	virtual ErrorOr<size_t> writeBatch(DatagramBatch &batch, size_t count) = 0;
+
+	/**
+	 * Lets the kernel coalesce consecutive packets of one flow into a single
+	 * received packet. Returns false if this isn't supported.
+	 */
+	virtual bool setReceiveOffload(bool enabled) = 0;
 };
 
 class OsNetworkAddress;
@@ -162,19 +543,70 @@ public:
 	parseAddress(const std::string &addr, uint16_t port_hint = 0) = 0;
 
 	/**
-	 * Set up a listener on this address
+	 * Set up a listener on this address. Names aren't resolved here, they
+	 * have to go through parseAddress first.
 	 */
 	virtual Own<Server> listen(NetworkAddress &bind_addr) = 0;
+	virtual Own<Server> listen(NetworkAddress &bind_addr,
+							   const ListenOptions &options) = 0;
 
 	/**
-	 * Connect to a remote address
+	 * Connect to a remote address. Names are resolved without blocking the
+	 * event loop.
 	 */
 	virtual Conveyor<Own<IoStream>> connect(NetworkAddress &address) = 0;
+	virtual Conveyor<Own<IoStream>> connect(NetworkAddress &address,
+											const SocketOptions &options) = 0;
 
 	/**
-	 * Bind a datagram socket at this address.
+	 * Bind a datagram socket at this address. Like listen, it only takes
+	 * resolved or numeric addresses.
 	 */
 	virtual Own<Datagram> datagram(NetworkAddress &address) = 0;
+	virtual Own<Datagram> datagram(NetworkAddress &address,
+								   const SocketOptions &options) = 0;
+};
+
+enum class FileMode : uint8_t {
+	Read,
+	/// Creates the file if it doesn't exist and truncates it
+	Write,
+	/// Creates the file if it doesn't exist and writes at its end
+	Append
+};
+
+/**
+ * Access pattern hint which is passed on to the kernel page cache
+ */
+enum class FileAccess : uint8_t { Normal, Sequential, Random };
+
+/**
+ * Default amount of bytes a file stream reads ahead of the consumer
+ */
+constexpr size_t FILE_DEFAULT_READ_AHEAD = 256 * 1024;
+
+struct FileOptions {
+	/**
+	 * Bytes fetched from the file ahead of the consumer. With 0 only the
+	 * requested amount is read.
+	 */
+	size_t read_ahead = FILE_DEFAULT_READ_AHEAD;
+	FileAccess access = FileAccess::Sequential;
+};
+
+/**
+ * Sequential stream on a regular file. Regular files are always reported
+ * ready by readiness polling and block on io, so reads and writes run on
+ * worker threads and complete through readDone and writeDone. Reads are
+ * served from a read-ahead buffer which is refilled in the background.
+ *
+ * A read at the end of the file completes with the remaining bytes even if
+ * they are less than min_length. Once everything was read
+ * onReadDisconnected fires.
+ */
+class AsyncFileStream : public AsyncInputStream, public AsyncOutputStream {
+public:
+	virtual ~AsyncFileStream() = default;
 };
 
 class IoProvider {
@@ -183,14 +615,51 @@ public:
 
 	virtual Own<InputStream> wrapInputFd(int fd) = 0;
 
+	/**
+	 * Opens a regular file. Only opening happens on the calling thread.
+	 */
+	virtual ErrorOr<Own<AsyncFileStream>>
+	openFile(const std::string &path, FileMode mode,
+			 const FileOptions &options = {}) = 0;
+
+	/**
+	 * Accepts on a listening socket set up by the same kind of io provider,
+	 * usually a dup of another server's listenFd(). Takes ownership of fd.
+	 */
+	virtual Own<Server> wrapListenFd(int fd,
+									 const ListenOptions &options = {}) = 0;
+
 	virtual Network &network() = 0;
+
+	/**
+	 * Network for processes on the same host, which exchanges stream data
+	 * through shared memory instead of the kernel. Returns nullptr if the
+	 * backend doesn't provide one.
+	 */
+	virtual Network *sharedMemoryNetwork() { return nullptr; }
+};
+
+/**
+ * Selects the kernel interface the async io context is built on
+ */
+enum class AsyncIoBackend : uint8_t {
+	/// Readiness based polling. epoll on linux
+	Default,
+	/**
+	 * Completion based io_uring. Falls back to Default if the kernel doesn't
+	 * provide it
+	 */
+	Uring
 };
 
 struct AsyncIoContext {
 	Own<IoProvider> io;
 	EventLoop &event_loop;
 	EventPort &event_port;
+	/// Backend which was actually set up, after falling back if needed
+	AsyncIoBackend backend = AsyncIoBackend::Default;
 };
 
 ErrorOr<AsyncIoContext> setupAsyncIo();
+ErrorOr<AsyncIoContext> setupAsyncIo(AsyncIoBackend backend);
 } // namespace saw
@@ -2,10 +2,79 @@
 
 #include "io.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 namespace saw {
+namespace {
+/*
+ * Drops the transferred bytes from the front of the remaining segments
+ */
+void advanceSegments(std::vector<IoVector> &segments, size_t &next_segment,
+					 size_t bytes) {
+	while (next_segment < segments.size()) {
+		IoVector &segment = segments[next_segment];
+		size_t consumed = std::min(bytes, segment.length);
+		segment.data = static_cast<uint8_t *>(segment.data) + consumed;
+		segment.length -= consumed;
+		bytes -= consumed;
+
+		if (segment.length > 0) {
+			break;
+		}
+		++next_segment;
+	}
+}
+
+std::span<const IoVector> remainingSegments(std::vector<IoVector> &segments,
+											size_t next_segment) {
+	return {segments.data() + next_segment, segments.size() - next_segment};
+}
+} // namespace
+
 void ReadTaskAndStepHelper::readStep(InputStream &reader) {
+	if (!read_ahead.empty()) {
+		readAheadStep(reader);
+	}
+
+	// Buffered data has to be read before anything else
+	if (read_ahead_begin == read_ahead_end) {
+		readVectorStep(reader);
+
+		if (read_ahead.empty()) {
+			readTaskStep(reader);
+		}
+	}
+
+	if (match_low_watermark || low_watermark > 1) {
+		updateLowWatermark(reader);
+	}
+}
+
+size_t ReadTaskAndStepHelper::missingBytes() const {
+	if (read_task.has_value()) {
+		return read_task->min_length;
+	} else if (read_vector_task.has_value()) {
+		const ReadVectorIoTask &task = *read_vector_task;
+		return task.min_length - std::min(task.min_length, task.already_read);
+	} else if (peek_task.has_value()) {
+		size_t available = read_ahead_end - read_ahead_begin;
+		return peek_task->min_length -
+			   std::min(peek_task->min_length, available);
+	}
+	return 1;
+}
+
+void ReadTaskAndStepHelper::updateLowWatermark(InputStream &reader) {
+	size_t watermark =
+		match_low_watermark ? std::max<size_t>(missingBytes(), 1) : 1;
+	if (watermark != low_watermark && reader.setReadLowWatermark(watermark)) {
+		low_watermark = watermark;
+	}
+}
+
+void ReadTaskAndStepHelper::readTaskStep(InputStream &reader) {
 	while (read_task.has_value()) {
 		ReadIoTask &task = *read_task;
 
@@ -44,25 +113,220 @@ void ReadTaskAndStepHelper::readStep(InputStream &reader) {
 	}
 }
 
+void ReadTaskAndStepHelper::readVectorStep(InputStream &reader) {
+	while (read_vector_task.has_value()) {
+		ReadVectorIoTask &task = *read_vector_task;
+
+		ErrorOr<size_t> n_err =
+			reader.readv(remainingSegments(task.segments, task.next_segment));
+		if (n_err.isError()) {
+			const Error &error = n_err.error();
+			if (error.isCritical()) {
+				if (read_done) {
+					read_done->fail(error.copyError());
+				}
+				read_vector_task = std::nullopt;
+			}
+
+			break;
+		} else if (n_err.isValue()) {
+			size_t n = n_err.value();
+			task.already_read += n;
+			advanceSegments(task.segments, task.next_segment, n);
+
+			if (task.already_read >= task.min_length ||
+				task.next_segment == task.segments.size()) {
+				if (read_done) {
+					read_done->feed(size_t{task.already_read});
+				}
+				read_vector_task = std::nullopt;
+			}
+		} else {
+			if (read_done) {
+				read_done->fail(criticalError("Read failed"));
+			}
+			read_vector_task = std::nullopt;
+		}
+	}
+}
+
+bool ReadTaskAndStepHelper::serveReadAhead() {
+	size_t available = read_ahead_end - read_ahead_begin;
+
+	if (peek_task.has_value()) {
+		if (available < peek_task->min_length) {
+			return false;
+		}
+		if (read_done) {
+			read_done->feed(size_t{available});
+		}
+		peek_task = std::nullopt;
+		return true;
+	}
+
+	ReadIoTask &task = *read_task;
+	size_t amount = std::min(available, task.max_length);
+	if (amount > 0) {
+		memcpy(task.buffer, read_ahead.data() + read_ahead_begin, amount);
+		read_ahead_begin += amount;
+		task.buffer = static_cast<uint8_t *>(task.buffer) + amount;
+		task.min_length -= std::min(task.min_length, amount);
+		task.max_length -= amount;
+		task.already_read += amount;
+	}
+
+	if (task.min_length > 0) {
+		return false;
+	}
+	if (read_done) {
+		read_done->feed(size_t{task.already_read});
+	}
+	read_task = std::nullopt;
+	return true;
+}
+
+void ReadTaskAndStepHelper::readAheadStep(InputStream &reader) {
+	while (read_task.has_value() || peek_task.has_value()) {
+		if (serveReadAhead()) {
+			continue;
+		}
+
+		if (read_ahead_begin == read_ahead_end) {
+			read_ahead_begin = 0;
+			read_ahead_end = 0;
+		} else if (read_ahead_end == read_ahead.size()) {
+			size_t available = read_ahead_end - read_ahead_begin;
+			memmove(read_ahead.data(), read_ahead.data() + read_ahead_begin,
+					available);
+			read_ahead_begin = 0;
+			read_ahead_end = available;
+		}
+
+		// Reads which are at least as large as the buffer skip the copy
+		bool direct = read_task.has_value() && read_ahead_end == 0 &&
+					  read_task->max_length >= read_ahead.size();
+
+		ErrorOr<size_t> n_err =
+			direct ? reader.read(read_task->buffer, read_task->max_length)
+				   : reader.read(read_ahead.data() + read_ahead_end,
+								 read_ahead.size() - read_ahead_end);
+		if (n_err.isError()) {
+			const Error &error = n_err.error();
+			if (error.isCritical()) {
+				if (read_done) {
+					read_done->fail(error.copyError());
+				}
+				read_task = std::nullopt;
+				peek_task = std::nullopt;
+			}
+			break;
+		} else if (n_err.isValue()) {
+			size_t n = n_err.value();
+			if (!direct) {
+				read_ahead_end += n;
+				continue;
+			}
+
+			ReadIoTask &task = *read_task;
+			task.buffer = static_cast<uint8_t *>(task.buffer) + n;
+			task.min_length -= std::min(task.min_length, n);
+			task.max_length -= n;
+			task.already_read += n;
+		} else {
+			if (read_done) {
+				read_done->fail(criticalError("Read failed"));
+			}
+			read_task = std::nullopt;
+			peek_task = std::nullopt;
+		}
+	}
+}
+
 void WriteTaskAndStepHelper::writeStep(OutputStream &writer) {
-	while (write_task.has_value()) {
-		WriteIoTask &task = *write_task;
+	writeVectorStep(writer);
+	sendFileStep(writer);
+
+	if (!write_vector_task.has_value() && !send_file_task.has_value()) {
+		writeQueueStep(writer);
+	}
+}
+
+void WriteTaskAndStepHelper::writeQueueStep(OutputStream &writer) {
+	while (!write_queue.empty() && !corked) {
+		WriteIoTask &front = write_queue.front();
 
-		ErrorOr<size_t> n_err = writer.write(task.buffer, task.length);
+		if (front.length == 0) {
+			// Zero copy writes keep the buffer in use until it is released
+			if (writer.referencedBytes() > 0) {
+				break;
+			}
+			if (write_done) {
+				write_done->feed(size_t{front.already_written});
+			}
+			write_queue.pop_front();
+			continue;
+		}
+
+		// A single write keeps the zero copy path of the stream
+		ErrorOr<size_t> n_err = write_queue.size() == 1
+									? writer.write(front.buffer, front.length)
+									: writer.writev(gatherQueue());
 
 		if (n_err.isValue()) {
+			size_t n = n_err.value();
+			for (auto iter = write_queue.begin();
+				 n > 0 && iter != write_queue.end(); ++iter) {
+				size_t consumed = std::min(n, iter->length);
+				iter->buffer = static_cast<const uint8_t *>(iter->buffer) +
+							   consumed;
+				iter->length -= consumed;
+				iter->already_written += consumed;
+				n -= consumed;
+			}
+		} else if (n_err.isError()) {
+			const Error &error = n_err.error();
+			if (error.isCritical()) {
+				if (write_done) {
+					write_done->fail(error.copyError());
+				}
+				write_queue.clear();
+			}
+			break;
+		} else {
+			if (write_done) {
+				write_done->fail(criticalError("Write failed"));
+			}
+			write_queue.clear();
+		}
+	}
+}
 
+std::span<const IoVector> WriteTaskAndStepHelper::gatherQueue() {
+	size_t count = 0;
+	for (auto iter = write_queue.begin();
+		 iter != write_queue.end() && count < gathered.size(); ++iter) {
+		gathered[count++] =
+			IoVector{const_cast<void *>(iter->buffer), iter->length};
+	}
+	return {gathered.data(), count};
+}
+
+void WriteTaskAndStepHelper::writeVectorStep(OutputStream &writer) {
+	while (write_vector_task.has_value()) {
+		WriteVectorIoTask &task = *write_vector_task;
+
+		ErrorOr<size_t> n_err =
+			writer.writev(remainingSegments(task.segments, task.next_segment));
+		if (n_err.isValue()) {
 			size_t n = n_err.value();
-			assert(n <= task.length);
-			if (n == task.length) {
+			task.already_written += n;
+			advanceSegments(task.segments, task.next_segment, n);
+
+			if (task.next_segment == task.segments.size()) {
 				if (write_done) {
-					write_done->feed(n + task.already_written);
+					write_done->feed(size_t{task.already_written});
 				}
-				write_task = std::nullopt;
-			} else {
-				task.buffer = static_cast<const uint8_t *>(task.buffer) + n;
-				task.length -= n;
-				task.already_written += n;
+				write_vector_task = std::nullopt;
 			}
 		} else if (n_err.isError()) {
 			const Error &error = n_err.error();
@@ -70,16 +334,52 @@ void WriteTaskAndStepHelper::writeStep(OutputStream &writer) {
 				if (write_done) {
 					write_done->fail(error.copyError());
 				}
-				write_task = std::nullopt;
+				write_vector_task = std::nullopt;
 			}
 			break;
 		} else {
 			if (write_done) {
 				write_done->fail(criticalError("Write failed"));
 			}
-			write_task = std::nullopt;
+			write_vector_task = std::nullopt;
 		}
 	}
 }
 
-} // namespace saw
\ No newline at end of file
+void WriteTaskAndStepHelper::sendFileStep(OutputStream &writer) {
+	while (send_file_task.has_value()) {
+		SendFileIoTask &task = *send_file_task;
+
+		ErrorOr<size_t> n_err =
+			writer.sendFile(task.fd, task.offset, task.length);
+		if (n_err.isValue()) {
+			size_t n = n_err.value();
+			assert(n <= task.length);
+			task.offset += n;
+			task.length -= n;
+			task.already_written += n;
+
+			if (task.length == 0) {
+				if (write_done) {
+					write_done->feed(size_t{task.already_written});
+				}
+				send_file_task = std::nullopt;
+			}
+		} else if (n_err.isError()) {
+			const Error &error = n_err.error();
+			if (error.isCritical()) {
+				if (write_done) {
+					write_done->fail(error.copyError());
+				}
+				send_file_task = std::nullopt;
+			}
+			break;
+		} else {
+			if (write_done) {
+				write_done->fail(criticalError("Write failed"));
+			}
+			send_file_task = std::nullopt;
+		}
+	}
+}
+} // namespace saw
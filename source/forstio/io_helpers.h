@@ -3,8 +3,12 @@
 #include "async.h"
 #include "common.h"
 
+#include <array>
 #include <cstdint>
+#include <deque>
 #include <optional>
+#include <span>
+#include <vector>
 
 namespace saw {
 /*
@@ -16,6 +20,15 @@ namespace saw {
  * and gnutls doesn't let me write or read into buffers I have to have this kind
  * of strange abstraction. This may also be reusable for windows/macOS though.
  */
+/**
+ * Segment for scatter and gather io. Matches the layout of struct iovec on
+ * unix systems
+ */
+struct IoVector {
+	void *data;
+	size_t length;
+};
+
 class InputStream;
 
 class ReadTaskAndStepHelper {
@@ -27,16 +40,59 @@ public:
 		size_t already_read = 0;
 	};
 	std::optional<ReadIoTask> read_task;
+
+	struct ReadVectorIoTask {
+		std::vector<IoVector> segments;
+		size_t next_segment = 0;
+		size_t min_length;
+		size_t already_read = 0;
+	};
+	std::optional<ReadVectorIoTask> read_vector_task;
+
+	/**
+	 * Waits for buffered read-ahead data without consuming it
+	 */
+	struct PeekIoTask {
+		size_t min_length;
+	};
+	std::optional<PeekIoTask> peek_task;
+
 	Own<ConveyorFeeder<size_t>> read_done = nullptr;
 
 	Own<ConveyorFeeder<void>> on_read_disconnect = nullptr;
 
+	/**
+	 * Read-ahead data in [read_ahead_begin, read_ahead_end). Reads and peeks
+	 * are served from it while it has a capacity.
+	 */
+	std::vector<uint8_t> read_ahead;
+	size_t read_ahead_begin = 0;
+	size_t read_ahead_end = 0;
+
+	/// Keeps the read low watermark of the stream at the missing bytes
+	bool match_low_watermark = false;
+	size_t low_watermark = 1;
+
 public:
 	void readStep(InputStream &reader);
+
+private:
+	void readTaskStep(InputStream &reader);
+	void readVectorStep(InputStream &reader);
+	void readAheadStep(InputStream &reader);
+	bool serveReadAhead();
+
+	size_t missingBytes() const;
+	void updateLowWatermark(InputStream &reader);
 };
 
 class OutputStream;
 
+/**
+ * Queued writes which are gathered into one writev at most
+ */
+constexpr size_t WRITE_QUEUE_MAX_SEGMENTS = 64;
+
 class WriteTaskAndStepHelper {
 public:
 	struct WriteIoTask {
@@ -44,10 +100,39 @@ public:
 		size_t length;
 		size_t already_written = 0;
 	};
-	std::optional<WriteIoTask> write_task;
+	/**
+	 * Written in order, each completed task is reported on its own. Only
+	 * stepped while no vector or file task is pending.
+	 */
+	std::deque<WriteIoTask> write_queue;
+	/// Holds the queue back until it's unset
+	bool corked = false;
+
+	struct WriteVectorIoTask {
+		std::vector<IoVector> segments;
+		size_t next_segment = 0;
+		size_t already_written = 0;
+	};
+	std::optional<WriteVectorIoTask> write_vector_task;
+
+	struct SendFileIoTask {
+		int fd;
+		uint64_t offset;
+		size_t length;
+		size_t already_written = 0;
+	};
+	std::optional<SendFileIoTask> send_file_task;
 	Own<ConveyorFeeder<size_t>> write_done = nullptr;
 
 public:
 	void writeStep(OutputStream &writer);
+
+private:
+	std::array<IoVector, WRITE_QUEUE_MAX_SEGMENTS> gathered;
+
+	void writeQueueStep(OutputStream &writer);
+	std::span<const IoVector> gatherQueue();
+	void writeVectorStep(OutputStream &writer);
+	void sendFileStep(OutputStream &writer);
 };
 } // namespace saw
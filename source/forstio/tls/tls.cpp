@@ -99,6 +99,16 @@ Conveyor<Own<IoStream>> TlsServer::accept() {
 	});
 }
 
+void TlsServer::setMaxPendingAccepts(size_t limit) {
+	SAW_ASSERT(internal) { return; }
+	internal->setMaxPendingAccepts(limit);
+}
+
+const ServerMetrics &TlsServer::metrics() const {
+	assert(internal);
+	return internal->metrics();
+}
+
 namespace {
 /*
 * Small helper for setting up the nonblocking connection handshake
@@ -159,14 +169,22 @@ Own<Server> TlsNetwork::listen(NetworkAddress& address) {
 	return heap<TlsServer>(internal.listen(address));
 }
 
+Own<Server> TlsNetwork::listen(NetworkAddress& address, const ListenOptions& options) {
+	return heap<TlsServer>(internal.listen(address, options));
+}
+
 Conveyor<Own<IoStream>> TlsNetwork::connect(NetworkAddress& address) {
+	return connect(address, SocketOptions{});
+}
+
+Conveyor<Own<IoStream>> TlsNetwork::connect(NetworkAddress& address, const SocketOptions& options) {
 	// Helper setups
 	auto caf = newConveyorAndFeeder<Own<IoStream>>();
 	Own<TlsClientStreamHelper> helper = heap<TlsClientStreamHelper>(std::move(caf.feeder));
 	TlsClientStreamHelper* hlp_ptr = helper.get();
 	
 	// Conveyor entangled structure
-	auto prim_conv = internal.connect(address).then([this, hlp_ptr, addr = address.address()](
+	auto prim_conv = internal.connect(address, options).then([this, hlp_ptr, addr = address.address()](
 										Own<IoStream> stream) -> ErrorOr<void> {
 		IoStream* inner_stream = stream.get();
 		auto tls_stream = heap<TlsIoStream>(std::move(stream));
@@ -206,6 +224,11 @@ Own<Datagram> TlsNetwork::datagram(NetworkAddress& address){
 	return nullptr;
 }
 
+Own<Datagram> TlsNetwork::datagram(NetworkAddress& address, const SocketOptions& options){
+	(void)options;
+	return datagram(address);
+}
+
 static ssize_t forst_tls_push_func(gnutls_transport_ptr_t p, const void *data,
 						 size_t size) {
 	IoStream *stream = reinterpret_cast<IoStream *>(p);
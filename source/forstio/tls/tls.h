@@ -31,6 +31,10 @@ public:
 	TlsServer(Own<Server> srv);
 
 	Conveyor<Own<IoStream>> accept() override;
+
+	void setMaxPendingAccepts(size_t limit) override;
+
+	const ServerMetrics &metrics() const override;
 };
 
 class TlsNetwork final : public Network {
@@ -44,10 +48,13 @@ public:
 	Conveyor<Own<NetworkAddress>> parseAddress(const std::string &addr, uint16_t port = 0) override;
 	
 	Own<Server> listen(NetworkAddress& address) override;
+	Own<Server> listen(NetworkAddress& address, const ListenOptions& options) override;
 
 	Conveyor<Own<IoStream>> connect(NetworkAddress& address) override;
+	Conveyor<Own<IoStream>> connect(NetworkAddress& address, const SocketOptions& options) override;
 
 	Own<Datagram> datagram(NetworkAddress& address) override;
+	Own<Datagram> datagram(NetworkAddress& address, const SocketOptions& options) override;
 };
 
 std::optional<Own<TlsNetwork>> setupTlsNetwork(Network &network);
@@ -2,6 +2,12 @@
 
 #include "source/forstio/async.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 namespace {
 SAW_TEST("Async Immediate"){
 	using namespace saw;
@@ -227,4 +233,392 @@ SAW_TEST("Async Merge"){
 	SAW_EXPECT(!wrong_value, std::string{"Expected values 10 or 11"});
 	SAW_EXPECT(elements_passed == 3, std::string{"Expected 2 passed elements, got only "} + std::to_string(elements_passed));
 }
+
+SAW_TEST("Async Merge Ordered"){
+	using namespace saw;
+
+	EventLoop event_loop;
+	WaitScope wait_scope{event_loop};
+
+	auto feeder_a = newConveyorAndFeeder<int>();
+	auto feeder_b = newConveyorAndFeeder<int>();
+
+	auto cam = feeder_a.conveyor.mergeOrdered([](const int& value){
+		return value;
+	});
+
+	cam.second.attach(std::move(feeder_b.conveyor));
+
+	std::vector<int> values;
+
+	auto sink = cam.first.then([&values](int value){
+		values.push_back(value);
+	}).sink();
+
+	feeder_a.feeder->feed(1);
+	feeder_a.feeder->feed(4);
+	feeder_a.feeder->feed(5);
+
+	wait_scope.poll();
+
+	SAW_EXPECT(values.empty(), std::string{"Expected no elements while an input is empty, got "} + std::to_string(values.size()));
+
+	feeder_b.feeder->feed(2);
+	feeder_b.feeder->feed(3);
+	feeder_b.feeder->feed(6);
+
+	wait_scope.poll();
+
+	std::vector<int> expected{1,2,3,4,5};
+	SAW_EXPECT(values == expected, std::string{"Expected 5 sorted elements, got "} + std::to_string(values.size()));
+
+	feeder_a.feeder->fail(makeError("Input done", Error::Code::Exhausted));
+
+	wait_scope.poll();
+
+	SAW_EXPECT(values.size() == 6 && values.back() == 6, "Expected 6 after closing the first input");
+}
+
+SAW_TEST("Async Ordered Merge Exhaustion"){
+	using namespace saw;
+
+	EventLoop event_loop;
+	WaitScope wait_scope{event_loop};
+
+	auto feeder_a = newConveyorAndFeeder<int>();
+	auto feeder_b = newConveyorAndFeeder<int>();
+
+	auto cam = feeder_a.conveyor.mergeOrdered([](const int& value){
+		return value;
+	});
+
+	cam.second.attach(std::move(feeder_b.conveyor));
+
+	std::vector<int> values;
+	size_t exhausted = 0;
+
+	auto sink = cam.first.then([&values](int value){
+		values.push_back(value);
+	}, [&exhausted](Error&& error){
+		if(error.code() == Error::Code::Exhausted){
+			++exhausted;
+		}
+		return std::move(error);
+	}).sink();
+
+	feeder_a.feeder->feed(1);
+	feeder_b.feeder->feed(2);
+	feeder_b.feeder->feed(3);
+	feeder_a.feeder->fail(makeError("Input done", Error::Code::Exhausted));
+
+	wait_scope.poll();
+	SAW_EXPECT(exhausted == 0, "Exhausted while an input is still open");
+
+	feeder_b.feeder->fail(makeError("Input done", Error::Code::Exhausted));
+
+	wait_scope.poll();
+
+	std::vector<int> expected{1,2,3};
+	SAW_EXPECT(values == expected, std::string{"Expected 3 sorted elements, got "} + std::to_string(values.size()));
+	SAW_EXPECT(exhausted == 1, std::string{"Expected one exhaustion after the last input ended, got "} + std::to_string(exhausted));
+}
+
+SAW_TEST("Async Partition"){
+	using namespace saw;
+
+	EventLoop event_loop;
+	WaitScope wait_scope{event_loop};
+
+	auto feeder_conveyor = newConveyorAndFeeder<size_t>();
+
+	auto branches = feeder_conveyor.conveyor.partition(2, [](const size_t& value){
+		return value;
+	}, 2);
+
+	SAW_EXPECT(branches.size() == 2, "Expected 2 partitions");
+
+	for(size_t i = 1; i <= 6; ++i){
+		feeder_conveyor.feeder->feed(std::move(i));
+	}
+
+	wait_scope.poll();
+
+	SAW_EXPECT(branches[0].take().value() == 2, "Expected 2 in the even partition");
+	SAW_EXPECT(branches[1].take().value() == 1, "Expected 1 in the odd partition");
+
+	wait_scope.poll();
+
+	SAW_EXPECT(branches[0].take().value() == 4, "Expected 4 in the even partition");
+	SAW_EXPECT(branches[1].take().value() == 3, "Expected 3 in the odd partition");
+
+	wait_scope.poll();
+
+	SAW_EXPECT(branches[0].take().value() == 6, "Expected 6 in the even partition");
+	SAW_EXPECT(branches[1].take().value() == 5, "Expected 5 in the odd partition");
+}
+
+/// Event port which only waits for cross thread wakes and counts them
+class WakeCountingEventPort final : public saw::EventPort {
+private:
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool woken = false;
+
+public:
+	std::atomic<size_t> wakes{0};
+
+	saw::Conveyor<void> onSignal(saw::Signal) override {
+		return std::move(saw::newConveyorAndFeeder<void>().conveyor);
+	}
+
+	void poll() override {
+		std::lock_guard<std::mutex> lock{mutex};
+		woken = false;
+	}
+
+	void wait() override {
+		std::unique_lock<std::mutex> lock{mutex};
+		condition.wait(lock, [this]() { return woken; });
+		woken = false;
+	}
+
+	void wait(const std::chrono::steady_clock::duration &duration) override {
+		wait(std::chrono::steady_clock::now() + duration);
+	}
+
+	void wait(const std::chrono::steady_clock::time_point &time_point) override {
+		std::unique_lock<std::mutex> lock{mutex};
+		condition.wait_until(lock, time_point, [this]() { return woken; });
+		woken = false;
+	}
+
+	void wake() override {
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			woken = true;
+		}
+		++wakes;
+		condition.notify_one();
+	}
+};
+
+SAW_TEST("Async Cross Thread Partition"){
+	using namespace saw;
+
+	auto port = heap<WakeCountingEventPort>();
+	WakeCountingEventPort& wake_port = *port;
+	EventLoop event_loop{std::move(port)};
+	WaitScope wait_scope{event_loop};
+
+	auto cross_thread = newCrossThreadConveyorAndFeeder<size_t>();
+
+	std::vector<size_t> values;
+	std::atomic<size_t> received{0};
+	auto sink = cross_thread.conveyor.then([&values, &received](size_t value){
+		values.push_back(value);
+		received = values.size();
+	}).sink();
+
+	constexpr size_t lock_step = 8;
+	constexpr size_t total = 200;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+
+	std::thread producer{[feeder = std::move(cross_thread.feeder), &received, deadline]() mutable {
+		EventLoop producer_loop;
+		WaitScope producer_scope{producer_loop};
+
+		auto feeder_conveyor = newConveyorAndFeeder<size_t>();
+
+		std::vector<Own<ConveyorFeeder<size_t>>> feeders;
+		auto local = newConveyorAndFeeder<size_t>();
+		feeders.push_back(std::move(local.feeder));
+		feeders.push_back(std::move(feeder));
+
+		auto partition_sink = feeder_conveyor.conveyor.partition(std::move(feeders), [](const size_t& value){
+			return value;
+		});
+
+		auto awaitReceived = [&received, deadline](size_t count){
+			while(received < count && std::chrono::steady_clock::now() < deadline){
+				std::this_thread::yield();
+			}
+		};
+
+		// Hand over one odd value at a time, so every one of them has to
+		// wake the waiting consumer loop
+		for(size_t i = 1; i <= lock_step; ++i){
+			feeder_conveyor.feeder->feed(size_t{i});
+			producer_scope.poll();
+			if(i % 2 == 1){
+				awaitReceived((i + 1) / 2);
+			}
+		}
+
+		// Then race the consumer draining the queue
+		for(size_t i = lock_step + 1; i <= total; ++i){
+			feeder_conveyor.feeder->feed(size_t{i});
+			producer_scope.poll();
+		}
+
+		// Keep the thread alive until everything arrived on the other side
+		awaitReceived(total / 2);
+	}};
+
+	while(values.size() < total / 2 && std::chrono::steady_clock::now() < deadline){
+		wait_scope.wait(std::chrono::milliseconds{100});
+	}
+
+	std::vector<size_t> expected;
+	for(size_t i = 1; i <= total; i += 2){
+		expected.push_back(i);
+	}
+	bool arrived = values == expected;
+	size_t wakes = wake_port.wakes;
+
+	producer.join();
+
+	SAW_EXPECT(arrived, std::string{"Expected odd values from the running thread, got "} + std::to_string(values.size()));
+	SAW_EXPECT(wakes >= lock_step / 2, std::string{"Expected the waiting loop to be woken, got "} + std::to_string(wakes) + " wakes");
+}
+
+SAW_TEST("Async Semaphore"){
+	using namespace saw;
+
+	EventLoop event_loop;
+	WaitScope wait_scope{event_loop};
+
+	AsyncSemaphore semaphore{1};
+
+	Conveyor<AsyncSemaphore::Permit> first = semaphore.acquire();
+	Conveyor<AsyncSemaphore::Permit> second = semaphore.acquire();
+
+	SAW_EXPECT(semaphore.available() == 0, "Expected no available permit");
+	SAW_EXPECT(semaphore.waiting() == 1, "Expected one waiter");
+
+	wait_scope.poll();
+
+	ErrorOr<AsyncSemaphore::Permit> first_permit = first.take();
+	SAW_EXPECT(first_permit.isValue(), "First acquire didn't succeed");
+	SAW_EXPECT(second.take().isError(), "Second acquire succeeded too early");
+
+	first_permit.value().release();
+
+	wait_scope.poll();
+
+	ErrorOr<AsyncSemaphore::Permit> second_permit = second.take();
+	SAW_EXPECT(second_permit.isValue(), "Second acquire didn't succeed");
+	SAW_EXPECT(semaphore.waiting() == 0, "Expected no waiter");
+}
+
+SAW_TEST("Async Limit Concurrency"){
+	using namespace saw;
+
+	EventLoop event_loop;
+	WaitScope wait_scope{event_loop};
+
+	auto feeder_conveyor = newConveyorAndFeeder<size_t>();
+
+	std::vector<Own<ConveyorFeeder<size_t>>> requests;
+
+	Conveyor<size_t> responses = feeder_conveyor.conveyor.limitConcurrency(2, [&requests](size_t value){
+		auto request = newConveyorAndFeeder<size_t>();
+		requests.push_back(std::move(request.feeder));
+		return request.conveyor.then([value](size_t response){
+			return value + response;
+		});
+	});
+
+	feeder_conveyor.feeder->feed(10);
+	feeder_conveyor.feeder->feed(20);
+	feeder_conveyor.feeder->feed(30);
+
+	wait_scope.poll();
+
+	SAW_EXPECT(requests.size() == 2, std::string{"Expected 2 requests in flight, got "} + std::to_string(requests.size()));
+
+	requests[1]->feed(2);
+
+	wait_scope.poll();
+
+	ErrorOr<size_t> response = responses.take();
+	SAW_EXPECT(response.isValue() && response.value() == 22, "Expected response 22");
+
+	wait_scope.poll();
+
+	SAW_EXPECT(requests.size() == 3, std::string{"Expected 3 started requests, got "} + std::to_string(requests.size()));
+}
+
+SAW_TEST("Async Loop Metrics and Stalls"){
+	using namespace saw;
+
+	EventLoop event_loop;
+	WaitScope wait_scope{event_loop};
+
+	event_loop.setStallThreshold(std::chrono::milliseconds{1});
+
+	size_t stall_calls = 0;
+	event_loop.onStall([&stall_calls](const EventLoopStall&){
+		++stall_calls;
+	});
+
+	auto feeder_conveyor = newConveyorAndFeeder<size_t>();
+	auto sink = feeder_conveyor.conveyor.then([](size_t value){
+		if(value > 0){
+			std::this_thread::sleep_for(std::chrono::milliseconds{value});
+		}
+	}).sink();
+
+	feeder_conveyor.feeder->feed(0);
+	feeder_conveyor.feeder->feed(3);
+
+	wait_scope.poll();
+
+	const EventLoopMetrics& metrics = event_loop.metrics();
+	SAW_EXPECT(metrics.turns == 1, std::string{"Expected 1 turn, got "} + std::to_string(metrics.turns));
+	SAW_EXPECT(metrics.events >= 2, std::string{"Expected at least 2 events, got "} + std::to_string(metrics.events));
+	SAW_EXPECT(metrics.stalls == 1, std::string{"Expected 1 stall, got "} + std::to_string(metrics.stalls));
+	SAW_EXPECT(stall_calls == 1, "Stall handler wasn't called");
+	SAW_EXPECT(event_loop.stalls().size() == 1, "Expected 1 recorded stall");
+	SAW_EXPECT(event_loop.stalls().front().duration >= std::chrono::milliseconds{3}, "Recorded stall is too short");
+
+	event_loop.resetMetrics();
+	SAW_EXPECT(event_loop.metrics().events == 0, "Metrics weren't reset");
+}
+
+SAW_TEST("Async Timer"){
+	using namespace saw;
+
+	EventLoop event_loop;
+	WaitScope wait_scope{event_loop};
+
+	class Timer final : public TimerEvent {
+	public:
+		size_t fired = 0;
+
+		void fire() override { ++fired; }
+	};
+
+	Timer early;
+	Timer late;
+	Timer cancelled;
+
+	auto begin = std::chrono::steady_clock::now();
+	late.armAfter(std::chrono::milliseconds{20});
+	early.armAfter(std::chrono::milliseconds{5});
+	cancelled.armAfter(std::chrono::milliseconds{5});
+	cancelled.cancel();
+
+	wait_scope.poll();
+	SAW_EXPECT(early.fired == 0 && late.fired == 0, "Timer fired too early");
+	SAW_EXPECT(early.isScheduled(), "Timer isn't scheduled");
+
+	wait_scope.wait(std::chrono::seconds{1});
+	SAW_EXPECT(early.fired == 1 && late.fired == 0, "Earliest timer didn't fire first");
+	SAW_EXPECT(std::chrono::steady_clock::now() - begin >= std::chrono::milliseconds{5}, "Timer fired before its deadline");
+
+	wait_scope.wait(std::chrono::seconds{1});
+	SAW_EXPECT(late.fired == 1, "Later timer didn't fire");
+	SAW_EXPECT(std::chrono::steady_clock::now() - begin < std::chrono::seconds{1}, "Wait didn't stop at the timer deadline");
+	SAW_EXPECT(cancelled.fired == 0 && !cancelled.isScheduled(), "Cancelled timer fired");
+}
 }
@@ -0,0 +1,186 @@
+#include "suite/suite.h"
+
+#include "source/forstio/connection_pool.h"
+
+#include <vector>
+
+namespace {
+/**
+ * Listener which keeps every connection it accepted
+ */
+struct Acceptor {
+	saw::Own<saw::Server> server;
+	std::vector<saw::Own<saw::IoStream>> accepted;
+	saw::SinkConveyor accepting;
+};
+
+saw::Own<Acceptor> acceptAll(saw::Network& network, saw::NetworkAddress& address){
+	saw::Own<Acceptor> acceptor = saw::heap<Acceptor>();
+	acceptor->server = network.listen(address);
+	SAW_EXPECT(acceptor->server, "Couldn't listen on loopback");
+
+	Acceptor* target = acceptor.get();
+	acceptor->accepting = acceptor->server->accept().then([target](saw::Own<saw::IoStream> stream){
+		target->accepted.push_back(std::move(stream));
+	}).sink();
+	return acceptor;
+}
+
+SAW_TEST("Connection Pool Reuse and Limits"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23468};
+
+	Own<Acceptor> acceptor = acceptAll(network, address);
+	std::vector<Own<IoStream>>& accepted = acceptor->accepted;
+
+	ConnectionPoolOptions options;
+	options.max_connections_per_destination = 1;
+	options.idle_timeout = std::chrono::milliseconds{20};
+	ConnectionPool pool{network, options};
+
+	Maybe<ConnectionLease> first;
+	auto first_sink = pool.acquire(address).then([&](ConnectionLease lease){
+		first = std::move(lease);
+	}).sink();
+
+	Maybe<ConnectionLease> second;
+	auto second_sink = pool.acquire(address).then([&](ConnectionLease lease){
+		second = std::move(lease);
+	}).sink();
+
+	for(size_t i = 0; i < 100 && !(first && accepted.size() == 1); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(first.has_value(), "First lease wasn't handed out");
+	SAW_EXPECT(!second.has_value(), "Second lease exceeded the connection cap");
+	SAW_EXPECT(pool.openConnections() == 1, "Expected one open connection");
+
+	IoStream* connection = &first->stream();
+	first = std::nullopt;
+	wait_scope.poll();
+	SAW_EXPECT(second.has_value(), "Queued acquire wasn't served");
+	SAW_EXPECT(&second->stream() == connection, "Idle connection wasn't reused");
+
+	second = std::nullopt;
+	SAW_EXPECT(pool.idleConnections() == 1, "Connection didn't return to the pool");
+
+	for(size_t i = 0; i < 100 && pool.idleConnections() > 0; ++i){
+		wait_scope.wait(std::chrono::milliseconds{10});
+	}
+	SAW_EXPECT(pool.idleConnections() == 0, "Idle connection wasn't evicted");
+	SAW_EXPECT(pool.openConnections() == 0, "Evicted connection is still counted");
+	SAW_EXPECT(accepted.size() == 1, "Pool opened more connections than needed");
+}
+
+SAW_TEST("Connection Pool Discard"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23469};
+
+	Own<Acceptor> acceptor = acceptAll(network, address);
+	std::vector<Own<IoStream>>& accepted = acceptor->accepted;
+
+	ConnectionPool pool{network};
+	// Names are resolved through parseAddress instead of on the loop
+	StringNetworkAddress named{"localhost", 23469};
+
+	for(size_t round = 0; round < 2; ++round){
+		Maybe<ConnectionLease> lease;
+		auto sink = pool.acquire(named).then([&](ConnectionLease acquired){
+			lease = std::move(acquired);
+		}).sink();
+
+		for(size_t i = 0; i < 100 && !(lease && accepted.size() == round + 1); ++i){
+			wait_scope.wait(std::chrono::milliseconds{1});
+		}
+		SAW_EXPECT(lease.has_value(), "Lease wasn't handed out");
+		lease->discard();
+		SAW_EXPECT(pool.openConnections() == 0, "Discarded connection is still counted");
+	}
+	SAW_EXPECT(accepted.size() == 2, "Discarded connection was reused");
+}
+
+SAW_TEST("Connection Pool Resolve Failure"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	ConnectionPoolOptions options;
+	options.max_connections_per_destination = 1;
+	ConnectionPool pool{aio.io->network(), options};
+
+	// Each acquire resolves again instead of reusing the failed lookup
+	StringNetworkAddress invalid{"saw-resolver-test.invalid", 23483};
+	size_t failures = 0;
+	auto fail = [&](){
+		return [&](Error&& error){
+			++failures;
+			return std::move(error);
+		};
+	};
+	auto first_sink = pool.acquire(invalid).then([](ConnectionLease){}, fail()).sink();
+	auto second_sink = pool.acquire(invalid).then([](ConnectionLease){}, fail()).sink();
+
+	for(size_t i = 0; i < 1000 && failures < 2; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(failures == 2, "Failed resolution wasn't reported to every request");
+	SAW_EXPECT(pool.openConnections() == 0, "Failed resolution kept its slot");
+}
+
+SAW_TEST("Connection Pool Evicts Closed Idle Connections"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23481};
+
+	Own<Acceptor> acceptor = acceptAll(network, address);
+	std::vector<Own<IoStream>>& accepted = acceptor->accepted;
+
+	ConnectionPool pool{network};
+
+	for(size_t round = 0; round < 2; ++round){
+		Maybe<ConnectionLease> lease;
+		auto sink = pool.acquire(address).then([&](ConnectionLease acquired){
+			lease = std::move(acquired);
+		}).sink();
+
+		for(size_t i = 0; i < 100 && !(lease && accepted.size() == round + 1); ++i){
+			wait_scope.wait(std::chrono::milliseconds{1});
+		}
+		SAW_EXPECT(lease.has_value(), "Lease wasn't handed out");
+		SAW_EXPECT(accepted.size() == round + 1, "Closed connection was reused");
+		lease = std::nullopt;
+		SAW_EXPECT(pool.idleConnections() == 1, "Connection didn't return to the pool");
+
+		// The server side goes away while the connection sits in the pool
+		accepted.back() = nullptr;
+		for(size_t i = 0; i < 100 && pool.idleConnections() > 0; ++i){
+			wait_scope.wait(std::chrono::milliseconds{1});
+		}
+		SAW_EXPECT(pool.idleConnections() == 0, "Closed idle connection wasn't evicted");
+		SAW_EXPECT(pool.openConnections() == 0, "Evicted connection is still counted");
+	}
+}
+}
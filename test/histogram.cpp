@@ -0,0 +1,79 @@
+#include "suite/suite.h"
+
+#include "source/forstio/async.h"
+#include "source/forstio/histogram.h"
+
+namespace {
+SAW_TEST("Histogram Percentiles"){
+	using namespace saw;
+
+	LatencyHistogram histogram;
+
+	for(uint64_t i = 1; i <= 1000; ++i){
+		histogram.recordNanoseconds(i * 1000);
+	}
+
+	LatencyHistogram::Snapshot snapshot = histogram.snapshot();
+
+	SAW_EXPECT(snapshot.count() == 1000, std::string{"Expected 1000 values, got "} + std::to_string(snapshot.count()));
+	SAW_EXPECT(snapshot.max().count() == 1000000, "Wrong maximum");
+	SAW_EXPECT(snapshot.mean().count() == 500500, std::string{"Wrong mean "} + std::to_string(snapshot.mean().count()));
+
+	int64_t p50 = snapshot.percentile(50.0).count();
+	SAW_EXPECT(p50 >= 500000 && p50 <= 500000 * 104 / 100, std::string{"p50 out of bounds: "} + std::to_string(p50));
+
+	int64_t p99 = snapshot.percentile(99.0).count();
+	SAW_EXPECT(p99 >= 990000 && p99 <= 1000000, std::string{"p99 out of bounds: "} + std::to_string(p99));
+
+	SAW_EXPECT(snapshot.percentile(100.0).count() == 1000000, "p100 is not the maximum");
+}
+
+SAW_TEST("Histogram Merge"){
+	using namespace saw;
+
+	LatencyHistogram first;
+	LatencyHistogram second;
+
+	first.recordNanoseconds(10);
+	second.recordNanoseconds(20000);
+
+	LatencyHistogram::Snapshot snapshot = first.snapshot();
+	snapshot.merge(second.snapshot());
+
+	SAW_EXPECT(snapshot.count() == 2, "Expected 2 values after merging");
+	SAW_EXPECT(snapshot.percentile(50.0).count() == 10, "Expected 10 as median");
+	SAW_EXPECT(snapshot.max().count() == 20000, "Expected 20000 as maximum");
+
+	first.merge(second.snapshot());
+	SAW_EXPECT(first.snapshot().count() == 2, "Expected 2 values after merging into histogram");
+}
+
+SAW_TEST("Histogram Conveyor Measure"){
+	using namespace saw;
+
+	EventLoop event_loop;
+	WaitScope wait_scope{event_loop};
+
+	LatencyHistogram histogram;
+
+	auto feeder_conveyor = newConveyorAndFeeder<size_t>();
+
+	Conveyor<std::string> measured = feeder_conveyor.conveyor.measure(histogram, [](Conveyor<size_t> conveyor){
+		return conveyor.buffer(4).then([](size_t value){
+			return std::to_string(value);
+		});
+	});
+
+	feeder_conveyor.feeder->feed(5);
+	feeder_conveyor.feeder->feed(6);
+
+	wait_scope.poll();
+
+	ErrorOr<std::string> first = measured.take();
+	ErrorOr<std::string> second = measured.take();
+
+	SAW_EXPECT(first.isValue() && first.value() == "5", "Expected 5 as first element");
+	SAW_EXPECT(second.isValue() && second.value() == "6", "Expected 6 as second element");
+	SAW_EXPECT(histogram.snapshot().count() == 2, std::string{"Expected 2 measurements, got "} + std::to_string(histogram.snapshot().count()));
+}
+}
@@ -1,8 +1,69 @@
 #include "suite/suite.h"
 
+#include "source/forstio/buffer.h"
 #include "source/forstio/io.h"
 
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <tuple>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 namespace {
+/**
+ * Uring setups fall back to epoll, which would let io_uring tests pass without
+ * ever running it
+ */
+bool uringSelected(const saw::AsyncIoContext& aio){
+	if(aio.backend == saw::AsyncIoBackend::Uring){
+		return true;
+	}
+	std::fprintf(stderr, "io_uring isn't available, skipping\n");
+	return false;
+}
+
+/**
+ * Both ends of one connection
+ */
+struct StreamPair {
+	saw::Own<saw::IoStream> accepted;
+	saw::Own<saw::IoStream> connected;
+};
+
+/**
+ * Listens on address, connects to it and waits until both ends are set up.
+ * The listener is closed again once the connection is established.
+ */
+StreamPair connectPair(saw::Network& network, saw::WaitScope& wait_scope, saw::NetworkAddress& address, const saw::SocketOptions& options = {}){
+	using namespace saw;
+
+	Own<Server> server = network.listen(address);
+	SAW_EXPECT(server, "Couldn't listen");
+
+	StreamPair pair;
+	auto accept_sink = server->accept().then([&](Own<IoStream> stream){
+		pair.accepted = std::move(stream);
+	}).sink();
+	auto connect_sink = network.connect(address, options).then([&](Own<IoStream> stream){
+		pair.connected = std::move(stream);
+	}).sink();
+
+	for(size_t i = 0; i < 1000 && !(pair.accepted && pair.connected); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(pair.accepted && pair.connected, "Connection wasn't established");
+	return pair;
+}
+
 /*
 SAW_TEST("Io Socket Pair"){
 	using namespace saw;
@@ -42,4 +103,1419 @@ SAW_TEST("Io Socket Pair"){
 	SAW_EXPECT(buffer_out[6] == 0, "Element 7 failed");
 }
 */
+
+SAW_TEST("Io Uring Loopback"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo(AsyncIoBackend::Uring);
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	if(!uringSelected(aio)){
+		return;
+	}
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23451};
+
+	auto [accepted, connected] = connectPair(network, wait_scope, address);
+
+	uint8_t buffer_out[7] = {1,2,3,4,5,6,7};
+	uint8_t buffer_in[7] = {0,0,0,0,0,0,0};
+
+	auto written = connected->write(buffer_out, 7);
+	SAW_EXPECT(written.isValue() && written.value() == 7, "Write failed");
+
+	size_t received = 0;
+	for(size_t i = 0; i < 100 && received < 7; ++i){
+		wait_scope.wait(std::chrono::milliseconds{10});
+		auto read = accepted->read(buffer_in + received, 7 - received);
+		if(read.isValue()){
+			received += read.value();
+		}
+	}
+	SAW_EXPECT(received == 7, "Not all bytes received");
+	for(size_t i = 0; i < 7; ++i){
+		SAW_EXPECT(buffer_in[i] == buffer_out[i], "Received wrong byte");
+	}
+}
+
+SAW_TEST("Io Uring Pipe Disconnect"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo(AsyncIoBackend::Uring);
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	if(!uringSelected(aio)){
+		return;
+	}
+	WaitScope wait_scope{aio.event_loop};
+
+	int pipefds[2];
+	SAW_EXPECT(::pipe(pipefds) == 0, "Couldn't create pipe");
+
+	Own<InputStream> input = aio.io->wrapInputFd(pipefds[0]);
+
+	bool ready = false;
+	bool disconnected = false;
+	auto ready_sink = input->readReady().then([&](){
+		ready = true;
+	}).sink();
+	auto disconnect_sink = input->onReadDisconnected().then([&](){
+		disconnected = true;
+	}).sink();
+
+	uint8_t value = 42;
+	SAW_EXPECT(::write(pipefds[1], &value, 1) == 1, "Couldn't write to pipe");
+	::close(pipefds[1]);
+
+	for(size_t i = 0; i < 100 && !ready; ++i){
+		wait_scope.wait(std::chrono::milliseconds{10});
+	}
+	SAW_EXPECT(ready, "Read readiness not signaled");
+
+	uint8_t read_value = 0;
+	auto read = input->read(&read_value, 1);
+	SAW_EXPECT(read.isValue() && read.value() == 1, "Read failed");
+	SAW_EXPECT(read_value == 42, "Read wrong value");
+
+	for(size_t i = 0; i < 100 && !disconnected; ++i){
+		wait_scope.wait(std::chrono::milliseconds{10});
+	}
+	SAW_EXPECT(disconnected, "Disconnect not signaled");
+
+	read = input->read(&read_value, 1);
+	SAW_EXPECT(read.isError() && read.error().isCritical(), "Expected end of stream");
+}
+
+SAW_TEST("Io Uring Submission Ring Full"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo(AsyncIoBackend::Uring);
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	if(!uringSelected(aio)){
+		return;
+	}
+	WaitScope wait_scope{aio.event_loop};
+
+	// Each wrapped descriptor submits a read right away, more than the ring holds
+	constexpr size_t pipe_count = 300;
+	std::vector<Own<InputStream>> inputs;
+	std::vector<int> write_ends;
+	std::vector<SinkConveyor> ready_sinks;
+	size_t ready = 0;
+	for(size_t i = 0; i < pipe_count; ++i){
+		int pipefds[2];
+		SAW_EXPECT(::pipe(pipefds) == 0, "Couldn't create pipe");
+		write_ends.push_back(pipefds[1]);
+		inputs.push_back(aio.io->wrapInputFd(pipefds[0]));
+		ready_sinks.push_back(inputs.back()->readReady().then([&](){
+			++ready;
+		}).sink());
+	}
+
+	uint8_t value = 42;
+	for(int fd : write_ends){
+		SAW_EXPECT(::write(fd, &value, 1) == 1, "Couldn't write to pipe");
+	}
+	for(size_t i = 0; i < 100 && ready < pipe_count; ++i){
+		wait_scope.wait(std::chrono::milliseconds{10});
+	}
+	for(int fd : write_ends){
+		::close(fd);
+	}
+	SAW_EXPECT(ready == pipe_count, std::string{"Only "} + std::to_string(ready) + " reads completed");
+}
+
+SAW_TEST("Io Vectored Read Into Ring Buffer"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+
+	int pipefds[2];
+	SAW_EXPECT(::pipe(pipefds) == 0, "Couldn't create pipe");
+
+	Own<InputStream> input = aio.io->wrapInputFd(pipefds[0]);
+
+	// Move the write position to the middle so the free space wraps around
+	RingBuffer ring{8};
+	uint8_t filler[5] = {0,0,0,0,0};
+	SAW_EXPECT(!ring.push(*filler, 5).failed(), "Couldn't fill ring buffer");
+	SAW_EXPECT(!ring.pop(*filler, 5).failed(), "Couldn't drain ring buffer");
+
+	uint8_t data[6] = {1,2,3,4,5,6};
+	SAW_EXPECT(::write(pipefds[1], data, 6) == 6, "Couldn't write to pipe");
+	::close(pipefds[1]);
+
+	auto read = input->readv(ring);
+	SAW_EXPECT(read.isValue(), "Vectored read failed");
+	SAW_EXPECT(read.value() == 6, "Vectored read was short");
+	SAW_EXPECT(ring.readCompositeLength() == 6, "Ring buffer wasn't advanced");
+
+	uint8_t result[6] = {0,0,0,0,0,0};
+	SAW_EXPECT(!ring.pop(*result, 6).failed(), "Couldn't read ring buffer");
+	for(size_t i = 0; i < 6; ++i){
+		SAW_EXPECT(result[i] == data[i], "Read wrong byte");
+	}
+}
+
+SAW_TEST("Io Send File"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	FILE* file = ::tmpfile();
+	SAW_EXPECT(file, "Couldn't create temporary file");
+	std::vector<uint8_t> content(100000);
+	for(size_t i = 0; i < content.size(); ++i){
+		content[i] = static_cast<uint8_t>(i * 7);
+	}
+	int file_fd = ::fileno(file);
+	SAW_EXPECT(::write(file_fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()), "Couldn't write temporary file");
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23452};
+
+	auto [accepted, connected_stream] = connectPair(network, wait_scope, address);
+	Own<AsyncIoStream> connected = heap<AsyncIoStream>(std::move(connected_stream));
+
+	size_t sent = 0;
+	auto sent_sink = connected->writeDone().then([&](size_t n){
+		sent = n;
+	}).sink();
+
+	// Skip the first bytes to check that the offset is respected
+	connected->sendFile(file_fd, 1000, content.size() - 1000);
+
+	std::vector<uint8_t> received(content.size() - 1000);
+	size_t received_length = 0;
+	for(size_t i = 0; i < 500 && received_length < received.size(); ++i){
+		wait_scope.wait(std::chrono::milliseconds{10});
+		while(received_length < received.size()){
+			auto read = accepted->read(received.data() + received_length, received.size() - received_length);
+			if(!read.isValue()){
+				break;
+			}
+			received_length += read.value();
+		}
+	}
+	wait_scope.poll();
+
+	::fclose(file);
+
+	SAW_EXPECT(received_length == received.size(), "Not all bytes received");
+	SAW_EXPECT(sent == received.size(), "Completion reported the wrong size");
+	for(size_t i = 0; i < received.size(); ++i){
+		SAW_EXPECT(received[i] == content[i + 1000], "Received wrong byte");
+	}
+}
+
+/*
+ * Relays one loopback connection into another and checks that everything
+ * written on the first arrives at the end of the second
+ */
+void pumpThroughLoopback(saw::AsyncIoBackend backend, uint16_t port){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo(backend);
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address_in{"127.0.0.1", port};
+	StringNetworkAddress address_out{"127.0.0.1", static_cast<uint16_t>(port + 1)};
+
+	Own<Server> server_in = network.listen(address_in);
+	Own<Server> server_out = network.listen(address_out);
+	SAW_EXPECT(server_in && server_out, "Couldn't listen on loopback");
+
+	Own<IoStream> source, relay_in, relay_out, sink;
+	auto sinks = std::make_tuple(
+		server_in->accept().then([&](Own<IoStream> stream){ relay_in = std::move(stream); }).sink(),
+		server_out->accept().then([&](Own<IoStream> stream){ sink = std::move(stream); }).sink(),
+		network.connect(address_in).then([&](Own<IoStream> stream){ source = std::move(stream); }).sink(),
+		network.connect(address_out).then([&](Own<IoStream> stream){ relay_out = std::move(stream); }).sink()
+	);
+
+	for(size_t i = 0; i < 100 && !(source && relay_in && relay_out && sink); ++i){
+		wait_scope.wait(std::chrono::milliseconds{10});
+	}
+	SAW_EXPECT(source && relay_in && relay_out && sink, "Loopback connections not established");
+
+	Maybe<size_t> pumped;
+	auto pump_sink = pump(*relay_in, *relay_out).then([&](size_t n){
+		pumped = n;
+	}).sink();
+
+	std::vector<uint8_t> content(200000);
+	for(size_t i = 0; i < content.size(); ++i){
+		content[i] = static_cast<uint8_t>(i * 13);
+	}
+	std::vector<uint8_t> received(content.size());
+	size_t written = 0;
+	size_t received_length = 0;
+
+	for(size_t i = 0; i < 500 && received_length < received.size(); ++i){
+		if(written < content.size()){
+			auto write = source->write(content.data() + written, content.size() - written);
+			if(write.isValue()){
+				written += write.value();
+			}
+		}
+		wait_scope.wait(std::chrono::milliseconds{1});
+		while(received_length < received.size()){
+			auto read = sink->read(received.data() + received_length, received.size() - received_length);
+			if(!read.isValue()){
+				break;
+			}
+			received_length += read.value();
+		}
+	}
+	SAW_EXPECT(received_length == received.size(), "Not all bytes relayed");
+	SAW_EXPECT(received == content, "Relayed wrong bytes");
+
+	source = nullptr;
+	for(size_t i = 0; i < 100 && !pumped.has_value(); ++i){
+		wait_scope.wait(std::chrono::milliseconds{10});
+	}
+	SAW_EXPECT(pumped.has_value(), "Pump didn't finish on disconnect");
+	SAW_EXPECT(*pumped == content.size(), "Pump reported wrong amount");
+}
+
+SAW_TEST("Io Pump Splice"){
+	pumpThroughLoopback(saw::AsyncIoBackend::Default, 23453);
+}
+
+SAW_TEST("Io Pump Buffered"){
+	pumpThroughLoopback(saw::AsyncIoBackend::Uring, 23455);
+}
+
+SAW_TEST("Io Zero Copy Write"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23457};
+
+	auto [accepted, connected] = connectPair(network, wait_scope, address);
+
+	IoStream& raw_stream = *connected;
+	AsyncIoStream async_stream{std::move(connected)};
+	SAW_EXPECT(async_stream.setZeroCopyThreshold(1024), "Zero copy isn't supported");
+
+	std::vector<uint8_t> content(100000);
+	for(size_t i = 0; i < content.size(); ++i){
+		content[i] = static_cast<uint8_t>(i * 3);
+	}
+
+	bool done = false;
+	size_t referenced_at_done = 0;
+	auto done_sink = async_stream.writeDone().then([&](size_t){
+		done = true;
+		referenced_at_done = raw_stream.referencedBytes();
+	}).sink();
+	async_stream.write(content.data(), content.size());
+	SAW_EXPECT(raw_stream.referencedBytes() > 0, "Write wasn't sent without copying");
+
+	std::vector<uint8_t> received(content.size());
+	size_t received_length = 0;
+	for(size_t i = 0; i < 500 && !(done && received_length == received.size()); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+		while(received_length < received.size()){
+			auto read = accepted->read(received.data() + received_length, received.size() - received_length);
+			if(!read.isValue()){
+				break;
+			}
+			received_length += read.value();
+		}
+	}
+
+	SAW_EXPECT(received == content, "Received wrong bytes");
+	SAW_EXPECT(done, "Write didn't complete");
+	SAW_EXPECT(referenced_at_done == 0, "Write completed while the buffer was still referenced");
+}
+
+/*
+ * Always writable stream which records how its data was handed over and
+ * serves reads from incoming
+ */
+class RecordingStream final : public saw::IoStream {
+public:
+	std::vector<size_t> calls;
+	std::vector<uint8_t> data;
+
+	std::string incoming;
+	size_t read_calls = 0;
+
+	saw::Own<saw::ConveyorFeeder<void>> read_ready = nullptr;
+	saw::Own<saw::ConveyorFeeder<void>> write_ready = nullptr;
+	saw::Own<saw::ConveyorFeeder<void>> disconnected = nullptr;
+
+	saw::ErrorOr<size_t> read(void* buffer, size_t length) override {
+		++read_calls;
+		if(incoming.empty()){
+			return saw::recoverableError("Currently busy");
+		}
+		size_t amount = std::min(length, incoming.size());
+		memcpy(buffer, incoming.data(), amount);
+		incoming.erase(0, amount);
+		return amount;
+	}
+
+	saw::Conveyor<void> readReady() override {
+		auto caf = saw::newConveyorAndFeeder<void>();
+		read_ready = std::move(caf.feeder);
+		return std::move(caf.conveyor);
+	}
+
+	saw::Conveyor<void> onReadDisconnected() override {
+		auto caf = saw::newConveyorAndFeeder<void>();
+		disconnected = std::move(caf.feeder);
+		return std::move(caf.conveyor);
+	}
+
+	saw::ErrorOr<size_t> write(const void* buffer, size_t length) override {
+		const uint8_t* bytes = static_cast<const uint8_t*>(buffer);
+		data.insert(data.end(), bytes, bytes + length);
+		calls.push_back(length);
+		return length;
+	}
+
+	using saw::OutputStream::writev;
+	saw::ErrorOr<size_t> writev(std::span<const saw::IoVector> segments) override {
+		size_t length = 0;
+		for(auto& segment : segments){
+			const uint8_t* bytes = static_cast<const uint8_t*>(segment.data);
+			data.insert(data.end(), bytes, bytes + segment.length);
+			length += segment.length;
+		}
+		calls.push_back(length);
+		return length;
+	}
+
+	saw::Conveyor<void> writeReady() override {
+		auto caf = saw::newConveyorAndFeeder<void>();
+		write_ready = std::move(caf.feeder);
+		return std::move(caf.conveyor);
+	}
+};
+
+SAW_TEST("Async Io Stream Write Coalescing"){
+	using namespace saw;
+
+	EventLoop event_loop;
+	WaitScope wait_scope{event_loop};
+
+	Own<RecordingStream> recording = heap<RecordingStream>();
+	RecordingStream& raw = *recording;
+	AsyncIoStream stream{std::move(recording)};
+
+	std::vector<size_t> completed;
+	auto done_sink = stream.writeDone().then([&](size_t length){
+		completed.push_back(length);
+	}).sink();
+
+	std::array<std::string, 3> messages{"first", "second", "third"};
+	for(auto& message : messages){
+		stream.write(message.data(), message.size());
+	}
+	SAW_EXPECT(raw.calls.empty(), "Small writes weren't queued");
+	wait_scope.poll();
+	SAW_EXPECT(raw.calls.size() == 1 && raw.calls.front() == 16, "Queued writes weren't coalesced");
+	SAW_EXPECT(std::string(raw.data.begin(), raw.data.end()) == "firstsecondthird", "Coalesced data is out of order");
+	SAW_EXPECT((completed == std::vector<size_t>{5, 6, 5}), "Writes weren't completed one by one");
+
+	stream.cork();
+	stream.write(messages[0].data(), messages[0].size());
+	wait_scope.poll();
+	stream.write(messages[1].data(), messages[1].size());
+	wait_scope.poll();
+	SAW_EXPECT(raw.calls.size() == 1, "Corked writes were sent");
+	stream.uncork();
+	wait_scope.poll();
+	SAW_EXPECT(raw.calls.size() == 2 && raw.calls.back() == 11, "Uncorked writes weren't sent together");
+
+	std::vector<uint8_t> large(ASYNC_IO_STREAM_COALESCE_LIMIT);
+	stream.write(large.data(), large.size());
+	SAW_EXPECT(raw.calls.size() == 3, "Large write waited for the end of the turn");
+	wait_scope.poll();
+	SAW_EXPECT(completed.size() == 6, "Not all writes completed");
+}
+
+SAW_TEST("Async Io Stream Read Ahead"){
+	using namespace saw;
+
+	EventLoop event_loop;
+	WaitScope wait_scope{event_loop};
+
+	Own<RecordingStream> recording = heap<RecordingStream>();
+	RecordingStream& raw = *recording;
+	AsyncIoStream stream{std::move(recording)};
+	stream.setReadAhead(1024);
+
+	std::vector<size_t> completed;
+	auto done_sink = stream.readDone().then([&](size_t length){
+		completed.push_back(length);
+	}).sink();
+
+	raw.incoming = "abcdefghij";
+	std::array<char, 4> prefix{};
+	stream.read(prefix.data(), 4, 4);
+	wait_scope.poll();
+	SAW_EXPECT(completed.size() == 1 && completed.back() == 4, "Read wasn't served");
+	SAW_EXPECT(std::string(prefix.data(), 4) == "abcd", "Read wrong bytes");
+
+	stream.peek(6);
+	wait_scope.poll();
+	SAW_EXPECT(completed.size() == 2 && completed.back() == 6, "Peek wasn't served");
+	SAW_EXPECT(stream.buffered().size() == 6 && stream.buffered().front() == 'e', "Peek consumed data");
+
+	stream.consume(2);
+	stream.read(prefix.data(), 4, 4);
+	wait_scope.poll();
+	SAW_EXPECT(std::string(prefix.data(), 4) == "ghij", "Consumed bytes were read");
+	SAW_EXPECT(raw.read_calls == 1, "Buffered reads went to the stream");
+
+	stream.peek(2);
+	wait_scope.poll();
+	SAW_EXPECT(completed.size() == 3, "Peek completed without data");
+	raw.incoming = "kl";
+	raw.read_ready->feed();
+	wait_scope.poll();
+	SAW_EXPECT(completed.size() == 4 && completed.back() == 2, "Peek didn't wait for data");
+
+	std::array<char, 2048> large{};
+	stream.read(large.data(), 3, large.size());
+	raw.incoming = std::string(1500, 'm');
+	raw.read_ready->feed();
+	wait_scope.poll();
+	SAW_EXPECT(completed.size() == 5 && completed.back() == 1502, "Large read wasn't passed through");
+}
+
+SAW_TEST("Io Socket Options"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23472};
+
+	ListenOptions listen_options;
+	listen_options.socket.no_delay = true;
+	listen_options.socket.receive_buffer = 64 * 1024;
+	listen_options.socket.defer_accept = 1;
+	Own<Server> server = network.listen(address, listen_options);
+	SAW_EXPECT(server, "Couldn't listen with socket options");
+
+	Own<IoStream> accepted;
+	auto accept_sink = server->accept().then([&](Own<IoStream> stream){
+		accepted = std::move(stream);
+	}).sink();
+
+	SocketOptions options;
+	options.no_delay = true;
+	options.send_buffer = 32 * 1024;
+	Own<IoStream> connected;
+	auto connect_sink = network.connect(address, options).then([&](Own<IoStream> stream){
+		connected = std::move(stream);
+	}).sink();
+
+	for(size_t i = 0; i < 100 && !connected; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(connected, "Couldn't connect with socket options");
+
+	// Deferred accepts only wake up once data arrived
+	uint8_t byte = 1;
+	auto written = connected->write(&byte, 1);
+	SAW_EXPECT(written.isValue(), "Couldn't write");
+	for(size_t i = 0; i < 100 && !accepted; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(accepted, "Connection wasn't accepted");
+
+	auto option = [](IoStream& stream, int level, int name){
+		int value = 0;
+		socklen_t length = sizeof(value);
+		::getsockopt(*stream.outputFd(), level, name, &value, &length);
+		return value;
+	};
+	SAW_EXPECT(option(*connected, IPPROTO_TCP, TCP_NODELAY) != 0, "Nagle wasn't disabled on connect");
+	SAW_EXPECT(option(*connected, SOL_SOCKET, SO_SNDBUF) >= 32 * 1024, "Send buffer wasn't set");
+	SAW_EXPECT(option(*accepted, IPPROTO_TCP, TCP_NODELAY) != 0, "Accepted connection didn't inherit the listener options");
+	SAW_EXPECT(option(*accepted, SOL_SOCKET, SO_RCVBUF) >= 64 * 1024, "Receive buffer wasn't inherited");
+}
+
+SAW_TEST("Io Low Watermarks"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23473};
+
+	auto [accepted_stream, connected] = connectPair(network, wait_scope, address);
+	int accepted_fd = *accepted_stream->inputFd();
+	Own<AsyncIoStream> accepted = heap<AsyncIoStream>(std::move(accepted_stream));
+
+	SAW_EXPECT(accepted->setWriteLowWatermark(16 * 1024), "Write low watermark isn't supported");
+	int value = 0;
+	socklen_t length = sizeof(value);
+	::getsockopt(accepted_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &value, &length);
+	SAW_EXPECT(value == 16 * 1024, "Write low watermark wasn't set");
+
+	auto low_watermark = [&](){
+		int watermark = 0;
+		socklen_t watermark_length = sizeof(watermark);
+		::getsockopt(accepted_fd, SOL_SOCKET, SO_RCVLOWAT, &watermark, &watermark_length);
+		return watermark;
+	};
+
+	size_t read_bytes = 0;
+	auto read_sink = accepted->readDone().then([&](size_t n){
+		read_bytes = n;
+	}).sink();
+
+	accepted->matchReadLowWatermark(true);
+	std::vector<uint8_t> frame(1000, 5);
+	std::vector<uint8_t> received(frame.size());
+	accepted->read(received.data(), received.size(), received.size());
+	SAW_EXPECT(low_watermark() == 1000, "Low watermark didn't follow the missing bytes");
+
+	// The fragment alone doesn't wake the reader up
+	SAW_EXPECT(connected->write(frame.data(), 10).isValue(), "Couldn't write the first fragment");
+	for(size_t i = 0; i < 10; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(read_bytes == 0, "Read completed early");
+	SAW_EXPECT(low_watermark() == 1000, "Reader was woken up by a fragment");
+
+	SAW_EXPECT(connected->write(frame.data() + 10, frame.size() - 10).isValue(), "Couldn't write the rest");
+	for(size_t i = 0; i < 100 && read_bytes == 0; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(read_bytes == frame.size() && received == frame, "Frame wasn't read");
+	SAW_EXPECT(low_watermark() == 1, "Low watermark wasn't reset");
+}
+
+SAW_TEST("Io Datagram Batch"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress sender_address{"127.0.0.1", 23458};
+	StringNetworkAddress receiver_address{"127.0.0.1", 23459};
+
+	Own<NetworkAddress> destination;
+	auto parse_sink = network.parseAddress("127.0.0.1", 23459).then([&](Own<NetworkAddress> addr){
+		destination = std::move(addr);
+	}).sink();
+	wait_scope.poll();
+	SAW_EXPECT(destination, "Couldn't parse the destination");
+
+	Own<Datagram> sender = network.datagram(sender_address);
+	Own<Datagram> receiver = network.datagram(receiver_address);
+	SAW_EXPECT(sender && receiver, "Couldn't bind datagrams");
+
+	constexpr size_t packet_count = 8;
+	Own<DatagramBatch> outgoing = sender->newBatch(packet_count, 512);
+	Own<DatagramBatch> incoming = receiver->newBatch(packet_count, 512);
+
+	std::span<DatagramPacket> out_packets = outgoing->packets();
+	SAW_EXPECT(out_packets.size() == packet_count, "Batch has the wrong size");
+	for(size_t i = 0; i < packet_count; ++i){
+		DatagramPacket& packet = out_packets[i];
+		packet.length = 100 + i;
+		memset(packet.data, static_cast<int>(i), packet.length);
+		packet.address = destination.get();
+	}
+
+	auto sent = sender->writeBatch(*outgoing, packet_count);
+	SAW_EXPECT(sent.isValue() && sent.value() == packet_count, "Batch wasn't sent");
+
+	size_t received = 0;
+	for(size_t i = 0; i < 100 && received < packet_count; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+		auto read = receiver->readBatch(*incoming);
+		if(!read.isValue()){
+			continue;
+		}
+		for(size_t j = 0; j < read.value(); ++j, ++received){
+			DatagramPacket& packet = incoming->packets()[j];
+			SAW_EXPECT(packet.length == 100 + received, "Received packet has the wrong length");
+			SAW_EXPECT(packet.data[packet.length - 1] == received, "Received packet has the wrong content");
+			SAW_EXPECT(packet.address && packet.address->port() == 23458, "Received packet has the wrong source");
+			SAW_EXPECT(packet.address->address() == "127.0.0.1", "Received packet has the wrong source");
+		}
+	}
+	SAW_EXPECT(received == packet_count, "Not all packets were received");
+
+	// A segmented send arrives as separate packets without receive offload
+	DatagramPacket& train = out_packets[0];
+	train.length = 350;
+	train.segment_size = 100;
+	sent = sender->writeBatch(*outgoing, 1);
+	if(!sent.isValue()){
+		// Segmentation offload isn't available everywhere
+		return;
+	}
+
+	std::vector<size_t> segment_lengths;
+	for(size_t i = 0; i < 100 && segment_lengths.size() < 4; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+		auto read = receiver->readBatch(*incoming);
+		if(!read.isValue()){
+			continue;
+		}
+		for(size_t j = 0; j < read.value(); ++j){
+			segment_lengths.push_back(incoming->packets()[j].length);
+		}
+	}
+	SAW_EXPECT((segment_lengths == std::vector<size_t>{100, 100, 100, 50}), "Segmented send wasn't split");
+}
+
+void datagramRequestResponse(saw::AsyncIoBackend backend, uint16_t port){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo(backend);
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress server_address{"127.0.0.1", port};
+	StringNetworkAddress client_address{"127.0.0.1", static_cast<uint16_t>(port + 1)};
+
+	Own<Datagram> server = network.datagram(server_address);
+	Own<Datagram> client = network.datagram(client_address);
+	SAW_EXPECT(server && client, "Couldn't bind datagrams");
+	SAW_EXPECT(client->connect(server_address).isValue(), "Couldn't connect datagram");
+
+	std::string request = "request";
+	auto sent = client->write(request.data(), request.size());
+	SAW_EXPECT(sent.isValue() && sent.value() == request.size(), "Request wasn't sent");
+
+	std::array<char, 64> buffer;
+	NetworkAddress* source = nullptr;
+	ErrorOr<size_t> received = recoverableError("Nothing received");
+	for(size_t i = 0; i < 100 && !received.isValue(); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+		received = server->read(buffer.data(), buffer.size(), source);
+	}
+	SAW_EXPECT(received.isValue(), "Request wasn't received");
+	SAW_EXPECT(std::string(buffer.data(), received.value()) == request, "Received wrong request");
+	SAW_EXPECT(source && source->port() == port + 1, "Request has the wrong source");
+
+	std::string response = "response";
+	sent = server->write(response.data(), response.size(), *source);
+	SAW_EXPECT(sent.isValue(), "Response wasn't sent");
+
+	received = recoverableError("Nothing received");
+	for(size_t i = 0; i < 100 && !received.isValue(); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+		received = client->read(buffer.data(), buffer.size());
+	}
+	SAW_EXPECT(received.isValue(), "Response wasn't received");
+	SAW_EXPECT(std::string(buffer.data(), received.value()) == response, "Received wrong response");
+}
+
+SAW_TEST("Io Datagram Request Response"){
+	datagramRequestResponse(saw::AsyncIoBackend::Default, 23460);
+	datagramRequestResponse(saw::AsyncIoBackend::Uring, 23462);
+}
+
+void acceptWithBackpressure(saw::AsyncIoBackend backend, uint16_t port, bool exact_limit){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo(backend);
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", port};
+
+	Own<Server> server = network.listen(address);
+	SAW_EXPECT(server, "Couldn't listen on loopback");
+	server->setMaxPendingAccepts(4);
+
+	// Nothing consumes the conveyor yet, so accepted connections pile up
+	Conveyor<Own<IoStream>> accepting = server->accept();
+
+	constexpr size_t connection_count = 10;
+	std::vector<Own<IoStream>> connected;
+	std::vector<SinkConveyor> connect_sinks;
+	for(size_t i = 0; i < connection_count; ++i){
+		connect_sinks.push_back(network.connect(address).then([&](Own<IoStream> stream){
+			connected.push_back(std::move(stream));
+		}).sink());
+	}
+
+	for(size_t i = 0; i < 100 && (connected.size() < connection_count || server->metrics().accepted < 4); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(connected.size() == connection_count, "Connections weren't established");
+	SAW_EXPECT(!exact_limit || server->metrics().accepted == 4, "Accepting didn't stop at the pending limit");
+	SAW_EXPECT(server->metrics().pauses == 1, "Pause wasn't counted");
+
+	std::vector<Own<IoStream>> accepted;
+	auto accept_sink = accepting.then([&](Own<IoStream> stream){
+		accepted.push_back(std::move(stream));
+	}).sink();
+
+	for(size_t i = 0; i < 100 && accepted.size() < connection_count; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(accepted.size() == connection_count, "Backlog wasn't drained after resuming");
+	SAW_EXPECT(server->metrics().accepted == connection_count, "Accepted connections weren't counted");
+}
+
+SAW_TEST("Io Accept Backpressure"){
+	acceptWithBackpressure(saw::AsyncIoBackend::Default, 23464, true);
+	// Multishot accepts may complete ahead of the pause
+	acceptWithBackpressure(saw::AsyncIoBackend::Uring, 23465, false);
+}
+
+SAW_TEST("Io Accept Retry After Descriptor Exhaustion"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23479};
+
+	Own<Server> server = network.listen(address);
+	SAW_EXPECT(server, "Couldn't listen on loopback");
+
+	std::vector<Own<IoStream>> accepted;
+	auto accept_sink = server->accept().then([&](Own<IoStream> stream){
+		accepted.push_back(std::move(stream));
+	}).sink();
+	wait_scope.poll();
+
+	int client = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	SAW_EXPECT(client >= 0, "Couldn't create a socket");
+	struct ::sockaddr_in loopback;
+	memset(&loopback, 0, sizeof(loopback));
+	loopback.sin_family = AF_INET;
+	loopback.sin_port = htons(23479);
+	loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	// No descriptor is left for the accepted connection
+	struct ::rlimit limit;
+	SAW_EXPECT(::getrlimit(RLIMIT_NOFILE, &limit) == 0, "Couldn't get the descriptor limit");
+	int lowest_free = ::dup(client);
+	::close(lowest_free);
+	struct ::rlimit exhausted = limit;
+	exhausted.rlim_cur = static_cast<rlim_t>(lowest_free);
+	SAW_EXPECT(::setrlimit(RLIMIT_NOFILE, &exhausted) == 0, "Couldn't lower the descriptor limit");
+
+	int rc = ::connect(client, reinterpret_cast<struct ::sockaddr*>(&loopback), sizeof(loopback));
+	for(size_t i = 0; i < 100 && server->metrics().accept_errors == 0; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	uint64_t accept_errors = server->metrics().accept_errors;
+	::setrlimit(RLIMIT_NOFILE, &limit);
+	SAW_EXPECT(rc == 0, "Couldn't connect to the listener");
+	SAW_EXPECT(accept_errors > 0, "Accepting didn't run out of descriptors");
+	SAW_EXPECT(accepted.empty(), "Connection was accepted beyond the limit");
+
+	// No further connection arrives, so only the retry picks it up
+	for(size_t i = 0; i < 100 && accepted.empty(); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	::close(client);
+	SAW_EXPECT(accepted.size() == 1, "Backlog wasn't retried after descriptors were free");
+}
+
+SAW_TEST("Io Listen Reuse Port"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23466};
+
+	ListenOptions options;
+	options.reuse_port = true;
+	Own<Server> first = network.listen(address, options);
+	Own<Server> second = network.listen(address, options);
+	SAW_EXPECT(first && second, "Couldn't share the port");
+	SAW_EXPECT(!network.listen(address), "Port was shared without reuse_port");
+	SAW_EXPECT(first->listenFd().has_value(), "Listener has no descriptor");
+
+	size_t accepted = 0;
+	auto first_sink = first->accept().then([&](Own<IoStream>){
+		++accepted;
+	}).sink();
+	auto second_sink = second->accept().then([&](Own<IoStream>){
+		++accepted;
+	}).sink();
+
+	constexpr size_t connection_count = 16;
+	std::vector<Own<IoStream>> connected;
+	std::vector<SinkConveyor> connect_sinks;
+	for(size_t i = 0; i < connection_count; ++i){
+		connect_sinks.push_back(network.connect(address).then([&](Own<IoStream> stream){
+			connected.push_back(std::move(stream));
+		}).sink());
+	}
+
+	for(size_t i = 0; i < 100 && accepted < connection_count; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(accepted == connection_count, "Not all connections were accepted");
+	SAW_EXPECT(first->metrics().accepted + second->metrics().accepted == connection_count, "Accepts weren't split between the listeners");
+}
+
+SAW_TEST("Io Resolve Names Asynchronously"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+
+	std::vector<Own<NetworkAddress>> resolved;
+	auto store = [&](){
+		return [&](Own<NetworkAddress> addr){
+			resolved.push_back(std::move(addr));
+		};
+	};
+
+	// Both lookups share one request
+	auto first_sink = network.parseAddress("localhost", 23467).then(store()).sink();
+	auto second_sink = network.parseAddress("localhost", 23467).then(store()).sink();
+	for(size_t i = 0; i < 1000 && resolved.size() < 2; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(resolved.size() == 2, "Lookups didn't finish");
+	SAW_EXPECT(resolved[0]->port() == 23467 && resolved[1]->port() == 23467, "Resolved the wrong port");
+
+	// Cached and numeric addresses don't wait for a worker
+	auto cached_sink = network.parseAddress("localhost", 23467).then(store()).sink();
+	auto numeric_sink = network.parseAddress("127.0.0.1", 23467).then(store()).sink();
+	wait_scope.poll();
+	SAW_EXPECT(resolved.size() == 4, "Cached lookup wasn't answered right away");
+
+	Own<Server> server = network.listen(*resolved[3]);
+	SAW_EXPECT(server, "Couldn't listen on the numeric address");
+
+	bool connected = false;
+	auto connect_sink = network.connect(*resolved[2]).then([&](Own<IoStream>){
+		connected = true;
+	}).sink();
+	for(size_t i = 0; i < 100 && !connected; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(connected, "Couldn't connect to the resolved address");
+}
+
+SAW_TEST("Io Resolve Failures"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+
+	// .invalid never resolves (RFC 6761)
+	bool parse_failed = false;
+	auto parse_sink = network.parseAddress("saw-resolver-test.invalid", 23467).then([](Own<NetworkAddress>){
+	}, [&](Error&& error){
+		parse_failed = true;
+		return std::move(error);
+	}).sink();
+
+	bool connect_failed = false;
+	StringNetworkAddress invalid{"saw-resolver-test.invalid", 23467};
+	auto connect_sink = network.connect(invalid).then([](Own<IoStream>){
+	}, [&](Error&& error){
+		connect_failed = true;
+		return std::move(error);
+	}).sink();
+
+	for(size_t i = 0; i < 1000 && !(parse_failed && connect_failed); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(parse_failed, "Failed lookup was reported as an address");
+	SAW_EXPECT(connect_failed, "Connect to an unresolvable name didn't fail");
+
+	// Binding doesn't look names up on the loop
+	StringNetworkAddress named{"localhost", 23467};
+	SAW_EXPECT(!network.listen(named), "Listen resolved a name");
+	SAW_EXPECT(!network.datagram(named), "Datagram resolved a name");
+}
+
+SAW_TEST("Io Connect Waits For Completion"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+
+	// Nothing listens here, so the connect has to fail instead of handing out a stream
+	StringNetworkAddress refused_address{"127.0.0.1", 23470};
+	bool refused = false;
+	bool connected = false;
+	auto refused_sink = network.connect(refused_address).then([&](Own<IoStream>){
+		connected = true;
+	}, [&](Error&& error){
+		refused = true;
+		return std::move(error);
+	}).sink();
+
+	for(size_t i = 0; i < 100 && !(refused || connected); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(refused && !connected, "Refused connect wasn't reported");
+
+	// localhost may resolve to ::1 first, which has to fall back to 127.0.0.1
+	StringNetworkAddress listen_address{"127.0.0.1", 23471};
+	Own<Server> server = network.listen(listen_address);
+	SAW_EXPECT(server, "Couldn't listen on loopback");
+
+	StringNetworkAddress dual_stack_address{"localhost", 23471};
+	Own<IoStream> stream;
+	auto connect_sink = network.connect(dual_stack_address).then([&](Own<IoStream> connected_stream){
+		stream = std::move(connected_stream);
+	}).sink();
+
+	for(size_t i = 0; i < 100 && !stream; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(stream, "Couldn't connect to any address of localhost");
+
+	uint8_t byte = 42;
+	auto written = stream->write(&byte, 1);
+	SAW_EXPECT(written.isValue() && written.value() == 1, "Established connection isn't writable");
+}
+
+void fileRoundTrip(saw::AsyncIoBackend backend){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo(backend);
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	std::string path = "/tmp/forstio_io_file_" + std::to_string(::getpid());
+
+	constexpr size_t chunk_size = 10000;
+	constexpr size_t chunk_count = 5;
+	std::vector<uint8_t> data(chunk_size);
+	{
+		auto err_or_file = aio.io->openFile(path, FileMode::Write);
+		SAW_EXPECT(err_or_file.isValue(), "Couldn't create the file");
+		Own<AsyncFileStream> file = std::move(err_or_file.value());
+
+		size_t written = 0;
+		size_t chunk = 0;
+		auto write_sink = file->writeDone().then([&](size_t length){
+			written += length;
+		}).sink();
+
+		for(; chunk < chunk_count; ++chunk){
+			for(size_t i = 0; i < chunk_size; ++i){
+				data[i] = static_cast<uint8_t>(chunk * chunk_size + i);
+			}
+			size_t expected = written + chunk_size;
+			file->write(data.data(), chunk_size);
+			for(size_t i = 0; i < 1000 && written < expected; ++i){
+				wait_scope.wait(std::chrono::milliseconds{1});
+			}
+			SAW_EXPECT(written == expected, "Write didn't complete");
+		}
+	}
+
+	FileOptions options;
+	// Smaller than a read, so reads wait for the workers
+	options.read_ahead = 4096;
+	auto err_or_file = aio.io->openFile(path, FileMode::Read, options);
+	::unlink(path.c_str());
+	SAW_EXPECT(err_or_file.isValue(), "Couldn't open the file");
+	Own<AsyncFileStream> file = std::move(err_or_file.value());
+
+	std::vector<uint8_t> content(chunk_size * chunk_count + 1);
+	size_t read_bytes = 0;
+	bool reached_end = false;
+	auto read_sink = file->readDone().then([&](size_t length){
+		read_bytes += length;
+		if(read_bytes < content.size()){
+			file->read(content.data() + read_bytes, 1, std::min<size_t>(8192, content.size() - read_bytes));
+		}
+	}).sink();
+	auto end_sink = file->onReadDisconnected().then([&](){
+		reached_end = true;
+	}).sink();
+
+	file->read(content.data(), 1, 8192);
+	for(size_t i = 0; i < 1000 && !reached_end; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(reached_end, "End of the file wasn't reported");
+	SAW_EXPECT(read_bytes == chunk_size * chunk_count, std::string{"Expected the whole file, read "} + std::to_string(read_bytes));
+
+	bool matches = true;
+	for(size_t i = 0; i < read_bytes; ++i){
+		matches = matches && content[i] == static_cast<uint8_t>(i);
+	}
+	SAW_EXPECT(matches, "File content differs");
+
+	SAW_EXPECT(aio.io->openFile(path, FileMode::Read).isError(), "Opened a missing file");
+}
+
+SAW_TEST("Io File Stream"){
+	fileRoundTrip(saw::AsyncIoBackend::Default);
+	fileRoundTrip(saw::AsyncIoBackend::Uring);
+}
+
+SAW_TEST("Io Shared Memory Stream"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network* network = aio.io->sharedMemoryNetwork();
+	SAW_EXPECT(network, "Epoll backend has no shared memory network");
+
+	std::string path = "/tmp/forstio_shm_" + std::to_string(::getpid());
+	StringNetworkAddress address{"unix:" + path, 0};
+
+	auto [accepted, connected] = connectPair(*network, wait_scope, address);
+
+	size_t read_wakeups = 0;
+	auto read_sink = accepted->readReady().then([&](){
+		++read_wakeups;
+	}).sink();
+	size_t write_wakeups = 0;
+	auto write_sink = connected->writeReady().then([&](){
+		++write_wakeups;
+	}).sink();
+
+	// Larger than a ring, so the writer has to wait for space
+	std::vector<uint8_t> sent(1024 * 1024 + 17);
+	for(size_t i = 0; i < sent.size(); ++i){
+		sent[i] = static_cast<uint8_t>(i * 7);
+	}
+	std::vector<uint8_t> received(sent.size());
+	size_t written = 0;
+	size_t read_bytes = 0;
+	for(size_t i = 0; i < 1000 && read_bytes < sent.size(); ++i){
+		while(written < sent.size()){
+			auto result = connected->write(sent.data() + written, sent.size() - written);
+			if(result.isError()){
+				break;
+			}
+			written += result.value();
+		}
+		while(read_bytes < received.size()){
+			auto result = accepted->read(received.data() + read_bytes, std::min<size_t>(100000, received.size() - read_bytes));
+			if(result.isError()){
+				break;
+			}
+			read_bytes += result.value();
+		}
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(read_bytes == sent.size(), std::string{"Expected all data, read "} + std::to_string(read_bytes));
+	SAW_EXPECT(received == sent, "Received data differs");
+	SAW_EXPECT(write_wakeups > 0, "Writer wasn't woken up once space was free");
+
+	const char reply[] = "pong";
+	auto err_or_written = accepted->write(reply, sizeof(reply));
+	SAW_EXPECT(err_or_written.isValue() && err_or_written.value() == sizeof(reply), "Couldn't answer");
+	char answer[sizeof(reply)] = {};
+	auto err_or_read = connected->read(answer, sizeof(answer));
+	SAW_EXPECT(err_or_read.isValue() && err_or_read.value() == sizeof(reply) && std::string{answer} == "pong", "Answer wasn't received");
+
+	read_wakeups = 0;
+	SAW_EXPECT(accepted->read(received.data(), 1).isError(), "Read from an empty ring");
+	connected = nullptr;
+	for(size_t i = 0; i < 100 && read_wakeups == 0; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(read_wakeups > 0, "Waiting reader wasn't woken up on close");
+	auto err_or_closed = accepted->read(received.data(), 1);
+	SAW_EXPECT(err_or_closed.isError() && err_or_closed.error().isCritical(), "Closed peer wasn't reported");
+}
+
+SAW_TEST("Io Shared Memory Failed Handshake"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network* network = aio.io->sharedMemoryNetwork();
+	SAW_EXPECT(network, "Epoll backend has no shared memory network");
+
+	std::string path = "/tmp/forstio_shm_failed_" + std::to_string(::getpid());
+	StringNetworkAddress address{"unix:" + path, 0};
+
+	Own<Server> server = network->listen(address);
+	SAW_EXPECT(server, "Couldn't listen on the socket path");
+
+	std::vector<Own<IoStream>> accepted;
+	auto accept_sink = server->accept().then([&](Own<IoStream> stream){
+		accepted.push_back(std::move(stream));
+	}).sink();
+
+	// Gone before the server could pass the shared memory
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	SAW_EXPECT(fd >= 0, "Couldn't create a unix socket");
+	struct ::sockaddr_un unix_address;
+	memset(&unix_address, 0, sizeof(unix_address));
+	unix_address.sun_family = AF_UNIX;
+	memcpy(unix_address.sun_path, path.data(), path.size());
+	int rc = ::connect(fd, reinterpret_cast<struct ::sockaddr*>(&unix_address), sizeof(unix_address));
+	::close(fd);
+	SAW_EXPECT(rc == 0, "Couldn't connect to the socket path");
+
+	for(size_t i = 0; i < 100 && server->metrics().accept_errors == 0; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(server->metrics().accept_errors == 1, "Failed handshake wasn't counted");
+	SAW_EXPECT(accepted.empty(), "Failed handshake produced a stream");
+
+	Own<IoStream> connected;
+	auto connect_sink = network->connect(address).then([&](Own<IoStream> stream){
+		connected = std::move(stream);
+	}).sink();
+
+	for(size_t i = 0; i < 100 && !(accepted.size() == 1 && connected); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(accepted.size() == 1 && connected, "Server stopped accepting after a failed handshake");
+}
+
+/**
+ * Events the descriptor is registered for with any epoll instance of this
+ * process, as listed in the epoll fdinfo
+ */
+saw::Maybe<uint32_t> registeredEvents(int fd){
+	for(int epoll_fd = 0; epoll_fd < 1024; ++epoll_fd){
+		std::ifstream fdinfo{"/proc/self/fdinfo/" + std::to_string(epoll_fd)};
+		std::string line;
+		while(std::getline(fdinfo, line)){
+			int target = -1;
+			unsigned int events = 0;
+			if(std::sscanf(line.c_str(), "tfd: %d events: %x", &target, &events) == 2 && target == fd){
+				return static_cast<uint32_t>(events);
+			}
+		}
+	}
+	return std::nullopt;
+}
+
+SAW_TEST("Io Lazy Interest Registration"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23478};
+
+	auto [accepted, connected] = connectPair(network, wait_scope, address);
+	SAW_EXPECT(accepted->inputFd().has_value(), "Accepted stream has no descriptor");
+	int fd = *accepted->inputFd();
+
+	wait_scope.poll();
+	SAW_EXPECT(!registeredEvents(fd).has_value(), "Stream without waiters was registered");
+
+	// Data arriving ahead of the registration still wakes the reader
+	const char message[] = "ping";
+	SAW_EXPECT(connected->write(message, sizeof(message)).isValue(), "Couldn't write");
+	wait_scope.wait(std::chrono::milliseconds{5});
+
+	bool read_ready = false;
+	auto read_sink = accepted->readReady().then([&](){
+		read_ready = true;
+	}).sink();
+	for(size_t i = 0; i < 100 && !read_ready; ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(read_ready, "Reader wasn't woken up for pending data");
+
+	Maybe<uint32_t> events = registeredEvents(fd);
+	SAW_EXPECT(events.has_value() && (*events & EPOLLIN), "Read interest wasn't registered");
+	SAW_EXPECT(!(*events & EPOLLOUT), "Write interest was registered without a waiting writer");
+
+	char buffer[sizeof(message)];
+	SAW_EXPECT(accepted->read(buffer, sizeof(buffer)).isValue(), "Couldn't read");
+
+	// Dropping the reader drops the interest before the next wakeup
+	read_sink = SinkConveyor{};
+	for(size_t i = 0; i < 100 && (*registeredEvents(fd) & EPOLLIN); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(!(*registeredEvents(fd) & EPOLLIN), "Read interest outlived its reader");
+}
+
+SAW_TEST("Io Datagram Lazy Interest Registration"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	// The datagram socket takes the lowest free descriptor
+	int fd = ::dup(0);
+	SAW_EXPECT(fd >= 0, "Couldn't probe for a free descriptor");
+	::close(fd);
+
+	StringNetworkAddress address{"127.0.0.1", 23484};
+	Own<Datagram> datagram = aio.io->network().datagram(address);
+	SAW_EXPECT(datagram, "Couldn't bind the datagram");
+
+	wait_scope.poll();
+	SAW_EXPECT(!registeredEvents(fd).has_value(), "Datagram without waiters was registered");
+
+	auto read_sink = datagram->readReady().then([](){}).sink();
+	wait_scope.poll();
+	Maybe<uint32_t> events = registeredEvents(fd);
+	SAW_EXPECT(events.has_value() && (*events & EPOLLIN), "Read interest wasn't registered");
+	SAW_EXPECT(!(*events & EPOLLOUT), "Write interest was registered without a waiting writer");
+
+	read_sink = SinkConveyor{};
+	wait_scope.poll();
+	SAW_EXPECT(!(*registeredEvents(fd) & EPOLLIN), "Read interest outlived its reader");
+}
+
+SAW_TEST("Io Async Stream Write Interest"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23482};
+
+	auto [accepted, connected] = connectPair(network, wait_scope, address);
+	SAW_EXPECT(accepted->outputFd().has_value(), "Accepted stream has no descriptor");
+	int fd = *accepted->outputFd();
+
+	AsyncIoStream stream{std::move(accepted)};
+	size_t written = 0;
+	auto done_sink = stream.writeDone().then([&](size_t n){
+		written += n;
+	}).sink();
+
+	wait_scope.poll();
+	Maybe<uint32_t> events = registeredEvents(fd);
+	SAW_EXPECT(events.has_value() && !(*events & EPOLLOUT), "Idle stream was registered for writing");
+
+	// Larger than the socket buffers, so the write blocks until it's read
+	std::vector<uint8_t> data(16 * 1024 * 1024, 0x5a);
+	stream.write(data.data(), data.size());
+	wait_scope.poll();
+	SAW_EXPECT(written == 0, "Write didn't block");
+	events = registeredEvents(fd);
+	SAW_EXPECT(events.has_value() && (*events & EPOLLOUT), "Blocked write isn't waiting for the stream");
+
+	std::vector<uint8_t> buffer(64 * 1024);
+	size_t received = 0;
+	for(size_t i = 0; i < 10000 && received < data.size(); ++i){
+		ErrorOr<size_t> n = connected->read(buffer.data(), buffer.size());
+		if(n.isValue()){
+			received += n.value();
+		}else{
+			wait_scope.poll();
+		}
+	}
+	for(size_t i = 0; i < 100 && written < data.size(); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(written == data.size(), "Blocked write didn't finish");
+
+	for(size_t i = 0; i < 100 && (*registeredEvents(fd) & EPOLLOUT); ++i){
+		wait_scope.wait(std::chrono::milliseconds{1});
+	}
+	SAW_EXPECT(!(*registeredEvents(fd) & EPOLLOUT), "Write interest outlived the blocked write");
+}
+
+SAW_TEST("Io Quick Ack Stays Enabled"){
+	using namespace saw;
+
+	auto err_or_aio = setupAsyncIo();
+	SAW_EXPECT(!err_or_aio.isError(), "Async Io setup failed");
+	AsyncIoContext& aio = err_or_aio.value();
+	WaitScope wait_scope{aio.event_loop};
+
+	Network& network = aio.io->network();
+	StringNetworkAddress address{"127.0.0.1", 23485};
+
+	SocketOptions options;
+	options.quick_ack = true;
+	auto [accepted, connected] = connectPair(network, wait_scope, address, options);
+	int fd = *connected->outputFd();
+
+	// Answering right after a read makes the kernel leave quick ack mode
+	auto receive = [&](IoStream& stream){
+		char buffer[4];
+		for(size_t i = 0; i < 100; ++i){
+			if(stream.read(buffer, sizeof(buffer)).isValue()){
+				return true;
+			}
+			wait_scope.wait(std::chrono::milliseconds{1});
+		}
+		return false;
+	};
+	for(size_t round = 0; round < 8; ++round){
+		SAW_EXPECT(accepted->write("ping", 4).isValue(), "Couldn't write");
+		SAW_EXPECT(receive(*connected), "Ping didn't arrive");
+		SAW_EXPECT(connected->write("pong", 4).isValue(), "Couldn't write");
+		SAW_EXPECT(receive(*accepted), "Pong didn't arrive");
+	}
+	SAW_EXPECT(accepted->write("ping", 4).isValue(), "Couldn't write");
+	SAW_EXPECT(receive(*connected), "Ping didn't arrive");
+
+	int value = 0;
+	socklen_t length = sizeof(value);
+	SAW_EXPECT(::getsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &value, &length) == 0, "Couldn't query quick ack");
+	SAW_EXPECT(value == 1, "Quick ack wasn't set again after a read");
+}
 }
@@ -4,6 +4,8 @@
 
 #include <iostream>
 
+#include <unistd.h>
+
 namespace {
 namespace schema {
 	using namespace saw::schema;
@@ -175,6 +177,47 @@ SAW_TEST("Struct Decoding"){
 	SAW_EXPECT(foo_string.get() == "foo" && test_uint.get() == 23 && test_name.get() == "test_name", "Values not correctly decoded");
 }
 
+SAW_TEST("Mapped File Decoding"){
+	using namespace saw;
+	const uint8_t buffer_raw[] = {0x20,0,0,0,0,0,0,0,0x17,0,0,0,0x03,0,0,0,0,0,0,0,0x66,0x6f,0x6f,0x09,0,0,0,0,0,0,0,0x74,0x65,0x73,0x74,0x5f,0x6e,0x61,0x6d,0x65};
+
+	std::string path = "/tmp/forstio_mapped_" + std::to_string(::getpid());
+	{
+		MappedFileOptions options;
+		options.capacity = 4096;
+		auto err_or_file = mapFile(path, MappedFileMode::ReadWrite, options);
+		SAW_EXPECT(err_or_file.isValue(), "Couldn't map the file for writing");
+		MappedFileBuffer& file = *err_or_file.value();
+
+		SAW_EXPECT(file.readCompositeLength() == 0 && file.writeCompositeLength() == 4096, "New file isn't empty");
+		Error error = file.push(*buffer_raw, sizeof(buffer_raw));
+		SAW_EXPECT(!error.failed(), error.message());
+		SAW_EXPECT(!file.sync().failed(), "Couldn't sync the file");
+	}
+
+	MappedFileOptions options;
+	options.will_need = true;
+	options.populate = true;
+	auto err_or_file = mapFile(path, MappedFileMode::ReadOnly, options);
+	::unlink(path.c_str());
+	SAW_EXPECT(err_or_file.isValue(), "Couldn't map the file");
+	MappedFileBuffer& file = *err_or_file.value();
+	SAW_EXPECT(file.readCompositeLength() == sizeof(buffer_raw), "File wasn't cut to the written length");
+	SAW_EXPECT(file.writeCompositeLength() == 0, "Read-only mapping is writable");
+
+	ProtoKelCodec codec;
+
+	auto root = heapMessageRoot<TestStruct>();
+	auto builder = root.build();
+
+	Error error = codec.decode<TestStruct>(builder, file);
+	auto reader = builder.asReader();
+
+	SAW_EXPECT(!error.failed(), error.message());
+	SAW_EXPECT(reader.get<"test_string">().get() == "foo" && reader.get<"test_uint">().get() == 23 && reader.get<"test_name">().get() == "test_name", "Values not correctly decoded");
+	SAW_EXPECT(file.readCompositeLength() == 0, "Decoding didn't consume the file");
+}
+
 SAW_TEST("Union Decoding"){
 	using namespace saw;
 	const uint8_t buffer_raw[] = {0x0f,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,0x00,0x00,0x00,0x03,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x66,0x6f,0x6f};